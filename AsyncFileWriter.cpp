@@ -0,0 +1,350 @@
+#include "AsyncFileWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// O_DIRECT で書けるのは、位置と長さとバッファがこの境界に揃っているときだけ
+const size_t DIRECT_IO_ALIGN = 4096;
+
+uint8_t *alloc_block(size_t size)
+{
+#ifdef _WIN32
+	return (uint8_t *)_aligned_malloc(size, DIRECT_IO_ALIGN);
+#else
+	void *p = nullptr;
+	return posix_memalign(&p, DIRECT_IO_ALIGN, size) == 0 ? (uint8_t *)p : nullptr;
+#endif
+}
+
+void free_block(uint8_t *p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+} // namespace
+
+struct AsyncFileWriter::Private {
+	Option opt;
+#ifdef _WIN32
+	FILE *fp = nullptr;
+#else
+	int fd = -1;
+	int direct_fd = -1; // O_DIRECT で開いたもの。揃っていない書き込みは fd で書く
+#endif
+
+	struct Block {
+		uint8_t *data = nullptr;
+		size_t size = 0;
+		int64_t offset = 0;
+	};
+	std::vector<uint8_t *> blocks; // 確保したすべてのブロック
+	std::vector<uint8_t *> free_blocks;
+	std::deque<Block> pending_blocks; // 書き込みを待つブロック
+	Block current; // 呼び出し側が埋めているブロック
+
+	int64_t position = 0; // 次に書く位置
+	int64_t size = 0; // 書き込みに回したブロックまでのファイルの大きさ
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread thread;
+	bool closing = false;
+	std::atomic<int> error = 0;
+
+	std::chrono::steady_clock::time_point opened;
+	std::chrono::steady_clock::time_point closed;
+	std::atomic<uint64_t> bytes = 0;
+	std::atomic<uint64_t> stalls = 0;
+	std::atomic<uint64_t> max_write_nanoseconds = 0;
+
+	// 埋めているブロックも含めたファイルの大きさ。size() と SEEK_END の両方で使う。mutex を持って呼ぶ
+	int64_t end() const
+	{
+		return std::max(size, current.offset + (int64_t)current.size);
+	}
+};
+
+AsyncFileWriter::AsyncFileWriter()
+	: m(new Private)
+{
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	close();
+	delete m;
+}
+
+bool AsyncFileWriter::open(std::string const &path, Option const &opt)
+{
+	close();
+
+	m->opt = opt;
+	m->opt.block_size = std::max(DIRECT_IO_ALIGN, opt.block_size / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN);
+	m->opt.blocks = std::max(2, opt.blocks);
+	m->error = 0;
+	m->closing = false;
+	m->position = 0;
+	m->size = 0;
+	m->current = {};
+	m->bytes = 0;
+	m->stalls = 0;
+	m->max_write_nanoseconds = 0;
+
+#ifdef _WIN32
+	m->fp = fopen(path.c_str(), "wb");
+	if (!m->fp) {
+		m->error = errno;
+		return false;
+	}
+#else
+	m->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m->fd < 0) {
+		m->error = errno;
+		return false;
+	}
+#ifdef __linux__
+	if (m->opt.direct_io) {
+		m->direct_fd = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+		if (m->direct_fd < 0) {
+			fprintf(stderr, "O_DIRECT is not available for %s\n", path.c_str());
+		}
+	}
+	if (m->opt.preallocate > 0) {
+		// 大きさは変えずに領域だけ確保する。対応しないファイルシステムでは何もしない
+		fallocate(m->fd, FALLOC_FL_KEEP_SIZE, 0, m->opt.preallocate);
+	}
+#endif
+#endif
+
+	for (int i = 0; i < m->opt.blocks; i++) {
+		uint8_t *p = alloc_block(m->opt.block_size);
+		if (!p) break;
+		m->blocks.push_back(p);
+		m->free_blocks.push_back(p);
+	}
+	if (m->blocks.empty()) {
+		m->error = ENOMEM;
+		close();
+		return false;
+	}
+
+	m->opened = std::chrono::steady_clock::now();
+	m->thread = std::thread([&](){
+		run();
+	});
+	return true;
+}
+
+// 残りを書き込んでから閉じる
+bool AsyncFileWriter::close()
+{
+	if (m->thread.joinable()) {
+		{
+			std::lock_guard lock(m->mutex);
+			submit();
+			m->closing = true;
+			m->cond.notify_all();
+		}
+		m->thread.join();
+		m->closed = std::chrono::steady_clock::now();
+	}
+#ifdef _WIN32
+	if (m->fp) {
+		fclose(m->fp);
+		m->fp = nullptr;
+	}
+#else
+	if (m->direct_fd >= 0) {
+		::close(m->direct_fd);
+		m->direct_fd = -1;
+	}
+	if (m->fd >= 0) {
+		::close(m->fd);
+		m->fd = -1;
+	}
+#endif
+	for (uint8_t *p : m->blocks) {
+		free_block(p);
+	}
+	m->blocks.clear();
+	m->free_blocks.clear();
+	m->current = {};
+	return m->error == 0;
+}
+
+bool AsyncFileWriter::isOpen() const
+{
+	return m->thread.joinable();
+}
+
+// 埋めているブロックを書き込みに回す。mutex を持って呼ぶ
+void AsyncFileWriter::submit()
+{
+	if (!m->current.data) return;
+	if (m->current.size > 0) {
+		m->size = std::max(m->size, m->current.offset + (int64_t)m->current.size);
+		m->pending_blocks.push_back(m->current);
+		m->cond.notify_all();
+	} else {
+		m->free_blocks.push_back(m->current.data);
+	}
+	m->current = {};
+}
+
+bool AsyncFileWriter::write(void const *data, size_t size)
+{
+	uint8_t const *src = (uint8_t const *)data;
+	std::unique_lock lock(m->mutex);
+	while (size > 0 && m->error == 0) {
+		if (!m->current.data) {
+			if (m->free_blocks.empty()) {
+				m->stalls++;
+				while (m->free_blocks.empty() && m->error == 0) {
+					m->cond.wait(lock);
+				}
+				if (m->error != 0) break;
+			}
+			m->current.data = m->free_blocks.back();
+			m->free_blocks.pop_back();
+			m->current.size = 0;
+			m->current.offset = m->position;
+		}
+		const size_t n = std::min(size, m->opt.block_size - m->current.size);
+		memcpy(m->current.data + m->current.size, src, n);
+		m->current.size += n;
+		m->position += n;
+		src += n;
+		size -= n;
+		if (m->current.size == m->opt.block_size) {
+			submit();
+		}
+	}
+	return m->error == 0;
+}
+
+// whence は SEEK_SET, SEEK_CUR, SEEK_END。移った位置を返す
+int64_t AsyncFileWriter::seek(int64_t offset, int whence)
+{
+	std::lock_guard lock(m->mutex);
+	int64_t pos = offset;
+	if (whence == SEEK_CUR) {
+		pos += m->position;
+	} else if (whence == SEEK_END) {
+		pos += m->end();
+	}
+	if (pos < 0) return -1;
+	// 続きでなければ、埋めているブロックはここまでで書き込む。同じ場所への書き込みは順に処理されるので待たない
+	if (m->current.data && pos != m->current.offset + (int64_t)m->current.size) {
+		submit();
+	}
+	m->position = pos;
+	return pos;
+}
+
+int64_t AsyncFileWriter::size() const
+{
+	std::lock_guard lock(m->mutex);
+	return m->end();
+}
+
+int AsyncFileWriter::error() const
+{
+	return m->error;
+}
+
+AsyncFileWriter::Stats AsyncFileWriter::stats() const
+{
+	Stats t;
+	t.bytes = m->bytes;
+	const auto end = isOpen() ? std::chrono::steady_clock::now() : m->closed;
+	const double sec = std::chrono::duration<double>(end - m->opened).count();
+	t.mbps = sec > 0 ? t.bytes / (1024.0 * 1024.0) / sec : 0;
+	{
+		std::lock_guard lock(m->mutex);
+		t.pending_blocks = m->pending_blocks.size();
+	}
+	t.stalls = m->stalls;
+	t.max_write_ms = m->max_write_nanoseconds / 1000000.0;
+	return t;
+}
+
+// 書き込むスレッド。ブロックを順に書き、空いたブロックを返す
+void AsyncFileWriter::run()
+{
+	while (1) {
+		Private::Block b;
+		{
+			std::unique_lock lock(m->mutex);
+			while (!m->closing && m->pending_blocks.empty()) {
+				m->cond.wait(lock);
+			}
+			if (m->pending_blocks.empty()) break;
+			b = m->pending_blocks.front();
+			m->pending_blocks.pop_front();
+		}
+
+		auto t0 = std::chrono::steady_clock::now();
+		int err = 0;
+		if (m->error == 0) {
+#ifdef _WIN32
+			if (_fseeki64(m->fp, b.offset, SEEK_SET) != 0 || fwrite(b.data, 1, b.size, m->fp) != b.size) {
+				err = errno ? errno : EIO;
+			}
+#else
+			int fd = m->fd;
+			if (m->direct_fd >= 0 && b.offset % DIRECT_IO_ALIGN == 0 && b.size % DIRECT_IO_ALIGN == 0) {
+				fd = m->direct_fd;
+			}
+			size_t done = 0;
+			while (done < b.size) {
+				ssize_t n = pwrite(fd, b.data + done, b.size - done, b.offset + done);
+				if (n < 0) {
+					if (errno == EINTR) continue;
+					err = errno;
+					break;
+				}
+				done += n;
+			}
+#endif
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+		if (ns > m->max_write_nanoseconds) {
+			m->max_write_nanoseconds = ns;
+		}
+
+		std::lock_guard lock(m->mutex);
+		if (err != 0 && m->error == 0) {
+			fprintf(stderr, "write failed: %s\n", strerror(err));
+			m->error = err;
+		}
+		if (err == 0) {
+			m->bytes += b.size;
+		}
+		m->free_blocks.push_back(b.data);
+		m->cond.notify_all();
+	}
+}
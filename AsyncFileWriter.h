@@ -0,0 +1,46 @@
+#ifndef ASYNCFILEWRITER_H
+#define ASYNCFILEWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 書き込むデータを大きなブロックにまとめ、別のスレッドでファイルに書き込む
+// 書き込みが滞っても、すべてのブロックが埋まるまで呼び出し側は待たない
+class AsyncFileWriter {
+public:
+	struct Option {
+		size_t block_size = 4 * 1024 * 1024; // 4096 の倍数
+		int blocks = 16;
+		bool direct_io = false; // Linux では O_DIRECT でも開き、ブロック単位の書き込みはページキャッシュを通さない
+		int64_t preallocate = 0; // あらかじめ確保しておくバイト数（Linux の fallocate）
+	};
+	struct Stats {
+		uint64_t bytes = 0; // 書き込んだバイト数
+		double mbps = 0; // 開いてからの平均 (MiB/s)
+		size_t pending_blocks = 0; // 書き込みを待つブロック
+		uint64_t stalls = 0; // 空きブロックがなくて待った回数
+		double max_write_ms = 0; // 1ブロックの書き込みにかかった最大の時間
+	};
+private:
+	struct Private;
+	Private *m;
+
+	void submit();
+	void run();
+public:
+	AsyncFileWriter();
+	~AsyncFileWriter();
+	AsyncFileWriter(AsyncFileWriter const &) = delete;
+	void operator = (AsyncFileWriter const &) = delete;
+	bool open(std::string const &path, Option const &opt);
+	bool close();
+	bool isOpen() const;
+	bool write(void const *data, size_t size);
+	int64_t seek(int64_t offset, int whence);
+	int64_t size() const;
+	int error() const;
+	Stats stats() const;
+};
+
+#endif // ASYNCFILEWRITER_H
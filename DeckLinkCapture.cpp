@@ -1,7 +1,10 @@
 #include "DeckLinkCapture.h"
 #include "DeckLinkDeviceDiscovery.h"
+#include "ImageKernels.h"
 #include "ProfileCallback.h"
+#include "WrappedFrame.h"
 #include "common.h"
+#include <atomic>
 
 static inline uint8_t clamp_uint8(int v)
 {
@@ -11,7 +14,7 @@ static inline uint8_t clamp_uint8(int v)
 struct DeckLinkCapture::Private {
 	DeckLinkCaptureDelegate *mainwindow = nullptr;
 	BMDPixelFormat pixel_format = bmdFormat8BitYUV;
-	BMDFieldDominance field_dominance = bmdUnknownFieldDominance;
+	std::atomic<BMDFieldDominance> field_dominance = bmdUnknownFieldDominance;
 };
 
 DeckLinkCapture::DeckLinkCapture(DeckLinkCaptureDelegate *mainwindow)
@@ -40,6 +43,16 @@ void DeckLinkCapture::setPixelFormat(BMDPixelFormat pixel_format)
 	m->pixel_format = pixel_format;
 }
 
+BMDFieldDominance DeckLinkCapture::fieldDominance() const
+{
+	return m->field_dominance;
+}
+
+void DeckLinkCapture::setFieldDominance(BMDFieldDominance field_dominance)
+{
+	m->field_dominance = field_dominance;
+}
+
 void DeckLinkCapture::addDevice(IDeckLink *decklink)
 {
 	Q_ASSERT(m->mainwindow);
@@ -107,112 +120,117 @@ void DeckLinkCapture::customEvent(QEvent *event)
 	}
 }
 
+namespace {
+
+// 10ビットRGB (ビッグエンディアン/リトルエンディアンの32ビット語) を8ビットRGBへ
+template <bool LE, int R, int G, int B> void unpack_10bit_rgb_row(uint8_t const *src, uint8_t *dst, int w)
+{
+	for (int x = 0; x < w; x++) {
+		uint32_t t = LE ? ((src[3] << 24) | (src[2] << 16) | (src[1] << 8) | src[0])
+						: ((src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3]);
+		dst[0] = t >> R;
+		dst[1] = t >> G;
+		dst[2] = t >> B;
+		src += 4;
+		dst += 3;
+	}
+}
+
+// 8ビット4チャネルから指定位置のRGBを取り出す
+template <int R, int G, int B> void unpack_8bit_rgb_row(uint8_t const *src, uint8_t *dst, int w)
+{
+	for (int x = 0; x < w; x++) {
+		dst[0] = src[R];
+		dst[1] = src[G];
+		dst[2] = src[B];
+		src += 4;
+		dst += 3;
+	}
+}
+
+void copy_row_uyvy(uint8_t const *src, uint8_t *dst, int w)
+{
+	memcpy(dst, src, w * 2);
+}
+
+Image convert_rows(int w, int h, Image::Format format, uint8_t const *data, int src_bytes_per_line, void (*row)(uint8_t const *src, uint8_t *dst, int w))
+{
+	Image image(w, h, format);
+	uint8_t *dst = image.bits();
+	const int dst_bytes_per_line = image.bytesPerLine();
+	ImageKernels::parallelRows(h, src_bytes_per_line + w * image.bytesPerPixel(), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++) {
+			row(data + src_bytes_per_line * y, dst + dst_bytes_per_line * y, w);
+		}
+	});
+	return image;
+}
+
+} // namespace
+
 Image DeckLinkCapture::createImage(int w, int h, BMDPixelFormat pixel_format, uint8_t const *data, int size)
 {
 	switch (pixel_format) {
 	case bmdFormat10BitRGB:
 		if (w * h * 4 == size) {
-			Image image(w, h, Image::Format::RGB8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + 4 * w * y;
-				uint8_t *dst = image.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					uint32_t t = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3];
-					dst[0] = t >> 22;
-					dst[1] = t >> 12;
-					dst[2] = t >> 2;
-					src += 4;
-					dst += 3;
-				}
-			}
-			return image;
+			return convert_rows(w, h, Image::Format::RGB8, data, w * 4, unpack_10bit_rgb_row<false, 22, 12, 2>);
 		}
 		break;
 	case bmdFormat10BitRGBX:
 		if (w * h * 4 == size) {
-			Image image(w, h, Image::Format::RGB8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + 4 * w * y;
-				uint8_t *dst = image.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					uint32_t t = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3];
-					dst[0] = t >> 24;
-					dst[1] = t >> 14;
-					dst[2] = t >> 4;
-					src += 4;
-					dst += 3;
-				}
-			}
-			return image;
+			return convert_rows(w, h, Image::Format::RGB8, data, w * 4, unpack_10bit_rgb_row<false, 24, 14, 4>);
 		}
 		break;
 	case bmdFormat10BitRGBXLE:
 		if (w * h * 4 == size) {
-			Image image(w, h, Image::Format::RGB8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + 4 * w * y;
-				uint8_t *dst = image.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					uint32_t t = (src[3] << 24) | (src[2] << 16) | (src[1] << 8) | src[0];
-					dst[0] = t >> 24;
-					dst[1] = t >> 14;
-					dst[2] = t >> 4;
-					src += 4;
-					dst += 3;
-				}
-			}
-			return image;
+			return convert_rows(w, h, Image::Format::RGB8, data, w * 4, unpack_10bit_rgb_row<true, 24, 14, 4>);
 		}
 		break;
 	case bmdFormat8BitBGRA:
 		if (w * h * 4 == size) {
-			Image image(w, h, Image::Format::RGB8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + 4 * w * y;
-				uint8_t *dst = image.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					dst[0] = src[2];
-					dst[1] = src[1];
-					dst[2] = src[0];
-					src += 4;
-					dst += 3;
-				}
-			}
-			return image;
+			return convert_rows(w, h, Image::Format::RGB8, data, w * 4, unpack_8bit_rgb_row<2, 1, 0>);
 		}
 		break;
 	case bmdFormat8BitARGB:
 		if (w * h * 4 == size) {
-			Image image(w, h, Image::Format::RGB8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + 4 * w * y;
-				uint8_t *dst = image.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					dst[0] = src[1];
-					dst[1] = src[2];
-					dst[2] = src[3];
-					src += 4;
-					dst += 3;
-				}
-			}
-			return image;
+			return convert_rows(w, h, Image::Format::RGB8, data, w * 4, unpack_8bit_rgb_row<1, 2, 3>);
 		}
 		break;
 	case bmdFormat8BitYUV:
 		if (w * h * 2 == size) {
-			Image image(w, h, Image::Format::UYVY8);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *src = data + w * y * 2;
-				uint8_t *dst = image.scanLine(y);
-				memcpy(dst, src, image.bytesPerLine());
+			return convert_rows(w, h, Image::Format::UYVY8, data, w * 2, copy_row_uyvy);
+		}
+		break;
+	case bmdFormat10BitYUV:
+		{
+			const int bytes_per_line = (w + 47) / 48 * 128; // v210 の行は48画素(128バイト)単位
+			if (bytes_per_line * h == size) {
+				return convert_rows(w, h, Image::Format::YUYV16, data, bytes_per_line, ImageKernels::table()->v210_to_yuyv16);
 			}
-			return image;
 		}
 		break;
 	}
 	return {};
 }
 
+Image DeckLinkCapture::createImage(IDeckLinkVideoInputFrame *frame)
+{
+	const int w = frame->GetWidth();
+	const int h = frame->GetHeight();
+	const int stride = frame->GetRowBytes();
+	const BMDPixelFormat pixel_format = frame->GetPixelFormat();
+	uint8_t *bytes = nullptr;
+	if (w < 1 || h < 1 || frame->GetBytes((void **)&bytes) != S_OK || !bytes) return {};
+
+	if (pixel_format == bmdFormat8BitYUV && stride >= w * 2) {
+		// コピーせずにフレームバッファを参照する。Imageが解放されるまでフレームを保持
+		Image image = WrappedFrame<IDeckLinkVideoInputFrame>::wrap(frame, w, h, Image::Format::UYVY8, stride, bytes);
+		if (image) return image;
+	}
+
+	return createImage(w, h, pixel_format, bytes, stride * h);
+}
+
 bool DeckLinkCapture::startCapture(DeckLinkInputDevice *selectedDevice, BMDDisplayMode displayMode, BMDFieldDominance fieldDominance, bool applyDetectedInputMode, bool input_audio)
 {
 	if (selectedDevice) {
@@ -46,6 +46,7 @@ private:
 	Private *m;
 
 	static Image createImage(int w, int h, BMDPixelFormat pixel_format, uint8_t const *data, int size);
+	static Image createImage(IDeckLinkVideoInputFrame *frame);
 
 	DeckLinkCaptureDelegate *delegate();
 
@@ -60,6 +61,8 @@ private:
 
 //	BMDPixelFormat pixelFormat() const;
 	void setPixelFormat(BMDPixelFormat pixel_format);
+	BMDFieldDominance fieldDominance() const;
+	void setFieldDominance(BMDFieldDominance field_dominance);
 protected:
 	void customEvent(QEvent *event) override;
 
@@ -87,9 +87,11 @@ SOURCES += \
 	DeckLinkInputDevice.cpp \
 	Deinterlace.cpp \
 	FrameProcessThread.cpp \
+	FramePool.cpp \
 	FrameRateCounter.cpp \
 	GlobalData.cpp \
 	Image.cpp \
+	ImageKernels.cpp \
 	ImageUtil.cpp \
 	ImageWidget.cpp \
 	MainWindow.cpp \
@@ -113,9 +115,12 @@ HEADERS += \
 	DeckLinkInputDevice.h \
 	Deinterlace.h \
 	FrameProcessThread.h \
+	FramePool.h \
 	FrameRateCounter.h \
+	FrameRing.h \
 	GlobalData.h \
 	Image.h \
+	ImageKernels.h \
 	ImageUtil.h \
 	ImageWidget.h \
 	MainWindow.h \
@@ -129,6 +134,7 @@ HEADERS += \
 	UIWidget.h \
 	VideoEncoderOption.h \
 	VideoFrameData.h \
+	WrappedFrame.h \
 	common.h \
 	joinpath.h \
 	main.h
@@ -143,8 +149,8 @@ RESOURCES += \
 	resources.qrc
 
 use_ffmpeg {
-	SOURCES += FFmpegVideoEncoder.cpp
-	HEADERS += FFmpegVideoEncoder.h includeffmpeg.h
+	SOURCES += AsyncFileWriter.cpp FFmpegVideoEncoder.cpp
+	HEADERS += AsyncFileWriter.h FFmpegVideoEncoder.h includeffmpeg.h
 }
 
 # DISTFILES += \
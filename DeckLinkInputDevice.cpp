@@ -35,6 +35,13 @@
 #include "common.h"
 #include <omp.h>
 
+namespace {
+
+// フレームと音声の時刻の単位。一般的なフレームの長さ (1001/60000 秒など) と音声の1サンプル (1/48000 秒) を整数で表せる
+const BMDTimeScale STREAM_TIME_SCALE = 240000;
+
+}
+
 struct DeckLinkInputDevice::Private {
 	QAtomicInt refcount = 1;
 
@@ -326,8 +333,14 @@ HRESULT DeckLinkInputDevice::VideoInputFormatChanged(BMDVideoInputFormatChangedE
 	if (detectedSignalFlags & bmdDetectedVideoInputRGB444) {
 		pixel_format = bmdFormat10BitRGB;
 	}
+#ifndef Q_OS_WIN // Windows版SDKにはビット深度の検出フラグがない
+	else if (detectedSignalFlags & (bmdDetectedVideoInput10BitDepth | bmdDetectedVideoInput12BitDepth)) {
+		pixel_format = bmdFormat10BitYUV;
+	}
+#endif
 
 	m->capture->setPixelFormat(pixel_format);
+	m->capture->setFieldDominance(newMode->GetFieldDominance());
 
 	// Stop the capture
 	m->decklink_input->StopStreams();
@@ -376,7 +389,20 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(IDeckLinkVideoInputFrame *vi
 
 		getHDRMetadataFromFrame(videoFrame, &t.d->hdr_metadata);
 
+		BMDTimeValue time = 0;
+		BMDTimeValue duration = 0;
+		if (videoFrame->GetStreamTime(&time, &duration, STREAM_TIME_SCALE) == S_OK) {
+			t.d->time_scale = STREAM_TIME_SCALE;
+			t.d->stream_time = time;
+			t.d->stream_duration = duration;
+			t.d->audio_time = time;
+		}
+
 		if (audioPacket) {
+			BMDTimeValue packet_time = 0;
+			if (t.d->time_scale > 0 && audioPacket->GetPacketTime(&packet_time, STREAM_TIME_SCALE) == S_OK) {
+				t.d->audio_time = packet_time;
+			}
 			const int channels = 2;
 			const int frames = audioPacket->GetSampleFrameCount();
 			const int bytes = frames * sizeof(int16_t) * channels;
@@ -389,13 +415,8 @@ HRESULT DeckLinkInputDevice::VideoInputFrameArrived(IDeckLinkVideoInputFrame *vi
 
 		if (videoFrame) {
 			t.d->pixfmt = videoFrame->GetPixelFormat();
-			int w = videoFrame->GetWidth();
-			int h = videoFrame->GetHeight();
-			int stride = videoFrame->GetRowBytes();
-			uint8_t const *bytes = nullptr;
-			if (w > 0 && h > 0 && videoFrame->GetBytes((void **)&bytes) == S_OK && bytes) {
-				t.d->image = DeckLinkCapture::createImage(w, h, t.d->pixfmt, bytes, stride * h);
-			}
+			t.d->field_dominance = m->capture->fieldDominance();
+			t.d->image = DeckLinkCapture::createImage(videoFrame);
 		}
 
 		emit m->capture->newFrame(t);
@@ -1,10 +1,15 @@
 #include "Deinterlace.h"
+#include "ImageKernels.h"
 #include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <omp.h>
 #include <string.h>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -13,32 +18,130 @@
 #include <alloca.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
 namespace {
 
-inline int diff(int a, int b)
+
+// 画素の型ごとのスコアの型。10ビットの差の二乗和は16ビットに収まらない
+// 差の二乗は画素値と比較されるので、10ビットでは値の比率(4倍)に合わせて縮める
+template <typename T> struct Score;
+template <> struct Score<uint8_t> { typedef uint16_t type; static const int shift = 0; };
+template <> struct Score<uint16_t> { typedef uint32_t type; static const int shift = 2; };
+
+template <typename T> inline int diff(int a, int b)
 {
 	int d = a - b;
-	return d * d;
+	return (d * d) >> Score<T>::shift;
+}
+
+// 位置 x で上下の行を shift だけ斜めにずらしたときの差の3画素分の和。x == 2 のときは左の1画素を含まない
+template <typename T> inline typename Score<T>::type calc_score(T const *curr, int stride, int x, int shift)
+{
+	typedef typename Score<T>::type S;
+	T const *a = curr - stride + shift;
+	T const *b = curr + stride - shift;
+	S score = diff<T>(a[x], b[x]);
+	score += diff<T>(a[x + 1], b[x + 1]);
+	if (x > 2) {
+		score += diff<T>(a[x - 1], b[x - 1]);
+	}
+	return score;
+}
+
+// 最もスコアの小さい方向で補間し、multiframe のときは前後のフレームの値で制限する
+template <typename T> inline int interpolate(int x, int stride, const T *prev, const T *curr, const T *next, T const *prevframe, T const *nextframe, bool multiframe, typename Score<T>::type scoreN2, typename Score<T>::type scoreN1, typename Score<T>::type score_0, typename Score<T>::type scoreP1, typename Score<T>::type scoreP2)
+{
+	typedef typename Score<T>::type S;
+	const int stride2 = stride * 2;
+
+	S score = score_0;
+	int shift = 0;
+	if (score > scoreN1 || score > scoreP1) {
+		if (scoreN1 < scoreP1) {
+			score = scoreN1;
+			shift = -1;
+		} else {
+			score = scoreP1;
+			shift = +1;
+		}
+	}
+	if (score > scoreN2 || score > scoreP2) {
+		if (scoreN2 < scoreP2) {
+			score = scoreN2;
+			shift = -2;
+		} else {
+			score = scoreP2;
+			shift = +2;
+		}
+	}
+
+	int value = (curr[x - stride + shift] + curr[x + stride - shift]) / 2;
+
+	if (multiframe) {
+		const int a = curr[x - stride];
+		const int b = curr[x + stride];
+		const int c = diff<T>(prev[x], next[x]) / 2;
+		const int d = diff<T>(prev[x - stride], a) + diff<T>(prev[x + stride], b) / 2;
+		const int e = diff<T>(next[x - stride], a) + diff<T>(next[x + stride], b) / 2;
+		const int f = (prevframe[x] + nextframe[x]) / 2;
+		int g = (prevframe[x - stride2] + nextframe[x - stride2]) / 2 - a;
+		int h = (prevframe[x + stride2] + nextframe[x + stride2]) / 2 - b;
+		if (g > h) { std::swap(g, h); }
+		const int i = +std::min(std::min(f - b, f - a), g);
+		const int j = -std::max(std::max(f - b, f - a), h);
+		const int k = std::max(std::max(c, std::max(d, e)), std::max(i, j));
+		const int min = f - k;
+		const int max = f + k;
+		value = std::min(std::max(value, min), max);
+	}
+
+	return value;
 }
 
-void process_row(int w, int stride, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, uint8_t *dst, bool multiframe, bool alternateframe)
+template <typename T> void interpolate_range(int x0, int x1, int stride, const T *prev, const T *curr, const T *next, T *dst, bool multiframe, bool alternateframe)
 {
-	uint16_t *tmpbuf = (uint16_t *)alloca(sizeof(uint16_t) * w * 5);
-	uint16_t *scoreN2 = tmpbuf + w * 0; // -2
-	uint16_t *scoreN1 = tmpbuf + w * 1; // -1
-	uint16_t *score_0 = tmpbuf + w * 2; //  0
-	uint16_t *scoreP1 = tmpbuf + w * 3; // +1
-	uint16_t *scoreP2 = tmpbuf + w * 4; // +2
+	T const *prevframe = !alternateframe ? prev : curr;
+	T const *nextframe = !alternateframe ? curr : next;
+	for (int x = x0; x < x1; x++) {
+		dst[x] = interpolate(x, stride, prev, curr, next, prevframe, nextframe, multiframe,
+							 calc_score(curr, stride, x, -2),
+							 calc_score(curr, stride, x, -1),
+							 calc_score(curr, stride, x,  0),
+							 calc_score(curr, stride, x, +1),
+							 calc_score(curr, stride, x, +2));
+	}
+}
 
-	auto CalcScore = [&](uint16_t *score, int shift){
-		uint8_t const *a = curr + 2 - stride + shift;
-		uint8_t const *b = curr + 2 + stride - shift;
-		uint16_t u = 0;
-		uint16_t v = diff(a[0], b[0]);
+template <typename T> void process_row(int w, int stride, const T *prev, const T *curr, const T *next, T *dst, bool multiframe, bool alternateframe)
+{
+	typedef typename Score<T>::type S;
+	S *tmpbuf = (S *)alloca(sizeof(S) * w * 5);
+	S *scoreN2 = tmpbuf + w * 0; // -2
+	S *scoreN1 = tmpbuf + w * 1; // -1
+	S *score_0 = tmpbuf + w * 2; //  0
+	S *scoreP1 = tmpbuf + w * 3; // +1
+	S *scoreP2 = tmpbuf + w * 4; // +2
+
+	auto CalcScore = [&](S *score, int shift){
+		T const *a = curr + 2 - stride + shift;
+		T const *b = curr + 2 + stride - shift;
+		S u = 0;
+		S v = diff<T>(a[0], b[0]);
 		for (int x = 0; x < w - 4; x++) {
-			uint16_t t = u;
+			S t = u;
 			u = v;
-			v = diff(a[x + 1], b[x + 1]);
+			v = diff<T>(a[x + 1], b[x + 1]);
 			score[x + 2] = t + u + v;
 		}
 	};
@@ -48,74 +151,589 @@ void process_row(int w, int stride, const uint8_t *prev, const uint8_t *curr, co
 	CalcScore(scoreP1, +1);
 	CalcScore(scoreP2, +2);
 
-	const int stride2 = stride * 2;
+	T const *prevframe = !alternateframe ? prev : curr;
+	T const *nextframe = !alternateframe ? curr : next;
+
+	for (int x = 2; x < w - 2; x++) {
+		dst[x] = interpolate(x, stride, prev, curr, next, prevframe, nextframe, multiframe, scoreN2[x], scoreN1[x], score_0[x], scoreP1[x], scoreP2[x]);
+	}
+	dst[0] = dst[1] = dst[2];
+	dst[w - 2] = dst[w - 1] = dst[w - 3];
+}
+
+// 8ビットの SIMD 版。スカラー版と同じ結果になる
+// 16ビットの要素で計算する。差の二乗の和はスカラー版と同じく16ビットで桁あふれさせる
+// multiframe の制限幅 k は 255 以上なら制限しないのと同じなので、255 で飽和させて符号付き16ビットで扱う
+
+#ifdef USE_X86_SIMD
+
+// SSSE3 8画素単位
+
+TARGET_SSSE3 inline __m128i load8_ssse3(uint8_t const *p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const *)p), _mm_setzero_si128());
+}
 
+TARGET_SSSE3 inline __m128i sq_ssse3(__m128i a, __m128i b)
+{
+	__m128i d = _mm_sub_epi16(a, b);
+	return _mm_mullo_epi16(d, d);
+}
+
+TARGET_SSSE3 inline __m128i gt_u16_ssse3(__m128i a, __m128i b)
+{
+	const __m128i bias = _mm_set1_epi16(-0x8000);
+	return _mm_cmpgt_epi16(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+}
+
+TARGET_SSSE3 inline __m128i select_ssse3(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+TARGET_SSSE3 inline __m128i min255_ssse3(__m128i x)
+{
+	return _mm_sub_epi16(x, _mm_subs_epu16(x, _mm_set1_epi16(255)));
+}
+
+TARGET_SSSE3 inline __m128i score_ssse3(uint8_t const *up, uint8_t const *dn, int x, int shift)
+{
+	__m128i s = sq_ssse3(load8_ssse3(up + x - 1 + shift), load8_ssse3(dn + x - 1 - shift));
+	s = _mm_add_epi16(s, sq_ssse3(load8_ssse3(up + x + shift), load8_ssse3(dn + x - shift)));
+	return _mm_add_epi16(s, sq_ssse3(load8_ssse3(up + x + 1 + shift), load8_ssse3(dn + x + 1 - shift)));
+}
+
+TARGET_SSSE3 inline __m128i candidate_ssse3(uint8_t const *up, uint8_t const *dn, int x, int shift)
+{
+	return _mm_srli_epi16(_mm_add_epi16(load8_ssse3(up + x + shift), load8_ssse3(dn + x - shift)), 1);
+}
+
+TARGET_SSSE3 void process_row_ssse3(int w, int stride, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, uint8_t *dst, bool multiframe, bool alternateframe)
+{
+	const int stride2 = stride * 2;
+	uint8_t const *up = curr - stride;
+	uint8_t const *dn = curr + stride;
 	uint8_t const *prevframe = !alternateframe ? prev : curr;
 	uint8_t const *nextframe = !alternateframe ? curr : next;
 
-	for (int x = 2; x < w - 2; x++) {
+	interpolate_range(2, 3, stride, prev, curr, next, dst, multiframe, alternateframe);
+	int x = 3;
+	for (; x + 8 <= w - 2; x += 8) {
+		__m128i sN2 = score_ssse3(up, dn, x, -2);
+		__m128i sN1 = score_ssse3(up, dn, x, -1);
+		__m128i s_0 = score_ssse3(up, dn, x,  0);
+		__m128i sP1 = score_ssse3(up, dn, x, +1);
+		__m128i sP2 = score_ssse3(up, dn, x, +2);
 
-		uint16_t score = score_0[x];
-		int shift = 0;
-		if (score > scoreN1[x] || score > scoreP1[x]) {
-			if (scoreN1[x] < scoreP1[x]) {
-				score = scoreN1[x];
-				shift = -1;
-			} else {
-				score = scoreP1[x];
-				shift = +1;
-			}
+		__m128i lt = gt_u16_ssse3(sP1, sN1);
+		__m128i m = select_ssse3(lt, sN1, sP1);
+		__m128i t = gt_u16_ssse3(s_0, m);
+		__m128i s = select_ssse3(t, m, s_0);
+		__m128i shift = _mm_and_si128(t, select_ssse3(lt, _mm_set1_epi16(-1), _mm_set1_epi16(1)));
+		lt = gt_u16_ssse3(sP2, sN2);
+		m = select_ssse3(lt, sN2, sP2);
+		t = gt_u16_ssse3(s, m);
+		shift = select_ssse3(t, select_ssse3(lt, _mm_set1_epi16(-2), _mm_set1_epi16(2)), shift);
+
+		__m128i value = candidate_ssse3(up, dn, x, 0);
+		value = select_ssse3(_mm_cmpeq_epi16(shift, _mm_set1_epi16(-2)), candidate_ssse3(up, dn, x, -2), value);
+		value = select_ssse3(_mm_cmpeq_epi16(shift, _mm_set1_epi16(-1)), candidate_ssse3(up, dn, x, -1), value);
+		value = select_ssse3(_mm_cmpeq_epi16(shift, _mm_set1_epi16(+1)), candidate_ssse3(up, dn, x, +1), value);
+		value = select_ssse3(_mm_cmpeq_epi16(shift, _mm_set1_epi16(+2)), candidate_ssse3(up, dn, x, +2), value);
+
+		if (multiframe) {
+			const __m128i a = load8_ssse3(up + x);
+			const __m128i b = load8_ssse3(dn + x);
+			__m128i c = _mm_srli_epi16(sq_ssse3(load8_ssse3(prev + x), load8_ssse3(next + x)), 1);
+			__m128i d = _mm_adds_epu16(sq_ssse3(load8_ssse3(prev + x - stride), a), _mm_srli_epi16(sq_ssse3(load8_ssse3(prev + x + stride), b), 1));
+			__m128i e = _mm_adds_epu16(sq_ssse3(load8_ssse3(next + x - stride), a), _mm_srli_epi16(sq_ssse3(load8_ssse3(next + x + stride), b), 1));
+			__m128i f = _mm_srli_epi16(_mm_add_epi16(load8_ssse3(prevframe + x), load8_ssse3(nextframe + x)), 1);
+			__m128i g = _mm_sub_epi16(_mm_srli_epi16(_mm_add_epi16(load8_ssse3(prevframe + x - stride2), load8_ssse3(nextframe + x - stride2)), 1), a);
+			__m128i h = _mm_sub_epi16(_mm_srli_epi16(_mm_add_epi16(load8_ssse3(prevframe + x + stride2), load8_ssse3(nextframe + x + stride2)), 1), b);
+			__m128i fa = _mm_sub_epi16(f, a);
+			__m128i fb = _mm_sub_epi16(f, b);
+			__m128i i = _mm_min_epi16(_mm_min_epi16(fb, fa), _mm_min_epi16(g, h));
+			__m128i j = _mm_sub_epi16(_mm_setzero_si128(), _mm_max_epi16(_mm_max_epi16(fb, fa), _mm_max_epi16(g, h)));
+			__m128i k = _mm_max_epi16(_mm_max_epi16(min255_ssse3(c), _mm_max_epi16(min255_ssse3(d), min255_ssse3(e))), _mm_max_epi16(i, j));
+			value = _mm_min_epi16(_mm_max_epi16(value, _mm_sub_epi16(f, k)), _mm_add_epi16(f, k));
 		}
-		if (score > scoreN2[x] || score > scoreP2[x]) {
-			if (scoreN2[x] < scoreP2[x]) {
-				score = scoreN2[x];
-				shift = -2;
-			} else {
-				score = scoreP2[x];
-				shift = +2;
-			}
+
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(value, value));
+	}
+	interpolate_range(x, w - 2, stride, prev, curr, next, dst, multiframe, alternateframe);
+	dst[0] = dst[1] = dst[2];
+	dst[w - 2] = dst[w - 1] = dst[w - 3];
+}
+
+// AVX2 16画素単位
+
+TARGET_AVX2 inline __m256i load16_avx2(uint8_t const *p)
+{
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)p));
+}
+
+TARGET_AVX2 inline __m256i sq_avx2(__m256i a, __m256i b)
+{
+	__m256i d = _mm256_sub_epi16(a, b);
+	return _mm256_mullo_epi16(d, d);
+}
+
+TARGET_AVX2 inline __m256i gt_u16_avx2(__m256i a, __m256i b)
+{
+	const __m256i bias = _mm256_set1_epi16(-0x8000);
+	return _mm256_cmpgt_epi16(_mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+}
+
+TARGET_AVX2 inline __m256i select_avx2(__m256i mask, __m256i a, __m256i b)
+{
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+TARGET_AVX2 inline __m256i score_avx2(uint8_t const *up, uint8_t const *dn, int x, int shift)
+{
+	__m256i s = sq_avx2(load16_avx2(up + x - 1 + shift), load16_avx2(dn + x - 1 - shift));
+	s = _mm256_add_epi16(s, sq_avx2(load16_avx2(up + x + shift), load16_avx2(dn + x - shift)));
+	return _mm256_add_epi16(s, sq_avx2(load16_avx2(up + x + 1 + shift), load16_avx2(dn + x + 1 - shift)));
+}
+
+TARGET_AVX2 inline __m256i candidate_avx2(uint8_t const *up, uint8_t const *dn, int x, int shift)
+{
+	return _mm256_srli_epi16(_mm256_add_epi16(load16_avx2(up + x + shift), load16_avx2(dn + x - shift)), 1);
+}
+
+TARGET_AVX2 void process_row_avx2(int w, int stride, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, uint8_t *dst, bool multiframe, bool alternateframe)
+{
+	const int stride2 = stride * 2;
+	uint8_t const *up = curr - stride;
+	uint8_t const *dn = curr + stride;
+	uint8_t const *prevframe = !alternateframe ? prev : curr;
+	uint8_t const *nextframe = !alternateframe ? curr : next;
+	const __m256i c255 = _mm256_set1_epi16(255);
+
+	interpolate_range(2, 3, stride, prev, curr, next, dst, multiframe, alternateframe);
+	int x = 3;
+	for (; x + 16 <= w - 2; x += 16) {
+		__m256i sN2 = score_avx2(up, dn, x, -2);
+		__m256i sN1 = score_avx2(up, dn, x, -1);
+		__m256i s_0 = score_avx2(up, dn, x,  0);
+		__m256i sP1 = score_avx2(up, dn, x, +1);
+		__m256i sP2 = score_avx2(up, dn, x, +2);
+
+		__m256i lt = gt_u16_avx2(sP1, sN1);
+		__m256i m = select_avx2(lt, sN1, sP1);
+		__m256i t = gt_u16_avx2(s_0, m);
+		__m256i s = select_avx2(t, m, s_0);
+		__m256i shift = _mm256_and_si256(t, select_avx2(lt, _mm256_set1_epi16(-1), _mm256_set1_epi16(1)));
+		lt = gt_u16_avx2(sP2, sN2);
+		m = select_avx2(lt, sN2, sP2);
+		t = gt_u16_avx2(s, m);
+		shift = select_avx2(t, select_avx2(lt, _mm256_set1_epi16(-2), _mm256_set1_epi16(2)), shift);
+
+		__m256i value = candidate_avx2(up, dn, x, 0);
+		value = select_avx2(_mm256_cmpeq_epi16(shift, _mm256_set1_epi16(-2)), candidate_avx2(up, dn, x, -2), value);
+		value = select_avx2(_mm256_cmpeq_epi16(shift, _mm256_set1_epi16(-1)), candidate_avx2(up, dn, x, -1), value);
+		value = select_avx2(_mm256_cmpeq_epi16(shift, _mm256_set1_epi16(+1)), candidate_avx2(up, dn, x, +1), value);
+		value = select_avx2(_mm256_cmpeq_epi16(shift, _mm256_set1_epi16(+2)), candidate_avx2(up, dn, x, +2), value);
+
+		if (multiframe) {
+			const __m256i a = load16_avx2(up + x);
+			const __m256i b = load16_avx2(dn + x);
+			__m256i c = _mm256_srli_epi16(sq_avx2(load16_avx2(prev + x), load16_avx2(next + x)), 1);
+			__m256i d = _mm256_adds_epu16(sq_avx2(load16_avx2(prev + x - stride), a), _mm256_srli_epi16(sq_avx2(load16_avx2(prev + x + stride), b), 1));
+			__m256i e = _mm256_adds_epu16(sq_avx2(load16_avx2(next + x - stride), a), _mm256_srli_epi16(sq_avx2(load16_avx2(next + x + stride), b), 1));
+			__m256i f = _mm256_srli_epi16(_mm256_add_epi16(load16_avx2(prevframe + x), load16_avx2(nextframe + x)), 1);
+			__m256i g = _mm256_sub_epi16(_mm256_srli_epi16(_mm256_add_epi16(load16_avx2(prevframe + x - stride2), load16_avx2(nextframe + x - stride2)), 1), a);
+			__m256i h = _mm256_sub_epi16(_mm256_srli_epi16(_mm256_add_epi16(load16_avx2(prevframe + x + stride2), load16_avx2(nextframe + x + stride2)), 1), b);
+			__m256i fa = _mm256_sub_epi16(f, a);
+			__m256i fb = _mm256_sub_epi16(f, b);
+			__m256i i = _mm256_min_epi16(_mm256_min_epi16(fb, fa), _mm256_min_epi16(g, h));
+			__m256i j = _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_max_epi16(_mm256_max_epi16(fb, fa), _mm256_max_epi16(g, h)));
+			__m256i cde = _mm256_min_epu16(_mm256_max_epu16(c, _mm256_max_epu16(d, e)), c255);
+			__m256i k = _mm256_max_epi16(cde, _mm256_max_epi16(i, j));
+			value = _mm256_min_epi16(_mm256_max_epi16(value, _mm256_sub_epi16(f, k)), _mm256_add_epi16(f, k));
 		}
 
-		int value = (curr[x - stride + shift] + curr[x + stride - shift]) / 2;
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1)));
+	}
+	interpolate_range(x, w - 2, stride, prev, curr, next, dst, multiframe, alternateframe);
+	dst[0] = dst[1] = dst[2];
+	dst[w - 2] = dst[w - 1] = dst[w - 3];
+}
+
+#endif // USE_X86_SIMD
+
+#ifdef USE_NEON
+
+// NEON 8画素単位
+
+inline uint16x8_t sq_neon(uint16x8_t a, uint16x8_t b)
+{
+	uint16x8_t d = vsubq_u16(a, b);
+	return vmulq_u16(d, d);
+}
+
+void process_row_neon(int w, int stride, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, uint8_t *dst, bool multiframe, bool alternateframe)
+{
+	const int stride2 = stride * 2;
+	uint8_t const *up = curr - stride;
+	uint8_t const *dn = curr + stride;
+	uint8_t const *prevframe = !alternateframe ? prev : curr;
+	uint8_t const *nextframe = !alternateframe ? curr : next;
+	const uint16x8_t c255 = vdupq_n_u16(255);
+
+	auto load = [](uint8_t const *p){
+		return vmovl_u8(vld1_u8(p));
+	};
+	auto score = [&](int x, int shift){
+		uint16x8_t s = sq_neon(load(up + x - 1 + shift), load(dn + x - 1 - shift));
+		s = vaddq_u16(s, sq_neon(load(up + x + shift), load(dn + x - shift)));
+		return vaddq_u16(s, sq_neon(load(up + x + 1 + shift), load(dn + x + 1 - shift)));
+	};
+	auto candidate = [&](int x, int shift){
+		return vreinterpretq_s16_u16(vhaddq_u16(load(up + x + shift), load(dn + x - shift)));
+	};
+
+	interpolate_range(2, 3, stride, prev, curr, next, dst, multiframe, alternateframe);
+	int x = 3;
+	for (; x + 8 <= w - 2; x += 8) {
+		uint16x8_t sN2 = score(x, -2);
+		uint16x8_t sN1 = score(x, -1);
+		uint16x8_t s_0 = score(x,  0);
+		uint16x8_t sP1 = score(x, +1);
+		uint16x8_t sP2 = score(x, +2);
+
+		uint16x8_t lt = vcltq_u16(sN1, sP1);
+		uint16x8_t m = vbslq_u16(lt, sN1, sP1);
+		uint16x8_t t = vcgtq_u16(s_0, m);
+		uint16x8_t s = vbslq_u16(t, m, s_0);
+		int16x8_t shift = vreinterpretq_s16_u16(vandq_u16(t, vbslq_u16(lt, vdupq_n_u16(0xffff), vdupq_n_u16(1))));
+		lt = vcltq_u16(sN2, sP2);
+		m = vbslq_u16(lt, sN2, sP2);
+		t = vcgtq_u16(s, m);
+		shift = vbslq_s16(t, vbslq_s16(lt, vdupq_n_s16(-2), vdupq_n_s16(2)), shift);
+
+		int16x8_t value = candidate(x, 0);
+		value = vbslq_s16(vceqq_s16(shift, vdupq_n_s16(-2)), candidate(x, -2), value);
+		value = vbslq_s16(vceqq_s16(shift, vdupq_n_s16(-1)), candidate(x, -1), value);
+		value = vbslq_s16(vceqq_s16(shift, vdupq_n_s16(+1)), candidate(x, +1), value);
+		value = vbslq_s16(vceqq_s16(shift, vdupq_n_s16(+2)), candidate(x, +2), value);
 
 		if (multiframe) {
-			const int a = curr[x - stride];
-			const int b = curr[x + stride];
-			const int c = diff(prev[x], next[x]) / 2;
-			const int d = diff(prev[x - stride], a) + diff(prev[x + stride], b) / 2;
-			const int e = diff(next[x - stride], a) + diff(next[x + stride], b) / 2;
-			const int f = (prevframe[x] + nextframe[x]) / 2;
-			int g = (prevframe[x - stride2] + nextframe[x - stride2]) / 2 - a;
-			int h = (prevframe[x + stride2] + nextframe[x + stride2]) / 2 - b;
-			if (g > h) { std::swap(g, h); }
-			const int i = +std::min(std::min(f - b, f - a), g);
-			const int j = -std::max(std::max(f - b, f - a), h);
-			const int k = std::max(std::max(c, std::max(d, e)), std::max(i, j));
-			const int min = f - k;
-			const int max = f + k;
-			value = std::min(std::max(value, min), max);
+			const uint16x8_t a = load(up + x);
+			const uint16x8_t b = load(dn + x);
+			uint16x8_t c = vshrq_n_u16(sq_neon(load(prev + x), load(next + x)), 1);
+			uint16x8_t d = vqaddq_u16(sq_neon(load(prev + x - stride), a), vshrq_n_u16(sq_neon(load(prev + x + stride), b), 1));
+			uint16x8_t e = vqaddq_u16(sq_neon(load(next + x - stride), a), vshrq_n_u16(sq_neon(load(next + x + stride), b), 1));
+			int16x8_t cde = vreinterpretq_s16_u16(vminq_u16(vmaxq_u16(c, vmaxq_u16(d, e)), c255));
+			int16x8_t f = vreinterpretq_s16_u16(vhaddq_u16(load(prevframe + x), load(nextframe + x)));
+			int16x8_t g = vsubq_s16(vreinterpretq_s16_u16(vhaddq_u16(load(prevframe + x - stride2), load(nextframe + x - stride2))), vreinterpretq_s16_u16(a));
+			int16x8_t h = vsubq_s16(vreinterpretq_s16_u16(vhaddq_u16(load(prevframe + x + stride2), load(nextframe + x + stride2))), vreinterpretq_s16_u16(b));
+			int16x8_t fa = vsubq_s16(f, vreinterpretq_s16_u16(a));
+			int16x8_t fb = vsubq_s16(f, vreinterpretq_s16_u16(b));
+			int16x8_t i = vminq_s16(vminq_s16(fb, fa), vminq_s16(g, h));
+			int16x8_t j = vnegq_s16(vmaxq_s16(vmaxq_s16(fb, fa), vmaxq_s16(g, h)));
+			int16x8_t k = vmaxq_s16(cde, vmaxq_s16(i, j));
+			value = vminq_s16(vmaxq_s16(value, vsubq_s16(f, k)), vaddq_s16(f, k));
 		}
 
-		dst[x] = value;
+		vst1_u8(dst + x, vqmovun_s16(value));
 	}
+	interpolate_range(x, w - 2, stride, prev, curr, next, dst, multiframe, alternateframe);
 	dst[0] = dst[1] = dst[2];
 	dst[w - 2] = dst[w - 1] = dst[w - 3];
 }
 
-void process_channel(int w, int h, int stride, const uint8_t *src_prev, const uint8_t *src_curr, const uint8_t *src_next, uint8_t *dst)
+#endif // USE_NEON
+
+typedef void (*RowFunc8)(int w, int stride, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, uint8_t *dst, bool multiframe, bool alternateframe);
+
+// ImageKernels で選択されている命令セットに合わせる
+RowFunc8 row_func8()
 {
-#pragma omp parallel for
-	for (int y = 0; y < h; y++) {
-		uint8_t *d = dst + stride * y;
-		uint8_t const *curr = src_curr + stride * y;
-		uint8_t const *prev = src_prev + stride * y;
-		uint8_t const *next = src_next + stride * y;
-		if ((y & 1) && y >= 1 && y < h - 1) {
-			bool multiframe = (y >= 2 && y < h - 2);
-			bool alternateframe = false;
-			process_row(w, stride, prev, curr, next, d, multiframe, alternateframe);
-		} else {
-			memcpy(d, curr, w);
+	switch (ImageKernels::level()) {
+#if defined(USE_X86_SIMD)
+	case ImageKernels::Level::AVX2:
+		return process_row_avx2;
+	case ImageKernels::Level::SSSE3:
+		return process_row_ssse3;
+#elif defined(USE_NEON)
+	case ImageKernels::Level::NEON:
+		return process_row_neon;
+#endif
+	default:
+		break;
+	}
+	return process_row<uint8_t>;
+}
+
+template <typename T> auto row_func() -> void (*)(int, int, const T *, const T *, const T *, T *, bool, bool)
+{
+	if constexpr (std::is_same_v<T, uint8_t>) {
+		return row_func8();
+	} else {
+		return process_row<T>;
+	}
+}
+
+// 平面画像は左右に2画素の余白を持つ。各行の先頭（余白を含む）を処理の基点とする
+// CalcScore は余白の右端を1バイト越えて読むので、Imageにはもう1画素分確保する
+const int PADDING = 2;
+const int MARGIN = PADDING + 1;
+
+template <typename T = uint8_t> T *top_left(Image &image)
+{
+	return (T *)image.bits() - PADDING;
+}
+
+template <typename T = uint8_t> T const *top_left(Image const &image)
+{
+	return (T const *)image.bits() - PADDING;
+}
+
+// 動きを調べるブロックの大きさ（画素）
+const int BLOCK = 8;
+
+// 前後のフレームの差の平均がこの値（8ビット換算）以下のブロックは静止しているとみなす
+const int STATIC_THRESHOLD = 2;
+
+// これより短い静止範囲（ブロック数）は補間する
+const int MIN_STATIC_RUN = 4;
+
+// 行の差の絶対値の和をブロックごとに sad に加える
+template <typename T> void sad_row(int w, T const *a, T const *b, uint32_t *sad)
+{
+	for (int x = 0; x < w; x++) {
+		sad[x / BLOCK] += std::abs(a[x] - b[x]);
+	}
+}
+
+#if defined(USE_X86_SIMD)
+template <> void sad_row<uint8_t>(int w, uint8_t const *a, uint8_t const *b, uint32_t *sad)
+{
+	int x = 0;
+	for (; x + 16 <= w; x += 16) {
+		__m128i v = _mm_sad_epu8(_mm_loadu_si128((__m128i const *)(a + x)), _mm_loadu_si128((__m128i const *)(b + x)));
+		sad[x / BLOCK + 0] += _mm_cvtsi128_si32(v);
+		sad[x / BLOCK + 1] += _mm_extract_epi16(v, 4);
+	}
+	for (; x < w; x++) {
+		sad[x / BLOCK] += std::abs(a[x] - b[x]);
+	}
+}
+#endif
+
+void init_motion_map(int w, int h, Deinterlace::MotionMap *map)
+{
+	map->block = BLOCK;
+	map->cols = (w + BLOCK - 1) / BLOCK;
+	map->rows = (h + BLOCK - 1) / BLOCK;
+	map->moving.assign(map->cols * map->rows, 0);
+}
+
+// 前後のフレーム（prev, next は各行の最初の画素）の差から、動いているブロックを map に加える
+// N 枚の平面（plane 要素ずつ離れて並ぶ）をまとめて調べ、どれかの平面で動いていれば動いているとする
+template <int N, typename T> void detect_motion(int w, int h, int stride, int plane, T const *prev, T const *next, Deinterlace::MotionMap *map)
+{
+	const uint32_t limit = (BLOCK * BLOCK * STATIC_THRESHOLD) << (sizeof(T) == 1 ? 0 : 2);
+	const int cols = map->cols;
+	ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel num_threads(budget.count())
+	{
+		std::vector<uint32_t> sad(cols);
+#pragma omp for
+		for (int by = 0; by < map->rows; by++) {
+			const int y1 = std::min((by + 1) * BLOCK, h);
+			uint8_t *moving = map->moving.data() + cols * by;
+			for (int i = 0; i < N; i++) {
+				std::fill(sad.begin(), sad.end(), 0);
+				for (int y = by * BLOCK; y < y1; y++) {
+					sad_row(w, prev + plane * i + stride * y, next + plane * i + stride * y, sad.data());
+				}
+				for (int bx = 0; bx < cols; bx++) {
+					if (sad[bx] > limit) moving[bx] = 1;
+				}
+			}
+		}
+	}
+}
+
+// 動いているブロックの周囲のブロックも動いているとみなす
+void dilate_motion_map(Deinterlace::MotionMap *map)
+{
+	const int cols = map->cols;
+	const int rows = map->rows;
+	std::vector<uint8_t> src = map->moving;
+	for (int by = 0; by < rows; by++) {
+		for (int bx = 0; bx < cols; bx++) {
+			uint8_t m = 0;
+			for (int y = std::max(by - 1, 0); y <= std::min(by + 1, rows - 1); y++) {
+				for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, cols - 1); x++) {
+					m |= src[cols * y + x];
+				}
+			}
+			map->moving[cols * by + bx] = m;
+		}
+	}
+}
+
+// 残すフィールドの上下の行に対して、もう一方のフィールドの行が飛び出している画素を縞とみなす
+const int COMB_THRESHOLD = 12;
+
+// 縞のあるブロックが動いているブロックのこの数分の1に満たなければ、縞はないとみなす
+// 画面全体の数と比べると、小さな範囲だけが動いているインタレースの映像（テロップなど）を見逃す
+const int COMBED_RATIO = 32;
+
+// keep の field の行ともう一方の行（others[i]）を組み合わせたときに、縞の多い動いているブロックの数を result[i] に返す
+// keep, others は各行の最初の画素。keep の行を一度読むだけで、すべての組み合わせを数える
+// limit に達した組み合わせは数えるのをやめ、limit を返す
+template <typename T, int N> void count_combed(int w, int h, int stride, T const *keep, T const *const (&others)[N], int field, Deinterlace::MotionMap const &map, int limit, int (&result)[N])
+{
+	const int threshold = (COMB_THRESHOLD * COMB_THRESHOLD) << (sizeof(T) == 1 ? 0 : 4);
+	const int cols = map.cols;
+	std::atomic_int combed[N];
+	for (int i = 0; i < N; i++) {
+		combed[i] = 0;
+	}
+	ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel for num_threads(budget.count())
+	for (int by = 0; by < map.rows; by++) {
+		uint8_t const *moving = map.moving.data() + cols * by;
+		const int y0 = std::max(by * BLOCK, 1);
+		const int y1 = std::min((by + 1) * BLOCK, h - 1);
+		for (int bx = 0; bx < cols; bx++) {
+			if (!moving[bx]) continue; // 静止しているブロックはどう組み合わせても縞にならない
+			bool active[N];
+			bool any = false;
+			for (int i = 0; i < N; i++) {
+				active[i] = combed[i].load(std::memory_order_relaxed) < limit;
+				any = any || active[i];
+			}
+			if (!any) break;
+			const int x0 = bx * BLOCK;
+			const int x1 = std::min(x0 + BLOCK, w);
+			int n[N] = {};
+			for (int y = y0; y < y1; y++) {
+				if ((y & 1) == field) continue;
+				T const *a = keep + stride * (y - 1);
+				T const *c = keep + stride * (y + 1);
+				for (int i = 0; i < N; i++) {
+					if (!active[i]) continue;
+					T const *b = others[i] + stride * y;
+					for (int x = x0; x < x1; x++) {
+						if ((a[x] - b[x]) * (c[x] - b[x]) > threshold) n[i]++;
+					}
+				}
+			}
+			// ブロックの補間する行の画素の4分の1以上
+			for (int i = 0; i < N; i++) {
+				if (active[i] && n[i] * 8 >= BLOCK * BLOCK) combed[i]++;
+			}
+		}
+	}
+	for (int i = 0; i < N; i++) {
+		result[i] = std::min(combed[i].load(), limit);
+	}
+}
+
+// 1行のうち動いているブロックだけを補間し、静止しているブロックは curr の行（もう一方のフィールド）をそのまま使う
+// moving が nullptr のときは行全体を補間する
+template <typename T, typename R> void process_blocks(R process_row, int w, int stride, const T *prev, const T *curr, const T *next, T *dst, bool multiframe, bool alternateframe, uint8_t const *moving, int cols)
+{
+	if (!moving) {
+		process_row(w, stride, prev, curr, next, dst, multiframe, alternateframe);
+		return;
+	}
+	const int width = w - PADDING * 2;
+
+	// 細かく分けると SIMD で処理できる画素が減るので、短い静止範囲は両側の動いている範囲とまとめて補間する
+	// 動いている範囲が行の半分を超えるときは行全体を補間する
+	uint8_t *mv = (uint8_t *)alloca(cols);
+	memcpy(mv, moving, cols);
+	int count = 0;
+	for (int bx = 0, last = -1; bx < cols; bx++) {
+		if (!mv[bx]) continue;
+		if (last >= 0 && bx - last - 1 < MIN_STATIC_RUN) {
+			memset(mv + last + 1, 1, bx - last - 1);
+			count += bx - last - 1;
+		}
+		last = bx;
+		count++;
+	}
+	if (count == 0) {
+		memcpy(dst + PADDING, curr + PADDING, sizeof(T) * width);
+		return;
+	}
+	if (count * 2 > cols) {
+		process_row(w, stride, prev, curr, next, dst, multiframe, alternateframe);
+		for (int bx = 0; bx < cols; bx++) {
+			if (!mv[bx]) {
+				const int x0 = bx * BLOCK;
+				const int x1 = std::min(x0 + BLOCK, width);
+				memcpy(dst + PADDING + x0, curr + PADDING + x0, sizeof(T) * (x1 - x0));
+			}
+		}
+		return;
+	}
+	moving = mv;
+
+	auto run_end = [&](int bx){
+		const uint8_t m = moving[bx];
+		while (bx < cols && moving[bx] == m) bx++;
+		return bx;
+	};
+	// 動いている範囲を先に補間する。範囲の外側に書き込まれた値は、静止している範囲の複製で上書きされる
+	// 行の関数は先頭の画素を左の画素なしで補間するので、範囲の1画素前から始めてその画素は捨てる（行全体を補間したときと同じ値になる）
+	// 捨てる1画素を除いた幅を16画素の倍数に広げ、行の端以外をすべて SIMD で処理させる
+	for (int bx = 0; bx < cols;) {
+		const int ex = run_end(bx);
+		if (moving[bx]) {
+			const int x0 = bx > 0 ? bx * BLOCK - 1 : 0;
+			const int x1 = std::min(x0 + 1 + (ex * BLOCK - x0 - 1 + 15) / 16 * 16, width);
+			process_row(x1 - x0 + PADDING * 2, stride, prev + x0, curr + x0, next + x0, dst + x0, multiframe, alternateframe);
+		}
+		bx = ex;
+	}
+	for (int bx = 0; bx < cols;) {
+		const int ex = run_end(bx);
+		if (!moving[bx]) {
+			const int x0 = bx * BLOCK;
+			const int x1 = std::min(ex * BLOCK, width);
+			memcpy(dst + PADDING + x0, curr + PADDING + x0, sizeof(T) * (x1 - x0));
+		}
+		bx = ex;
+	}
+}
+
+// field は残すフィールド（0: 偶数行, 1: 奇数行）。もう一方のフィールドの行を補間する
+// alternateframe のときは時間方向に curr と next の間、そうでなければ prev と curr の間の値を使う
+// map が nullptr でなければ静止しているブロックは補間しない
+// N 枚の平面（plane 要素ずつ離れて並ぶ）を1行ずつまとめて処理し、各行を fn(y, rows) に渡す。rows[i] は i 枚目の平面の左の余白を含む行の先頭
+// 補間しない行は curr の行をそのまま渡す。すべての平面の同じ行を続けて処理するので、参照する行がキャッシュに残っているうちに書き出せる
+template <int N, typename T, typename F> void process_planes(int w, int h, int stride, int plane, const T *src_prev, const T *src_curr, const T *src_next, int field, bool alternateframe, Deinterlace::MotionMap const *map, F fn)
+{
+	auto process_row = row_func<T>();
+	ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel num_threads(budget.count())
+	{
+		std::vector<T> buf(w * N);
+		T const *rows[N];
+#pragma omp for
+		for (int y = 0; y < h; y++) {
+			const bool interpolate = (y & 1) != field && y >= 1 && y < h - 1;
+			const bool multiframe = (y >= 2 && y < h - 2);
+			uint8_t const *moving = map ? map->moving.data() + map->cols * (y / map->block) : nullptr;
+			for (int i = 0; i < N; i++) {
+				T const *curr = src_curr + plane * i + stride * y;
+				if (interpolate) {
+					T const *prev = src_prev + plane * i + stride * y;
+					T const *next = src_next + plane * i + stride * y;
+					process_blocks(process_row, w, stride, prev, curr, next, buf.data() + w * i, multiframe, alternateframe, moving, map ? map->cols : 0);
+					rows[i] = buf.data() + w * i;
+				} else {
+					rows[i] = curr;
+				}
+			}
+			fn(y, rows);
 		}
 	}
 }
@@ -136,18 +754,21 @@ struct DeintRGB {
 		format = input.format();
 		w = input.width();
 		h = input.height();
-		w4 = w + 4;
+		w4 = w + PADDING * 2;
 		h3 = h * 3;
-		stride = w4;
+		stride = Image::alignedBytesPerLine(w, Image::Format::UINT8, MARGIN);
 		offsetR = stride * h * 0;
 		offsetG = stride * h * 1;
 		offsetB = stride * h * 2;
-		Image planar(w4, h3, Image::Format::UINT8);
+		Image planar(w, h3, Image::Format::UINT8, MARGIN);
+		uint8_t *dst = top_left(planar);
+		ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel for num_threads(budget.count())
 		for (int y = 0; y < h; y++) {
 			uint8_t const *s = input.scanLine(y);
-			uint8_t *dR = planar.bits() + offsetR + stride * y;
-			uint8_t *dG = planar.bits() + offsetG + stride * y;
-			uint8_t *dB = planar.bits() + offsetB + stride * y;
+			uint8_t *dR = dst + offsetR + stride * y;
+			uint8_t *dG = dst + offsetG + stride * y;
+			uint8_t *dB = dst + offsetB + stride * y;
 			for (int x = 0; x < w; x++) {
 				dR[2 + x] = s[3 * x + 0];
 				dG[2 + x] = s[3 * x + 1];
@@ -156,209 +777,410 @@ struct DeintRGB {
 			dR[0] = dR[1] = dR[2];
 			dG[0] = dG[1] = dG[2];
 			dB[0] = dB[1] = dB[2];
-			dR[w + 2] = dR[w + 3] = dR[w + 1];
-			dG[w + 2] = dG[w + 3] = dG[w + 1];
-			dB[w + 2] = dB[w + 3] = dB[w + 1];
+			dR[w + 2] = dR[w + 3] = dR[w + 4] = dR[w + 1];
+			dG[w + 2] = dG[w + 3] = dG[w + 4] = dG[w + 1];
+			dB[w + 2] = dB[w + 3] = dB[w + 4] = dB[w + 1];
 		}
 		return planar;
 	}
 
-	Image perform(Image const &prev, Image const &curr, Image const &next)
+	bool valid(Image const &img) const
 	{
-		Image ret;
-		auto ValidImage = [&](Image const &img){
-			return img.width() == w4 && img.height() == h3 && img.format() == Image::Format::UINT8;
-		};
-		if (ValidImage(prev) && ValidImage(curr) && ValidImage(next)) {
-			Image dest(w4, h3, Image::Format::UINT8);
+		return img.width() == w && img.height() == h3 && img.padding() == MARGIN && img.format() == Image::Format::UINT8;
+	}
 
-			process_channel(w4, h, stride, prev.bits() + offsetR, curr.bits() + offsetR, next.bits() + offsetR, dest.bits() + offsetR);
-			process_channel(w4, h, stride, prev.bits() + offsetG, curr.bits() + offsetG, next.bits() + offsetG, dest.bits() + offsetG);
-			process_channel(w4, h, stride, prev.bits() + offsetB, curr.bits() + offsetB, next.bits() + offsetB, dest.bits() + offsetB);
+	bool detect(Image const &prev, Image const &next, Deinterlace::MotionMap *map) const
+	{
+		if (!valid(prev) || !valid(next)) return false;
+		init_motion_map(w, h, map);
+		detect_motion<3>(w, h, stride, offsetG - offsetR, prev.bits() + offsetR, next.bits() + offsetR, map);
+		dilate_motion_map(map);
+		return true;
+	}
 
+	// 緑の平面で調べる
+	void combed(Image const &keep, Image const *const (&others)[3], int field, Deinterlace::MotionMap const &map, int limit, int (&result)[3]) const
+	{
+		uint8_t const *o[3];
+		for (int i = 0; i < 3; i++) {
+			o[i] = others[i]->bits() + offsetG;
+		}
+		count_combed(w, h, stride, keep.bits() + offsetG, o, field, map, limit, result);
+	}
+
+	Image perform(Image const &prev, Image const &curr, Image const &next, Image const & /*source*/, int field, bool alternateframe, Deinterlace::MotionMap const *map)
+	{
+		Image ret;
+		if (valid(prev) && valid(curr) && valid(next)) {
 			ret = Image(w, h, format);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *sR = dest.bits() + offsetR + stride * y + 2;
-				uint8_t const *sG = dest.bits() + offsetG + stride * y + 2;
-				uint8_t const *sB = dest.bits() + offsetB + stride * y + 2;
-				uint8_t *d = ret.scanLine(y);
+			uint8_t *bits = ret.bits();
+			const int bpl = ret.bytesPerLine();
+			// 3枚の平面を行ごとに補間し、そのまま RGB に並べて書き出す
+			process_planes<3>(w4, h, stride, offsetG - offsetR, top_left(prev) + offsetR, top_left(curr) + offsetR, top_left(next) + offsetR, field, alternateframe, map, [&](int y, uint8_t const *const *rows){
+				uint8_t const *sR = rows[0] + PADDING;
+				uint8_t const *sG = rows[1] + PADDING;
+				uint8_t const *sB = rows[2] + PADDING;
+				uint8_t *d = bits + bpl * y;
 				for (int x = 0; x < w; x++) {
 					d[3 * x + 0] = sR[x];
 					d[3 * x + 1] = sG[x];
 					d[3 * x + 2] = sB[x];
 				}
-			}
+			});
 		}
 		return ret;
 	}
 };
 
+// 輝度だけを平面にして補間する。色差と偶数行は入力の画像から直接書き出す
 struct DeintYUV {
 	Image::Format format;
 	int w;
 	int h;
 	int w4;
-	int h3;
 	int stride;
-	int offsetY;
-	int offsetU;
-	int offsetV;
 
 	Image prepare(Image const &input)
 	{
 		format = input.format();
 		w = input.width();
 		h = input.height();
-		w4 = w + 4;
-		h3 = h * 3;
-		stride = w4;
-		offsetY = stride * h * 0;
-		offsetU = stride * h * 1;
-		offsetV = stride * h * 2;
-		Image planar(w4, h3, Image::Format::UINT8);
+		w4 = w + PADDING * 2;
+		stride = Image::alignedBytesPerLine(w, Image::Format::UINT8, MARGIN);
+		auto get_luma = ImageKernels::table()->*(format == Image::Format::UYVY8 ? &ImageKernels::Table::uyvy_get_luma : &ImageKernels::Table::yuyv_get_luma);
+		Image planar(w, h, Image::Format::UINT8, MARGIN);
+		uint8_t *dst = top_left(planar);
+		ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel for num_threads(budget.count())
 		for (int y = 0; y < h; y++) {
-			uint8_t const *s = input.scanLine(y);
-			uint8_t *dY = planar.bits() + offsetY + stride * y;
-			uint8_t *dU = planar.bits() + offsetU + stride * y;
-			uint8_t *dV = planar.bits() + offsetV + stride * y;
-			switch (format) {
-			case Image::Format::YUYV8:
-				for (int x = 0; x < w / 2; x++) {
-					dY[2 + 2 * x + 0] = s[4 * x + 0];
-					dU[2 + x]         = s[4 * x + 1];
-					dY[2 + 2 * x + 1] = s[4 * x + 2];
-					dV[2 + x]         = s[4 * x + 3];
-				}
-				break;
-			case Image::Format::UYVY8:
-				for (int x = 0; x < w / 2; x++) {
-					dY[2 + 2 * x + 0] = s[4 * x + 1];
-					dU[2 + x]         = s[4 * x + 0];
-					dY[2 + 2 * x + 1] = s[4 * x + 3];
-					dV[2 + x]         = s[4 * x + 2];
+			uint8_t *dY = dst + stride * y;
+			get_luma(input.scanLine(y), dY + 2, w);
+			dY[0] = dY[1] = dY[2];
+			dY[w + 2] = dY[w + 3] = dY[w + 4] = dY[w + 1];
+		}
+		return planar;
+	}
+
+	bool valid(Image const &img) const
+	{
+		return img.width() == w && img.height() == h && img.padding() == MARGIN && img.format() == Image::Format::UINT8;
+	}
+
+	bool detect(Image const &prev, Image const &next, Deinterlace::MotionMap *map) const
+	{
+		if (!valid(prev) || !valid(next)) return false;
+		init_motion_map(w, h, map);
+		detect_motion<1>(w, h, stride, 0, prev.bits(), next.bits(), map);
+		dilate_motion_map(map);
+		return true;
+	}
+
+	void combed(Image const &keep, Image const *const (&others)[3], int field, Deinterlace::MotionMap const &map, int limit, int (&result)[3]) const
+	{
+		uint8_t const *o[3];
+		for (int i = 0; i < 3; i++) {
+			o[i] = others[i]->bits();
+		}
+		count_combed(w, h, stride, keep.bits(), o, field, map, limit, result);
+	}
+
+	Image perform(Image const &prev, Image const &curr, Image const &next, Image const &source, int field, bool alternateframe, Deinterlace::MotionMap const *map)
+	{
+		Image ret;
+		if (valid(prev) && valid(curr) && valid(next) && source.width() == w && source.height() == h && source.format() == format) {
+			ret = Image(w, h, format);
+			uint8_t *bits = ret.bits();
+			const int bpl = ret.bytesPerLine();
+			auto set_luma = ImageKernels::table()->*(format == Image::Format::UYVY8 ? &ImageKernels::Table::uyvy_set_luma : &ImageKernels::Table::yuyv_set_luma);
+
+			process_planes<1>(w4, h, stride, 0, top_left(prev), top_left(curr), top_left(next), field, alternateframe, map, [&](int y, uint8_t const *const *rows){
+				uint8_t const *row = rows[0];
+				uint8_t *d = bits + bpl * y;
+				if ((y & 1) == field) {
+					memcpy(d, source.scanLine(y), w * 2);
+					return;
 				}
-				break;
+				// 補間する行の色差は残すフィールドの隣の行のものを使う
+				memcpy(d, source.scanLine(field == 0 ? y - 1 : std::min(y + 1, h - 1)), w * 2);
+				set_luma(row + PADDING, d, w);
+			});
+		}
+		return ret;
+	}
+};
+
+// 10ビットの YUYV (YUYV16)。輝度の平面には10ビットの値を UINT16 で保持する
+struct DeintYUV16 {
+	Image::Format format;
+	int w;
+	int h;
+	int w4;
+	int stride; // 要素数
+
+	Image prepare(Image const &input)
+	{
+		format = input.format();
+		w = input.width();
+		h = input.height();
+		w4 = w + PADDING * 2;
+		stride = Image::alignedBytesPerLine(w, Image::Format::UINT16, MARGIN) / sizeof(uint16_t);
+		Image planar(w, h, Image::Format::UINT16, MARGIN);
+		uint16_t *dst = top_left<uint16_t>(planar);
+		ImageKernels::ThreadBudget budget(ImageKernels::threadCount());
+#pragma omp parallel for num_threads(budget.count())
+		for (int y = 0; y < h; y++) {
+			uint16_t const *s = (uint16_t const *)input.scanLine(y);
+			uint16_t *dY = dst + stride * y;
+			for (int x = 0; x < w; x++) {
+				dY[2 + x] = s[2 * x] >> 6;
 			}
 			dY[0] = dY[1] = dY[2];
-			dU[0] = dU[1] = dU[2];
-			dV[0] = dV[1] = dV[2];
-			dY[w + 2] = dY[w + 3] = dY[w + 1];
-			dU[w / 2 + 2] = dU[w / 2 + 3] = dU[w / 2 + 1];
-			dV[w / 2 + 2] = dV[w / 2 + 3] = dV[w / 2 + 1];
+			dY[w + 2] = dY[w + 3] = dY[w + 4] = dY[w + 1];
 		}
 		return planar;
 	}
 
-	Image perform(Image const &prev, Image const &curr, Image const &next)
+	bool valid(Image const &img) const
 	{
-		Image ret;
-		auto ValidImage = [&](Image const &img){
-			return img.width() == w4 && img.height() == h3 && img.format() == Image::Format::UINT8;
-		};
-		if (ValidImage(prev) && ValidImage(curr) && ValidImage(next)) {
-			Image dest = curr.copy();
+		return img.width() == w && img.height() == h && img.padding() == MARGIN && img.format() == Image::Format::UINT16;
+	}
 
-			process_channel(w4, h, stride, prev.bits() + offsetY, curr.bits() + offsetY, next.bits() + offsetY, dest.bits() + offsetY);
+	bool detect(Image const &prev, Image const &next, Deinterlace::MotionMap *map) const
+	{
+		if (!valid(prev) || !valid(next)) return false;
+		init_motion_map(w, h, map);
+		detect_motion<1>(w, h, stride, 0, (uint16_t const *)prev.bits(), (uint16_t const *)next.bits(), map);
+		dilate_motion_map(map);
+		return true;
+	}
+
+	void combed(Image const &keep, Image const *const (&others)[3], int field, Deinterlace::MotionMap const &map, int limit, int (&result)[3]) const
+	{
+		uint16_t const *o[3];
+		for (int i = 0; i < 3; i++) {
+			o[i] = (uint16_t const *)others[i]->bits();
+		}
+		count_combed(w, h, stride, (uint16_t const *)keep.bits(), o, field, map, limit, result);
+	}
 
+	Image perform(Image const &prev, Image const &curr, Image const &next, Image const &source, int field, bool alternateframe, Deinterlace::MotionMap const *map)
+	{
+		Image ret;
+		if (valid(prev) && valid(curr) && valid(next) && source.width() == w && source.height() == h && source.format() == format) {
 			ret = Image(w, h, format);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *sY = dest.bits() + offsetY + stride * y + 2;
-				uint8_t const *sU = dest.bits() + offsetU + stride * (y & ~1) + 2;
-				uint8_t const *sV = dest.bits() + offsetV + stride * (y & ~1) + 2;
-				uint8_t *d = ret.scanLine(y);
-				switch (format) {
-				case Image::Format::YUYV8:
-					for (int x = 0; x < w / 2; x++) {
-						d[4 * x + 0] = sY[2 * x + 0];
-						d[4 * x + 1] = sU[x];
-						d[4 * x + 2] = sY[2 * x + 1];
-						d[4 * x + 3] = sV[x];
-					}
-					break;
-				case Image::Format::UYVY8:
-					for (int x = 0; x < w / 2; x++) {
-						d[4 * x + 1] = sY[2 * x + 0];
-						d[4 * x + 0] = sU[x];
-						d[4 * x + 3] = sY[2 * x + 1];
-						d[4 * x + 2] = sV[x];
-					}
-					break;
+			uint8_t *bits = ret.bits();
+			const int bpl = ret.bytesPerLine();
+
+			process_planes<1>(w4, h, stride, 0, top_left<uint16_t>(prev), top_left<uint16_t>(curr), top_left<uint16_t>(next), field, alternateframe, map, [&](int y, uint16_t const *const *rows){
+				uint16_t const *row = rows[0];
+				uint16_t *d = (uint16_t *)(bits + bpl * y);
+				if ((y & 1) == field) {
+					memcpy(d, source.scanLine(y), w * 4);
+					return;
 				}
-			}
+				// 補間する行の色差は残すフィールドの隣の行のものを使う
+				uint16_t const *sY = row + PADDING;
+				memcpy(d, source.scanLine(field == 0 ? y - 1 : std::min(y + 1, h - 1)), w * 4);
+				for (int x = 0; x < w; x++) {
+					d[2 * x] = sY[x] << 6;
+				}
+			});
 		}
 		return ret;
 	}
 };
 
+// keep の field の行と other のもう一方の行を組み合わせる
+Image weave(Image const &keep, Image const &other, int field)
+{
+	if (other.width() != keep.width() || other.height() != keep.height() || other.format() != keep.format()) return {};
+	Image ret(keep.width(), keep.height(), keep.format());
+	const int len = keep.width() * keep.bytesPerPixel();
+	for (int y = 0; y < keep.height(); y++) {
+		memcpy(ret.scanLine(y), ((y & 1) == field ? keep : other).scanLine(y), len);
+	}
+	return ret;
+}
+
 }
 
-template <typename T> Image Deinterlace::process(Image const &input)
+// 各フレームは一つ前のフレームを補間して返す。前後のフレームは通し番号で探し、
+// 参照中の画像は Image の参照カウントで保持されるので、複数のスレッドが別々のフレームを同時に処理できる
+// fields が true のときは両方のフィールドをそれぞれ補間して、時間の順に2枚返す
+template <typename T> std::vector<Image> Deinterlace::process(Image const &input, uint64_t sequence, bool fields, bool tff)
 {
 	const int w = input.width();
 	const int h = input.height();
-	if (w < 1 || h < 1) return {};
+	if (w < 1 || h < 1) {
+		std::lock_guard lock(mutex_);
+		history_.erase(sequence); // 予約を取り消す
+		cond_.notify_all();
+		return {};
+	}
 
 //	QElapsedTimer t;
 //	t.start();
 
 	T d;
 
+	{
+		std::lock_guard lock(mutex_);
+		history_[sequence]; // reserve されていなければ、ここで準備中として登録する
+	}
+
 	Image planar = d.prepare(input);
 
-	int prev_i;
-	int curr_i;
-	int next_i;
+	Image prev;
+	Image curr;
+	Image source;
+	Image prev_source;
 	{
-		std::lock_guard lock(mutex_);
-		if (image_count_ < NBUF) {
-			next_i = (image_index_ + image_count_) % NBUF;
-			image_buffer_[next_i] = planar;
-			image_count_++;
-			if (image_count_ == 1) {
-				next_i = (next_i + 1) % NBUF;
-				image_buffer_[next_i] = planar;
-				image_count_++;
+		std::unique_lock lock(mutex_);
+		Frame &frame = history_[sequence];
+		frame.planar = planar;
+		frame.source = input;
+		frame.ready = true;
+		cond_.notify_all();
+
+		// s より前の最も新しいフレーム。準備中なら待つ
+		auto before = [&](uint64_t s){
+			while (1) {
+				auto it = history_.lower_bound(s);
+				if (it == history_.begin()) return history_.end();
+				--it;
+				if (it->second.ready) return it;
+				cond_.wait(lock);
 			}
-			if (image_count_ == 2) {
-				next_i = (next_i + 1) % NBUF;
-				image_buffer_[next_i] = planar;
-				image_count_++;
+		};
+		auto it = before(sequence);
+		if (it != history_.end()) {
+			curr = it->second.planar;
+			source = it->second.source;
+			it = before(it->first);
+			prev = it != history_.end() ? it->second.planar : curr;
+			prev_source = it != history_.end() ? it->second.source : source;
+		} else { // 最初のフレーム
+			curr = planar;
+			prev = planar;
+			source = input;
+			prev_source = input;
+		}
+
+		history_[sequence].done = true;
+
+		// 各フレームは直前の2つを参照するので、先頭は続く2つも参照を終えているときだけ消す
+		auto removable = [&](){
+			if ((int)history_.size() <= NBUF) return false;
+			auto it = history_.begin();
+			for (int i = 0; i < 3; i++, ++it) {
+				if (!it->second.done) return false;
 			}
-			curr_i = (next_i + NBUF - 1) % NBUF;
-			prev_i = (next_i + NBUF - 2) % NBUF;
-		} else {
-			return {};
+			return true;
+		};
+		while (removable()) {
+			history_.erase(history_.begin());
 		}
 	}
 
-	Image const &prev = image_buffer_[prev_i];
-	Image const &curr = image_buffer_[curr_i];
-	Image const &next = image_buffer_[next_i];
-	Image ret = d.perform(prev, curr, next);
+	// 前後のフレームが揃っていれば、静止しているブロックは補間せずにそのまま使う
+	MotionMap map;
+	MotionMap const *motion = nullptr;
+	if (std::as_const(prev).bits() != std::as_const(planar).bits() && d.detect(prev, planar, &map)) {
+		motion = &map;
+		std::lock_guard lock(mutex_);
+		motion_map_ = map;
+	}
 
-//	qDebug() << t.elapsed();
+	// 動いているところに縞がなければプログレッシブの内容なので、そのまま返す
+	// 縞があっても、前後のフレームのもう一方のフィールドと組み合わせて縞がなくなればそれを返す（テレシネの逆変換）
+	if (motion && d.valid(curr)) {
+		const int field = tff ? 0 : 1;
+		const int moving = (int)std::count_if(map.moving.begin(), map.moving.end(), [](uint8_t m){ return m != 0; });
+		const int limit = std::max(1, moving / COMBED_RATIO);
+		// そのまま、前のフレームと、次のフレームと組み合わせたときの縞を一度に数える
+		Image const *others[] = {&curr, &prev, &planar};
+		int combed[3];
+		d.combed(curr, others, field, map, limit, combed);
+		Image frame;
+		if (combed[0] < limit) {
+			frame = source;
+		} else if (std::min(combed[1], combed[2]) < limit) {
+			frame = weave(source, combed[1] <= combed[2] ? prev_source : input, field);
+		}
+		if (frame) {
+			if (fields) return { frame, frame };
+			return { frame };
+		}
+	}
 
-	while (1) {
-		std::unique_lock lock(mutex_);
-		if (prev_i == image_index_) {
-			image_index_ = (image_index_ + 1) % NBUF;
-			image_count_--;
-			cond_.notify_all();
-			return ret;
+	// 後のフィールドを残すときは、補間する行を時間方向に次のフレームとの間の値で制限する
+	auto perform = [&](int field){
+		const bool alternateframe = (field == 1) == tff;
+		Image ret = d.perform(prev, curr, planar, source, field, alternateframe, motion);
+		if (!ret) { // 解像度や形式が変わった直後は、このフレームだけで補間する
+			ret = d.perform(planar, planar, planar, input, field, alternateframe, nullptr);
 		}
-		cond_.wait(lock);
+		return ret;
+	};
+
+	std::vector<Image> ret;
+	if (fields) {
+		ret.push_back(perform(tff ? 0 : 1));
+		ret.push_back(perform(tff ? 1 : 0));
+	} else {
+		ret.push_back(perform(0));
 	}
+
+//	qDebug() << t.elapsed();
+
+	return ret;
 }
 
-Image Deinterlace::deinterlace(Image const &input)
+std::vector<Image> Deinterlace::dispatch(Image const &input, uint64_t sequence, bool fields, bool tff)
 {
 	switch (input.format()) {
 	case Image::Format::YUYV8:
 	case Image::Format::UYVY8:
-		return process<DeintYUV>(input);
+		return process<DeintYUV>(input, sequence, fields, tff);
+	case Image::Format::YUYV16:
+		return process<DeintYUV16>(input, sequence, fields, tff);
 	case Image::Format::RGB8:
-		return process<DeintRGB>(input);
+		return process<DeintRGB>(input, sequence, fields, tff);
 	default:
-		return process<DeintRGB>(input.convertToFormat(Image::Format::RGB8));
+		return process<DeintRGB>(input.convertToFormat(Image::Format::RGB8), sequence, fields, tff);
 	}
 }
+
+Deinterlace::MotionMap Deinterlace::motionMap() const
+{
+	std::lock_guard lock(mutex_);
+	return motion_map_;
+}
+
+// 準備中として登録する。後の番号のフレームはこれを待つ
+void Deinterlace::reserve(uint64_t sequence)
+{
+	std::lock_guard lock(mutex_);
+	history_[sequence];
+}
+
+Image Deinterlace::deinterlace(Image const &input)
+{
+	return deinterlace(input, next_sequence_++);
+}
+
+Image Deinterlace::deinterlace(Image const &input, uint64_t sequence)
+{
+	std::vector<Image> ret = dispatch(input, sequence, false, true);
+	return ret.empty() ? Image() : ret[0];
+}
+
+std::vector<Image> Deinterlace::deinterlaceFields(Image const &input, bool tff)
+{
+	return deinterlaceFields(input, next_sequence_++, tff);
+}
+
+std::vector<Image> Deinterlace::deinterlaceFields(Image const &input, uint64_t sequence, bool tff)
+{
+	return dispatch(input, sequence, true, tff);
+}
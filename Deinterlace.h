@@ -2,20 +2,50 @@
 #define DEINTERLACE_H
 
 #include "Image.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
 #include <mutex>
+#include <vector>
 #include <condition_variable>
 
 class Deinterlace {
+public:
+	// ブロックごとの動きの検出結果。静止しているブロックは補間せず、もう一方のフィールドをそのまま使う
+	struct MotionMap {
+		int block = 8; // ブロックの大きさ（画素）
+		int cols = 0;
+		int rows = 0;
+		std::vector<uint8_t> moving; // cols * rows 個。0 なら静止している
+	};
 private:
-	std::mutex mutex_;
+	struct Frame {
+		Image planar;
+		Image source; // 入力された画像。YUV422 では色差と補間しない行をここから書き出す
+		bool ready = false; // planar の準備ができた
+		bool done = false; // 前のフレームの参照を終えた
+	};
+	mutable std::mutex mutex_;
 	std::condition_variable cond_;
-	int image_index_ = 0;
-	int image_count_ = 0;
+	std::map<uint64_t, Frame> history_; // 通し番号ごとの直近のフレーム
+	std::atomic<uint64_t> next_sequence_{0};
+	MotionMap motion_map_;
 	static const int NBUF = 8;
-	Image image_buffer_[NBUF];
-	template <typename T> Image process(const Image &input);
+	template <typename T> std::vector<Image> process(const Image &input, uint64_t sequence, bool fields, bool tff);
+	std::vector<Image> dispatch(const Image &input, uint64_t sequence, bool fields, bool tff);
 public:
+	// 直近に処理したフレームの動きの検出結果（表示のデバッグ用）
+	MotionMap motionMap() const;
+	// 動いているところに縞のないフレームはそのまま返し、テレシネの縞は前後のフレームのフィールドと組み合わせて取り除く
 	Image deinterlace(const Image &input);
+	// 複数のスレッドから呼ぶときは入力の順に sequence を付け、その順に reserve してから deinterlace を呼ぶ
+	// 欠番があってもよいが、reserve した番号は必ず deinterlace に渡すこと
+	void reserve(uint64_t sequence);
+	Image deinterlace(const Image &input, uint64_t sequence);
+	// フィールドごとに補間した2枚の画像を時間の順に返す（フレームレートが2倍になる）
+	// tff が false ならボトムフィールドが先
+	std::vector<Image> deinterlaceFields(const Image &input, bool tff);
+	std::vector<Image> deinterlaceFields(const Image &input, uint64_t sequence, bool tff);
 };
 
 #endif
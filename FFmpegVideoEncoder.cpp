@@ -1,11 +1,17 @@
 #include "VideoFrameData.h"
 #include "FFmpegVideoEncoder.h"
+#include "AsyncFileWriter.h"
+#include "Deinterlace.h"
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <cmath>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 #ifdef USE_FFMPEG
 #include "includeffmpeg.h"
@@ -35,37 +41,141 @@ void print_averror(int ret)
 	fprintf(stderr, "%s\n", msg.c_str());
 }
 
-int write_frame(AVCodecContext const *cc, AVFormatContext *fmt_ctx, const AVRational *time_base, AVStream *st, AVPacket *pkt)
+// AVIOContext の書き込み先を AsyncFileWriter にする。ディスクが詰まっても、バッファが埋まるまでは書き出すスレッドを止めない
+const int IO_BUFFER_SIZE = 256 * 1024;
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int write_output(void *opaque, uint8_t const *buf, int size)
+#else
+int write_output(void *opaque, uint8_t *buf, int size)
+#endif
 {
-	av_packet_rescale_ts(pkt, cc->time_base, st->time_base);
-	pkt->stream_index = st->index;
-	return av_interleaved_write_frame(fmt_ctx, pkt);
+	AsyncFileWriter *w = (AsyncFileWriter *)opaque;
+	return w->write(buf, size) ? size : AVERROR(w->error());
 }
 
-} // namespace
+int64_t seek_output(void *opaque, int64_t offset, int whence)
+{
+	AsyncFileWriter *w = (AsyncFileWriter *)opaque;
+	if (whence & AVSEEK_SIZE) return w->size();
+	return w->seek(offset, whence & ~AVSEEK_FORCE);
+}
+
+AVIOContext *open_output(AsyncFileWriter *writer, std::string const &path, OutputOption const &opt)
+{
+	AsyncFileWriter::Option o;
+	o.block_size = opt.buffer_size;
+	o.blocks = opt.buffers;
+	o.direct_io = opt.direct_io;
+	o.preallocate = opt.preallocate;
+	if (!writer->open(path, o)) return nullptr;
+	uint8_t *buffer = (uint8_t *)av_malloc(IO_BUFFER_SIZE);
+	AVIOContext *io = avio_alloc_context(buffer, IO_BUFFER_SIZE, 1, writer, nullptr, write_output, seek_output);
+	if (!io) {
+		av_free(buffer);
+		writer->close();
+	}
+	return io;
+}
 
-class FFmpegVideoEncoder::MyPicture {
-public:
-	int width = 0;
-	int height = 0;
-	uint8_t *pointers[4] = {};
-	int linesize[4] = {};
+// 残りを書き込んでから閉じる
+void close_output(AsyncFileWriter *writer, AVIOContext **io)
+{
+	if (!*io) return;
+	avio_flush(*io);
+	writer->close();
+	av_freep(&(*io)->buffer);
+	avio_context_free(io);
+}
 
-	int alloc(int width, int height, int pixfmt)
-	{
-		this->width = width;
-		this->height = height;
-		int r = av_image_alloc(pointers, linesize, width, height, (AVPixelFormat)pixfmt, 1);
-		if (r < 0) {
-			fprintf(stderr, "av_image_alloc failed\n");
-		}
-		return r;
+// sws_scale が直接読める画素形式。対応しない形式のときは AV_PIX_FMT_NONE
+AVPixelFormat source_pixel_format(Image::Format format)
+{
+	switch (format) {
+	case Image::Format::RGB8:
+		return AV_PIX_FMT_RGB24;
+	case Image::Format::UYVY8:
+		return AV_PIX_FMT_UYVY422;
+	case Image::Format::YUYV8:
+		return AV_PIX_FMT_YUYV422;
+	case Image::Format::YUYV16:
+		return AV_PIX_FMT_Y210LE;
+	case Image::Format::UINT8:
+		return AV_PIX_FMT_GRAY8;
+	case Image::Format::UINT16:
+		return AV_PIX_FMT_GRAY16LE;
+	default:
+		return AV_PIX_FMT_NONE;
 	}
-	void free()
-	{
-		av_freep(pointers);
+}
+
+// 変換を終えて符号化を待つフレームの上限
+const size_t MAX_CONVERTED_FRAMES = 3;
+
+// 片方のストリームのパケットが届かなくても、これを超えて溜まったら書き出す
+const size_t MAX_PENDING_PACKETS = 64;
+
+size_t image_bytes(Image const &image)
+{
+	return image ? (size_t)image.bytesPerLine() * image.height() : 0;
+}
+
+// 変換器を返す。条件が変わったときだけ作り直す
+// 1枚の画像を横長の帯に分け、CPU の数のスレッドで変換する（sws_scale_frame を使うときだけ有効）
+SwsContext *get_scaler(SwsContext *ctx, int sw, int sh, AVPixelFormat sf, int dw, int dh, AVPixelFormat df)
+{
+	if (ctx) {
+		int64_t v[6] = {};
+		av_opt_get_int(ctx, "srcw", 0, &v[0]);
+		av_opt_get_int(ctx, "srch", 0, &v[1]);
+		av_opt_get_int(ctx, "src_format", 0, &v[2]);
+		av_opt_get_int(ctx, "dstw", 0, &v[3]);
+		av_opt_get_int(ctx, "dsth", 0, &v[4]);
+		av_opt_get_int(ctx, "dst_format", 0, &v[5]);
+		if (v[0] == sw && v[1] == sh && v[2] == sf && v[3] == dw && v[4] == dh && v[5] == df) return ctx;
+		sws_freeContext(ctx);
 	}
-};
+	ctx = sws_alloc_context();
+	if (!ctx) return nullptr;
+	av_opt_set_int(ctx, "srcw", sw, 0);
+	av_opt_set_int(ctx, "srch", sh, 0);
+	av_opt_set_int(ctx, "src_format", sf, 0);
+	av_opt_set_int(ctx, "dstw", dw, 0);
+	av_opt_set_int(ctx, "dsth", dh, 0);
+	av_opt_set_int(ctx, "dst_format", df, 0);
+	av_opt_set_int(ctx, "sws_flags", SWS_BILINEAR, 0);
+	av_opt_set_int(ctx, "threads", 0, 0); // 0: CPU の数
+	if (sws_init_context(ctx, nullptr, nullptr) < 0) {
+		sws_freeContext(ctx);
+		return nullptr;
+	}
+	return ctx;
+}
+
+void release_image_buffer(void *opaque, uint8_t *)
+{
+	delete (Image *)opaque;
+}
+
+// 画像のバッファを複製せずに参照する AVFrame にする。AVFrame の参照がすべて外れるまで画像を解放しない
+bool wrap_image(Image const &image, AVFrame *frame)
+{
+	const size_t size = (size_t)image.bytesPerLine() * image.height();
+	Image *ref = new Image(image);
+	frame->buf[0] = av_buffer_create((uint8_t *)std::as_const(*ref).bits(), size, release_image_buffer, ref, AV_BUFFER_FLAG_READONLY);
+	if (!frame->buf[0]) {
+		delete ref;
+		return false;
+	}
+	frame->data[0] = frame->buf[0]->data;
+	frame->linesize[0] = image.bytesPerLine();
+	frame->width = image.width();
+	frame->height = image.height();
+	frame->format = source_pixel_format(image.format());
+	return true;
+}
+
+} // namespace
 
 struct FFmpegVideoEncoder::Private {
 	std::mutex mutex;
@@ -83,8 +193,6 @@ struct FFmpegVideoEncoder::Private {
 	bool audio_is_eof = false;
 	bool video_is_eof = false;
 
-	AVPixelFormat source_pixel_format = AV_PIX_FMT_YUYV422;
-
 	AVFrame *audio_frame = nullptr;
 	uint8_t **src_samples_data = 0;
 	int src_samples_linesize = 0;
@@ -96,24 +204,72 @@ struct FFmpegVideoEncoder::Private {
 	int samples_count = 0;
 	SwrContext *swr_ctx = nullptr;
 	SwsContext *sws_ctx = nullptr;
+	SwsContext *degraded_sws_ctx = nullptr; // 半分に縮めたフレーム用
 
-	double audio_pts = 0;
-	double video_pts = 0;
+	int64_t video_pts = 0; // 最後に符号化器に渡したフレームの pts（mutex で守る）
 
 	AVFormatContext *fc = nullptr;
 	AVCodecContext *video_codec_context = nullptr;
 	AVCodecContext *audio_codec_context = nullptr;
-	AVFrame *video_frame = nullptr;
-	FFmpegVideoEncoder::MyPicture src_picture;
-	FFmpegVideoEncoder::MyPicture dst_picture;
+	std::thread convert_thread; // 符号化の前に画素形式を変換するスレッド
+	bool convert_interrupted = false;
+	struct ConvertedFrame {
+		AVFrame *frame;
+		std::chrono::steady_clock::time_point enqueued;
+	};
+	std::deque<ConvertedFrame> converted_video_frames; // 変換を終えて符号化を待つフレーム
+	std::deque<AVFrame *> free_video_frames; // 符号化器に渡し終えたフレーム。バッファを再利用する
+
+	std::atomic<uint64_t> converted_frames = 0;
+	std::atomic<uint64_t> encoded_frames = 0;
+	std::atomic<uint64_t> dropped_video_frames = 0;
+	std::atomic<uint64_t> convert_nanoseconds = 0;
+	std::atomic<uint64_t> encode_nanoseconds = 0;
+	std::atomic<uint64_t> degraded_video_frames = 0;
+	std::atomic<uint64_t> latency_nanoseconds = 0;
+	std::atomic<uint64_t> max_latency_nanoseconds = 0;
 	int frame_count = 0;
 	AVStream *audio_st = nullptr;
 	AVStream *video_st = nullptr;
 
 	std::deque<VideoFrame> input_video_frames;
 	std::deque<AudioFrame> input_audio_frames;
+	size_t queued_bytes = 0; // input_video_frames の画像の合計
+	size_t max_queued_bytes = 0;
+	size_t max_video_queue = 0;
+
+	Deinterlace deinterlace;
+	struct Field {
+		Image image;
+		int64_t pts;
+		std::chrono::steady_clock::time_point enqueued;
+		bool degraded;
+	};
+	std::deque<Field> pending_fields; // フィールドごとに符号化するときの、まだ符号化していないフィールド
+	// deinterlaceFields は1つ前に渡したフレームのフィールドを返すので、そのフレームの時刻を覚えておく（画像は持たない）
+	bool has_field_source = false;
+	VideoFrame field_source;
+
+	int64_t time_origin = -1; // 記録を始めたときの入力装置の時刻（put_frame のスレッドだけが使う）
+	int64_t next_video_pts = 0; // 次に符号化できるフレームの pts（変換スレッドだけが使う）
+	int64_t audio_position = 0; // 次に符号化する音声のサンプルの位置
+
+	std::thread video_thread; // 映像を符号化するスレッド
+	std::thread audio_thread; // 音声を符号化するスレッド
+	std::thread thread; // 書き出すスレッド
+
+	// 符号化を終えて書き出しを待つパケット。audio_is_eof と video_is_eof もこれで守る
+	std::mutex mux_mutex;
+	std::condition_variable mux_cond;
+	std::deque<AVPacket *> video_packets;
+	std::deque<AVPacket *> audio_packets;
+
+	int64_t audio_input_end = 0; // 入力の音声の最後のサンプルの次の位置（mutex で守る）
+
+	OutputOption oopt;
+	AsyncFileWriter writer;
+	AVIOContext *io_context = nullptr;
 
-	std::thread thread;
 	int ret = 0;
 	bool interrupted = false;
 };
@@ -147,26 +303,52 @@ bool FFmpegVideoEncoder::is_interruption_requested() const
 
 void FFmpegVideoEncoder::default_get_audio_frame(int16_t *samples, int frame_size, int nb_channels)
 {
+	const int bytes_per_sample = nb_channels * sizeof(int16_t);
 	while (frame_size > 0) {
 		std::lock_guard lock(m->mutex);
 		if (m->input_audio_frames.empty()) break;
 		AudioFrame *frame = &m->input_audio_frames.front();
-		int n = frame->samples.size() / nb_channels / sizeof(int16_t);
+		if (frame->position) {
+			// 入力の時刻に合わせる。抜けているところは無音で埋め、書き出した範囲と重なるところは捨てる
+			const int64_t gap = *frame->position - m->audio_position;
+			if (gap > 0) {
+				const int n = (int)std::min<int64_t>(gap, frame_size);
+				memset(samples, 0, n * bytes_per_sample);
+				samples += n * nb_channels;
+				frame_size -= n;
+				m->audio_position += n;
+				continue;
+			}
+			if (gap < 0) {
+				const int n = (int)std::min<int64_t>(-gap, frame->samples.size() / bytes_per_sample);
+				frame->samples.remove(0, n * bytes_per_sample);
+				*frame->position += n;
+				if (frame->samples.size() < bytes_per_sample) {
+					m->input_audio_frames.pop_front();
+				}
+				continue;
+			}
+		}
+		int n = frame->samples.size() / bytes_per_sample;
 		n = std::min(n, frame_size);
 		frame_size -= n;
-		n *= nb_channels * sizeof(int16_t);
-		memcpy(samples, frame->samples.data(), n);
-		samples += n / sizeof(int16_t);
-		if (frame->samples.size() < n + nb_channels * sizeof(int16_t)) {
+		memcpy(samples, frame->samples.data(), n * bytes_per_sample);
+		samples += n * nb_channels;
+		m->audio_position += n;
+		if (frame->samples.size() < (n + 1) * bytes_per_sample) {
 			m->input_audio_frames.pop_front();
 		} else {
-			frame->samples.remove(0, n);
+			frame->samples.remove(0, n * bytes_per_sample);
+			if (frame->position) {
+				*frame->position += n;
+			}
 		}
 	}
 	int n = frame_size * nb_channels;
 	for (int i = 0; i < n; i++) {
 		samples[i] = 0;
 	}
+	m->audio_position += frame_size;
 }
 
 bool FFmpegVideoEncoder::get_audio_frame(int16_t *samples, int frame_size, int nb_channels)
@@ -199,7 +381,7 @@ bool FFmpegVideoEncoder::open_audio(AVCodecContext *cc, AVCodec const *codec, AV
 	m->ret = avcodec_parameters_from_context(cp, cc);
 
 	cp->frame_size = cc->frame_size;
-	m->src_nb_samples = cc->frame_size;
+	m->src_nb_samples = cc->frame_size > 0 ? cc->frame_size : 1024; // PCM はフレームの大きさを決めない
 	const int channels = cp->ch_layout.nb_channels;
 	m->ret = av_samples_alloc_array_and_samples(&m->src_samples_data, &m->src_samples_linesize, channels, m->src_nb_samples, AV_SAMPLE_FMT_S16, 0);
 	if (m->ret < 0) {
@@ -241,12 +423,27 @@ bool FFmpegVideoEncoder::open_audio(AVCodecContext *cc, AVCodec const *codec, AV
 	return true;
 }
 
-bool FFmpegVideoEncoder::next_audio_frame(AVCodecContext *cc, AVFormatContext *fc, AVStream *st, bool flush)
+// 符号化器から出てきたパケットを書き出しの待ち行列に積む
+void FFmpegVideoEncoder::receive_packets(AVCodecContext *cc, AVStream *st, std::deque<AVPacket *> *queue)
+{
+	AVPacket *pkt = av_packet_alloc();
+	while (avcodec_receive_packet(cc, pkt) == 0) {
+		av_packet_rescale_ts(pkt, cc->time_base, st->time_base);
+		pkt->stream_index = st->index;
+		std::lock_guard lock(m->mux_mutex);
+		queue->push_back(pkt);
+		m->mux_cond.notify_all();
+		pkt = av_packet_alloc();
+	}
+	av_packet_free(&pkt);
+}
+
+bool FFmpegVideoEncoder::next_audio_frame(AVCodecContext *cc, AVStream *st, bool flush)
 {
 	if (!st) return false;
 	if (!m->audio_frame) return false;
 
-	AVPacket pkt = {}; // data and size must be 0;
+	int ret;
 	int dst_nb_samples;
 	AVCodecParameters *cp = st->codecpar;
 	if (!flush) {
@@ -260,48 +457,37 @@ bool FFmpegVideoEncoder::next_audio_frame(AVCodecContext *cc, AVFormatContext *f
 			dst_nb_samples = av_rescale_rnd(swr_get_delay(m->swr_ctx, cp->sample_rate) + m->src_nb_samples, cp->sample_rate, cp->sample_rate, AV_ROUND_UP);
 			if (dst_nb_samples > m->max_dst_nb_samples) {
 				av_free(m->dst_samples_data[0]);
-				m->ret = av_samples_alloc(m->dst_samples_data, &m->dst_samples_linesize, channels, dst_nb_samples, (AVSampleFormat)cp->format, 0);
-				if (m->ret < 0) {
+				ret = av_samples_alloc(m->dst_samples_data, &m->dst_samples_linesize, channels, dst_nb_samples, (AVSampleFormat)cp->format, 0);
+				if (ret < 0) {
 					return false;
 				}
 				m->max_dst_nb_samples = dst_nb_samples;
 				m->dst_samples_size = av_samples_get_buffer_size(nullptr, channels, dst_nb_samples, (AVSampleFormat)cp->format, 0);
 			}
 			/* convert to destination format */
-			m->ret = swr_convert(m->swr_ctx, m->dst_samples_data, dst_nb_samples, (const uint8_t **)m->src_samples_data, m->src_nb_samples);
-			if (m->ret < 0) {
+			ret = swr_convert(m->swr_ctx, m->dst_samples_data, dst_nb_samples, (const uint8_t **)m->src_samples_data, m->src_nb_samples);
+			if (ret < 0) {
 				fprintf(stderr, "Error while converting\n");
 				return false;
 			}
-			dst_nb_samples = m->ret;
+			dst_nb_samples = ret;
 		} else {
 			dst_nb_samples = m->src_nb_samples;
 		}
 		m->audio_frame->nb_samples = dst_nb_samples;
 		AVRational rate = { 1, cp->sample_rate };
 		m->audio_frame->pts = av_rescale_q(m->samples_count, rate, st->time_base);
-		m->ret = avcodec_fill_audio_frame(m->audio_frame, channels, (AVSampleFormat)cp->format, m->dst_samples_data[0], m->dst_samples_size, 0);
+		ret = avcodec_fill_audio_frame(m->audio_frame, channels, (AVSampleFormat)cp->format, m->dst_samples_data[0], m->dst_samples_size, 0);
 		m->samples_count += dst_nb_samples;
 	}
 
-	m->ret = avcodec_send_frame(cc, flush ? nullptr : m->audio_frame);
-	if (m->ret < 0 && m->ret != AVERROR_EOF) {
+	ret = avcodec_send_frame(cc, flush ? nullptr : m->audio_frame);
+	if (ret < 0 && ret != AVERROR_EOF) {
 		fprintf(stderr, "error during sending frame");
 		return false;
 	}
 
-	while (avcodec_receive_packet(cc, &pkt) == 0) {
-		m->ret = write_frame(cc, fc, &st->time_base, st, &pkt);
-		if (m->ret != 0) {
-			printf("av_write_frame failed\n");
-		}
-	}
-
-	if (flush) {
-		m->audio_is_eof = true;
-	}
-
-	m->audio_pts = (double)m->samples_count * st->time_base.den / st->time_base.num / cp->sample_rate;
+	receive_packets(cc, st, &m->audio_packets);
 	return true;
 }
 
@@ -321,6 +507,9 @@ void FFmpegVideoEncoder::close_audio()
 		av_free(m->src_samples_data[0]);
 		av_free(m->src_samples_data);
 	}
+	m->src_samples_data = nullptr;
+	m->dst_samples_data = nullptr;
+	swr_free(&m->swr_ctx);
 	av_frame_free(&m->audio_frame);
 }
 
@@ -330,26 +519,79 @@ void FFmpegVideoEncoder::default_get_video_frame(VideoFrame *out)
 	if (!m->input_video_frames.empty()) {
 		std::swap(*out, m->input_video_frames.front());
 		m->input_video_frames.pop_front();
+		m->queued_bytes -= image_bytes(out->image);
+		m->cond.notify_all(); // Block のときは put_video_frame が空きを待っている
 	}
 }
 
-bool FFmpegVideoEncoder::get_video_frame(MyPicture *pict)
+// 入力の時刻を符号化器の time_base に換算する。時刻が不明なら前のフレームの次とする
+int64_t FFmpegVideoEncoder::video_pts(VideoFrame const &frame)
 {
-	VideoFrame frame;
-	default_get_video_frame(&frame);
-	if (frame.width() != pict->width || frame.height() != pict->height) return false;
+	if (frame.time_scale <= 0) return m->next_video_pts;
+	return av_rescale_q_rnd(frame.time, {1, (int)frame.time_scale}, m->video_codec_context->time_base, (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+}
 
-	frame.image = frame.image.convertToFormat(Image::Format::YUYV8);
-	uint8_t *p = pict->pointers[0];
-	memcpy(p, frame.image.bits(), frame.image.bytesPerLine() * frame.height());
+bool FFmpegVideoEncoder::get_video_frame(Image *out, int64_t *pts, std::chrono::steady_clock::time_point *enqueued)
+{
+	Image image;
+	bool degraded = false;
+	if (m->vopt.field_rate) {
+		// 1フレームから2つのフィールドを作り、1回に1つずつ渡す
+		if (m->pending_fields.empty()) {
+			VideoFrame frame;
+			default_get_video_frame(&frame);
+			if (frame.degraded) {
+				// 縦に半分にしたときに片方のフィールドだけになっているので、補間せずに2回使う
+				int64_t t = video_pts(frame);
+				m->pending_fields.push_back({frame.image, t, frame.enqueued, true});
+				m->pending_fields.push_back({frame.image, t + 1, frame.enqueued, true});
+				// 補間を待っているフレームはこれより前の時刻なので、次に返されても捨てる
+				m->has_field_source = false;
+			} else if (frame) {
+				std::vector<Image> fields = m->deinterlace.deinterlaceFields(frame.image, frame.top_field_first);
+				// 最初のフレームには前のフレームがないので、返されたフィールドは使わない
+				if (m->has_field_source) {
+					int64_t t = video_pts(m->field_source);
+					for (Image const &field : fields) {
+						m->pending_fields.push_back({field, t++, m->field_source.enqueued, false});
+					}
+				}
+				frame.image = {};
+				m->field_source = frame;
+				m->has_field_source = true;
+			}
+		}
+		if (!m->pending_fields.empty()) {
+			image = m->pending_fields.front().image;
+			*pts = m->pending_fields.front().pts;
+			*enqueued = m->pending_fields.front().enqueued;
+			degraded = m->pending_fields.front().degraded;
+			m->pending_fields.pop_front();
+		}
+	} else {
+		VideoFrame frame;
+		default_get_video_frame(&frame);
+		image = frame.image;
+		*pts = video_pts(frame);
+		*enqueued = frame.enqueued;
+		degraded = frame.degraded;
+	}
+	if (!image) return false;
+	if (!degraded && (image.width() != m->vopt.src_w || image.height() != m->vopt.src_h)) {
+		m->dropped_video_frames++;
+		return false;
+	}
 
+	// sws_scale が読めない形式のときだけ変換する
+	if (source_pixel_format(image.format()) == AV_PIX_FMT_NONE) {
+		image = image.convertToFormat(m->vopt.bit_depth > 8 ? Image::Format::YUYV16 : Image::Format::YUYV8);
+	}
+	*out = image;
 	return true;
 }
 
 bool FFmpegVideoEncoder::open_video(AVCodecContext *cc, AVCodec const *codec, AVStream *st, VideoOption const &opt)
 {
-	AVCodecParameters *c = st->codecpar;
-
 	AVDictionary *codec_options = nullptr;
 
 	m->ret = avcodec_open2(cc, codec, &codec_options);
@@ -360,72 +602,185 @@ bool FFmpegVideoEncoder::open_video(AVCodecContext *cc, AVCodec const *codec, AV
 
 	m->ret = avcodec_parameters_from_context(st->codecpar, cc);
 
-	m->video_frame = av_frame_alloc();
-	if (!m->video_frame) {
-		fprintf(stderr, "av_frame_alloc failed\n");
-		return false;
-	}
-	m->video_frame->format = c->format;
-	m->video_frame->width = c->width;
-	m->video_frame->height = c->height;
+	return true;
+}
 
-	m->ret = m->dst_picture.alloc(c->width, c->height, c->format);
-	if (m->ret < 0) return false;
+// 入力の画像を符号化器の画素形式に変換して converted_video_frames に積む。符号化スレッドと並行して動く
+void FFmpegVideoEncoder::convert_video_frames()
+{
+	AVCodecContext const *cc = m->video_codec_context;
+	AVFrame *src = av_frame_alloc();
+	while (1) {
+		Image image;
+		int64_t pts = 0;
+		std::chrono::steady_clock::time_point enqueued;
+		{
+			std::unique_lock lock(m->mutex);
+			// 符号化が追いつくまで待つ
+			while (!m->convert_interrupted && m->converted_video_frames.size() >= MAX_CONVERTED_FRAMES) {
+				m->cond.wait(lock);
+			}
+			if (m->convert_interrupted) break;
+		}
+		if (!get_video_frame(&image, &pts, &enqueued)) {
+			std::unique_lock lock(m->mutex);
+			if (!m->convert_interrupted && m->input_video_frames.empty() && m->pending_fields.empty()) {
+				m->cond.wait(lock);
+			}
+			continue;
+		}
+		// 前のフレームと時刻が重なるフレームは捨てる。抜けたフレームの分は pts を空けたままにする
+		if (pts < m->next_video_pts) {
+			m->dropped_video_frames++;
+			continue;
+		}
+		m->next_video_pts = pts + 1;
+
+		auto t0 = std::chrono::steady_clock::now();
+		AVFrame *dst = nullptr;
+		{
+			std::lock_guard lock(m->mutex);
+			if (!m->free_video_frames.empty()) {
+				dst = m->free_video_frames.front();
+				m->free_video_frames.pop_front();
+			}
+		}
+		if (!dst) {
+			dst = av_frame_alloc();
+		}
+
+		// 符号化器がそのまま読める形式なら、変換せずに画像のバッファを渡す
+		const bool passthrough = source_pixel_format(image.format()) == cc->pix_fmt && image.width() == cc->width && image.height() == cc->height;
+		bool ok = false;
+		if (passthrough) {
+			av_frame_unref(dst);
+			ok = wrap_image(image, dst);
+		} else {
+			ok = convert_video_frame(image, src, dst);
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		m->convert_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+		m->converted_frames++;
 
-	m->ret = m->src_picture.alloc(opt.src_w, opt.src_h, m->source_pixel_format);
-	if (m->ret < 0) return false;
+		dst->pts = pts;
 
-	for (int i = 0; i < 4; i++) {
-		m->video_frame->data[i] = m->dst_picture.pointers[i];
-		m->video_frame->linesize[i] = m->dst_picture.linesize[i];
+		std::lock_guard lock(m->mutex);
+		if (ok) {
+			m->converted_video_frames.push_back({dst, enqueued});
+		} else {
+			m->free_video_frames.push_back(dst);
+		}
+		m->cond.notify_all();
 	}
+	av_frame_free(&src);
+}
 
-	return true;
+// image を符号化器の画素形式と大きさに変換して dst に書く
+bool FFmpegVideoEncoder::convert_video_frame(Image const &image, AVFrame *src, AVFrame *dst)
+{
+	AVCodecContext const *cc = m->video_codec_context;
+	// 符号化器がまだ参照しているバッファには書き込まない
+	if (!dst->buf[0] || !av_frame_is_writable(dst)) {
+		av_frame_unref(dst);
+		dst->format = cc->pix_fmt;
+		dst->width = cc->width;
+		dst->height = cc->height;
+		if (av_frame_get_buffer(dst, 0) < 0) {
+			fprintf(stderr, "av_frame_get_buffer failed\n");
+			return false;
+		}
+	}
+
+	// 縮めたフレームが混じっても変換器を作り直さないように、大きさごとに持つ
+	const bool full = image.width() == m->vopt.src_w && image.height() == m->vopt.src_h;
+	SwsContext *&sws = full ? m->sws_ctx : m->degraded_sws_ctx;
+	sws = get_scaler(sws, image.width(), image.height(), source_pixel_format(image.format()), cc->width, cc->height, cc->pix_fmt);
+	if (!sws) {
+		fprintf(stderr, "Could not initialize the conversion context\n");
+		return false;
+	}
+	const bool ok = wrap_image(image, src) && sws_scale_frame(sws, dst, src) >= 0;
+	av_frame_unref(src);
+	if (!ok) {
+		fprintf(stderr, "sws_scale_frame failed\n");
+	}
+	return ok;
+}
+
+// 変換スレッドを止めて、変換済みのフレームを捨てる
+void FFmpegVideoEncoder::stop_video_conversion()
+{
+	{
+		std::lock_guard lock(m->mutex);
+		m->convert_interrupted = true;
+		m->cond.notify_all();
+	}
+	if (m->convert_thread.joinable()) {
+		m->convert_thread.join();
+	}
+	for (auto &f : m->converted_video_frames) {
+		av_frame_free(&f.frame);
+	}
+	m->converted_video_frames.clear();
+	for (AVFrame *f : m->free_video_frames) {
+		av_frame_free(&f);
+	}
+	m->free_video_frames.clear();
+	m->pending_fields.clear();
 }
 
-bool FFmpegVideoEncoder::next_video_frame(AVCodecContext *cc, AVFormatContext *fc, AVStream *st, bool flush)
+bool FFmpegVideoEncoder::next_video_frame(AVCodecContext *cc, AVStream *st, bool flush)
 {
 	if (!st) return false;
-	if (!m->video_frame) return false;
 
-	AVCodecParameters *c = st->codecpar;
+	// 変換は convert_video_frames で済んでいる
+	AVFrame *frame = nullptr;
+	std::chrono::steady_clock::time_point enqueued;
 	if (!flush) {
-		if (!m->sws_ctx) {
-			m->sws_ctx = sws_getContext(m->src_picture.width, m->src_picture.height, m->source_pixel_format, c->width, c->height, (AVPixelFormat)c->format, SWS_BILINEAR, nullptr, nullptr, nullptr);
-			if (!m->sws_ctx) {
-				fprintf(stderr, "Could not initialize the conversion context\n");
-				exit(1);
-			}
-		}
-		if (!get_video_frame(&m->src_picture)) {
-			return false;
-		}
-		sws_scale(m->sws_ctx, (const uint8_t * const *)m->src_picture.pointers, m->src_picture.linesize, 0, m->src_picture.height, m->dst_picture.pointers, m->dst_picture.linesize);
+		std::lock_guard lock(m->mutex);
+		if (m->converted_video_frames.empty()) return false;
+		frame = m->converted_video_frames.front().frame;
+		enqueued = m->converted_video_frames.front().enqueued;
+		m->converted_video_frames.pop_front();
 	}
+	int ret;
 	{
-		AVPacket pkt = {};
-
-		m->video_frame->pts = m->frame_count;
+		auto t0 = std::chrono::steady_clock::now();
+		if (frame) {
+			const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t0 - enqueued).count();
+			m->latency_nanoseconds += ns;
+			if (ns > m->max_latency_nanoseconds) {
+				m->max_latency_nanoseconds = ns; // 書き込むのはこのスレッドだけ
+			}
+		}
 
-		m->ret = avcodec_send_frame(cc, flush ? nullptr : m->video_frame);
-		if (m->ret < 0 && m->ret != AVERROR_EOF) {
+		ret = avcodec_send_frame(cc, frame);
+		if (frame) {
+			// 音声のスレッドは映像の時刻を見て、入力のない区間を無音で埋める
+			std::lock_guard lock(m->mutex);
+			m->video_pts = frame->pts;
+			if (!av_frame_is_writable(frame)) {
+				av_frame_unref(frame); // 入力の画像を参照しているか、符号化器と共有している。使い回さないので、すぐに手放す
+			}
+			m->free_video_frames.push_back(frame);
+			m->cond.notify_all();
+		}
+		if (ret < 0 && ret != AVERROR_EOF) {
 			fprintf(stderr, "avcodec_send_frame failed\n");
 			return false;
 		}
 
-		while (avcodec_receive_packet(cc, &pkt) == 0) {
-			m->ret = write_frame(cc, fc, &st->time_base, st, &pkt);
-		}
-
-		if (flush) {
-			m->video_is_eof = true;
+		receive_packets(cc, st, &m->video_packets);
+		auto t1 = std::chrono::steady_clock::now();
+		if (frame) {
+			m->encode_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+			m->encoded_frames++;
 		}
 	}
-	if (m->ret < 0) {
-		print_averror(m->ret);
+	if (ret < 0 && ret != AVERROR_EOF) {
+		print_averror(ret);
 		exit(1);
 	}
-	m->video_pts = m->video_frame->pts;
 	m->frame_count++;
 	return true;
 }
@@ -436,13 +791,44 @@ void FFmpegVideoEncoder::close_video()
 		avcodec_close(m->video_codec_context);
 		avcodec_free_context(&m->video_codec_context);
 	}
-	m->src_picture.free();
-	m->dst_picture.free();
-	av_frame_free(&m->video_frame);
+	sws_freeContext(m->sws_ctx);
+	m->sws_ctx = nullptr;
+	sws_freeContext(m->degraded_sws_ctx);
+	m->degraded_sws_ctx = nullptr;
 }
 
 namespace {
 
+// 10ビットのときはコーデックが対応する形式から選ぶ
+AVPixelFormat video_pixel_format(AVCodec const *codec, int bit_depth)
+{
+	switch (codec->id) {
+	case AV_CODEC_ID_RAWVIDEO:
+		return AV_PIX_FMT_UYVY422; // 入力の形式のまま書く
+	case AV_CODEC_ID_V210:
+		return AV_PIX_FMT_YUV422P10LE;
+	case AV_CODEC_ID_FFV1:
+	case AV_CODEC_ID_UTVIDEO:
+		// 色差を間引かない
+		if (bit_depth > 8 && codec->pix_fmts) {
+			for (AVPixelFormat const *p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+				if (*p == AV_PIX_FMT_YUV422P10LE) return *p;
+			}
+		}
+		return AV_PIX_FMT_YUV422P;
+	default:
+		break;
+	}
+	if (bit_depth > 8 && codec->pix_fmts) {
+		for (AVPixelFormat f : {AV_PIX_FMT_YUV422P10LE, AV_PIX_FMT_P010LE, AV_PIX_FMT_YUV420P10LE}) {
+			for (AVPixelFormat const *p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+				if (*p == f) return f;
+			}
+		}
+	}
+	return AV_PIX_FMT_YUV420P;
+}
+
 AVCodecContext *new_codec_context(AVFormatContext *fc, AVCodec const *codec, AudioOption const &aopt, VideoOption const &vopt)
 {
 	AVCodecContext *cc = avcodec_alloc_context3(codec);
@@ -455,9 +841,9 @@ AVCodecContext *new_codec_context(AVFormatContext *fc, AVCodec const *codec, Aud
 	case AVMEDIA_TYPE_VIDEO:
 		cc->width = vopt.dst_w;
 		cc->height = vopt.dst_h;
-		cc->pix_fmt = AV_PIX_FMT_YUV420P;
+		cc->pix_fmt = video_pixel_format(codec, vopt.bit_depth);
 		cc->time_base.num = vopt.fps.den;
-		cc->time_base.den = vopt.fps.num;
+		cc->time_base.den = vopt.fps.num * (vopt.field_rate ? 2 : 1); // フィールドごとのときは2倍のレート
 		cc->bit_rate = cc->width * cc->height * 8;
 
 		cc->gop_size = 12;
@@ -474,6 +860,18 @@ AVCodecContext *new_codec_context(AVFormatContext *fc, AVCodec const *codec, Aud
 			 * the motion of the chroma plane does not match the luma plane. */
 			cc->mb_decision = 2;
 		}
+		if (cc->codec_id == AV_CODEC_ID_RAWVIDEO || cc->codec_id == AV_CODEC_ID_V210 || cc->codec_id == AV_CODEC_ID_FFV1 || cc->codec_id == AV_CODEC_ID_UTVIDEO) {
+			// 取り込み用。すべてキーフレームにして、符号化器が対応するスレッドをすべて使う
+			cc->gop_size = 1;
+			cc->bit_rate = 0;
+			cc->thread_count = 0;
+			cc->thread_type = FF_THREAD_SLICE | FF_THREAD_FRAME;
+		}
+		if (cc->codec_id == AV_CODEC_ID_FFV1) {
+			cc->level = 3; // スライスに分けて並列に符号化できるのは version 3 から
+			cc->slices = 24;
+			av_opt_set_int(cc->priv_data, "slicecrc", 1, 0);
+		}
 		if (fc->flags & AVFMT_GLOBALHEADER) {
 			cc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 		}
@@ -508,44 +906,143 @@ AVStream *add_stream(AVFormatContext *fc, AVCodec const *codec, AVCodecContext c
 
 } // namespace
 
+// 1フレーム分の入力が揃ったか、映像がその先まで進んだか（入力のない区間は無音で埋める）
+bool FFmpegVideoEncoder::is_audio_frame_ready(int frame_size) const
+{
+	const int64_t end = m->audio_position + frame_size;
+	if (m->audio_input_end >= end) return true;
+	if (!m->video_st) return false;
+	return av_compare_ts(end, {1, m->aopt.sample_rate}, m->video_pts, m->video_codec_context->time_base) <= 0;
+}
+
+// 映像を符号化するスレッド。変換済みのフレームを符号化器に渡し、出てきたパケットを積む
+void FFmpegVideoEncoder::encode_video()
+{
+	while (1) {
+		{
+			std::unique_lock lock(m->mutex);
+			while (m->is_video_recording && m->converted_video_frames.empty()) {
+				m->cond.wait(lock);
+			}
+			if (!m->is_video_recording) break;
+		}
+		next_video_frame(m->video_codec_context, m->video_st, false);
+	}
+	stop_video_conversion();
+	next_video_frame(m->video_codec_context, m->video_st, true); // 符号化器に残っているパケットを出す
+
+	std::lock_guard lock(m->mux_mutex);
+	m->video_is_eof = true;
+	m->mux_cond.notify_all();
+}
+
+// 音声を符号化するスレッド。映像の符号化が遅れても止まらない
+void FFmpegVideoEncoder::encode_audio()
+{
+	const int frame_size = m->src_nb_samples;
+	while (1) {
+		{
+			std::unique_lock lock(m->mutex);
+			while (m->is_audio_recording && !is_audio_frame_ready(frame_size)) {
+				m->cond.wait(lock);
+			}
+			if (!m->is_audio_recording) break;
+		}
+		next_audio_frame(m->audio_codec_context, m->audio_st, false);
+	}
+	// 受け取った入力を書き出してから止める
+	while (1) {
+		{
+			std::lock_guard lock(m->mutex);
+			if (m->input_audio_frames.empty()) break;
+		}
+		next_audio_frame(m->audio_codec_context, m->audio_st, false);
+	}
+	next_audio_frame(m->audio_codec_context, m->audio_st, true);
+
+	std::lock_guard lock(m->mux_mutex);
+	m->audio_is_eof = true;
+	m->mux_cond.notify_all();
+}
+
+// 次に書き出すパケットを取り出す。映像と音声の時刻の早い方から書き、
+// 片方がまだ届いていないときは、そのストリームが終わったか、溜まりすぎたときだけ書く
+AVPacket *FFmpegVideoEncoder::take_packet()
+{
+	auto *vq = &m->video_packets;
+	auto *aq = &m->audio_packets;
+	const bool video_pending = m->video_st && !m->video_is_eof;
+	const bool audio_pending = m->audio_st && !m->audio_is_eof;
+	std::deque<AVPacket *> *q = nullptr;
+	if (!vq->empty() && !aq->empty()) {
+		q = av_compare_ts(vq->front()->dts, m->video_st->time_base, aq->front()->dts, m->audio_st->time_base) <= 0 ? vq : aq;
+	} else if (!vq->empty() && (!audio_pending || vq->size() > MAX_PENDING_PACKETS)) {
+		q = vq;
+	} else if (!aq->empty() && (!video_pending || aq->size() > MAX_PENDING_PACKETS)) {
+		q = aq;
+	}
+	if (!q) return nullptr;
+	AVPacket *pkt = q->front();
+	q->pop_front();
+	return pkt;
+}
+
+// 書き出すスレッド。符号化は encode_video と encode_audio がそれぞれのスレッドで行う
 void FFmpegVideoEncoder::run()
 {
 	m->recording_ready = true;
 
-	bool flush = false;
-	while ((m->is_video_recording && !m->video_is_eof) || (m->is_audio_recording && !m->audio_is_eof)) {
-		double audio_time = (m->audio_st && !m->audio_is_eof) ? m->audio_pts * av_q2d(m->audio_st->time_base) : INFINITY;
-		double video_time = (m->video_st && !m->video_is_eof) ? m->video_pts * av_q2d(m->video_codec_context->time_base) : INFINITY;
-
-		bool f = false;
-		if (m->audio_st && !m->audio_is_eof && audio_time <= video_time) {
-			f = next_audio_frame(m->audio_codec_context, m->fc, m->audio_st, flush);
-		} else if (m->video_st && !m->video_is_eof && video_time < audio_time) {
-			f = next_video_frame(m->video_codec_context, m->fc, m->video_st, flush);
+	while (1) {
+		AVPacket *pkt = nullptr;
+		{
+			std::unique_lock lock(m->mux_mutex);
+			pkt = take_packet();
+			if (!pkt) {
+				const bool video_done = !m->video_st || m->video_is_eof;
+				const bool audio_done = !m->audio_st || m->audio_is_eof;
+				if (video_done && audio_done && m->video_packets.empty() && m->audio_packets.empty()) break;
+				m->mux_cond.wait(lock);
+				continue;
+			}
 		}
-		if (!f) {
-			std::unique_lock lock(m->mutex);
-			m->cond.wait(lock);
+		int ret = av_interleaved_write_frame(m->fc, pkt);
+		if (ret < 0) {
+			fprintf(stderr, "av_interleaved_write_frame failed\n");
+			print_averror(ret);
 		}
+		av_packet_free(&pkt);
 	}
 
 	m->recording_ready = false;
 
-	av_write_trailer(m->fc);
-	if (!(m->fc->oformat->flags & AVFMT_NOFILE)) {
-		avio_close(m->fc->pb);
+	if (m->video_thread.joinable()) {
+		m->video_thread.join();
 	}
+	if (m->audio_thread.joinable()) {
+		m->audio_thread.join();
+	}
+
+	av_write_trailer(m->fc);
+	close_context();
+	m->ret = 0;
+}
 
+// 出力と符号化器を閉じて解放する。記録を終えたときと、create が途中で失敗したときに使う
+void FFmpegVideoEncoder::close_context()
+{
+	close_output(&m->writer, &m->io_context);
+	if (m->fc) {
+		m->fc->pb = nullptr;
+	}
 	close_video();
 	close_audio();
 	avformat_free_context(m->fc);
 	m->fc = nullptr;
 	m->video_st = nullptr;
 	m->audio_st = nullptr;
-	m->ret = 0;
 }
 
-bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, const VideoOption &vopt, const AudioOption &aopt)
+bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, const VideoOption &vopt, const AudioOption &aopt, OutputOption const &oopt)
 {
 	if (is_recording()) return false;
 
@@ -555,8 +1052,35 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 	m->format = format;
 	m->vopt = vopt;
 	m->aopt = aopt;
+	m->oopt = oopt;
 	m->is_video_recording = m->vopt.active;
 	m->is_audio_recording = m->aopt.active;
+	m->frame_count = 0;
+	m->samples_count = 0;
+	m->video_pts = 0;
+	m->audio_is_eof = false;
+	m->video_is_eof = false;
+	m->time_origin = -1;
+	m->next_video_pts = 0;
+	m->has_field_source = false;
+	m->audio_position = 0;
+	m->converted_frames = 0;
+	m->encoded_frames = 0;
+	m->dropped_video_frames = 0;
+	m->convert_nanoseconds = 0;
+	m->encode_nanoseconds = 0;
+	m->degraded_video_frames = 0;
+	m->latency_nanoseconds = 0;
+	m->max_latency_nanoseconds = 0;
+	{
+		std::lock_guard lock(m->mutex);
+		m->input_video_frames.clear();
+		m->input_audio_frames.clear();
+		m->queued_bytes = 0;
+		m->max_queued_bytes = 0;
+		m->max_video_queue = 0;
+		m->audio_input_end = 0;
+	}
 
 	av_log_set_level(AV_LOG_INFO);
 
@@ -590,6 +1114,21 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 		acodec = AV_CODEC_ID_AC3;
 		vcname = "libsvtav1";
 		break;
+	case Format::RAWVIDEO:
+		suffix = "mkv";
+		vcodec = m->vopt.bit_depth > 8 ? AV_CODEC_ID_V210 : AV_CODEC_ID_RAWVIDEO;
+		acodec = AV_CODEC_ID_PCM_S16LE;
+		break;
+	case Format::FFV1:
+		suffix = "mkv";
+		vcodec = AV_CODEC_ID_FFV1;
+		acodec = AV_CODEC_ID_PCM_S16LE;
+		break;
+	case Format::UTVIDEO:
+		suffix = "mkv";
+		vcodec = AV_CODEC_ID_UTVIDEO;
+		acodec = AV_CODEC_ID_PCM_S16LE;
+		break;
 	}
 
 	AVOutputFormat const *oformat = av_guess_format(suffix.c_str(), nullptr, nullptr);
@@ -619,11 +1158,10 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 		}
 	}
 
-	AVIOContext *io_context = nullptr;
 	if (!(oformat->flags & AVFMT_NOFILE)) {
-		m->ret = avio_open(&io_context, m->filepath.c_str(), AVIO_FLAG_WRITE);
-		if (m->ret < 0) {
-			fprintf(stderr, "avio_open failed\n");
+		m->io_context = open_output(&m->writer, m->filepath, m->oopt);
+		if (!m->io_context) {
+			fprintf(stderr, "could not open %s\n", m->filepath.c_str());
 			return false;
 		}
 	}
@@ -631,6 +1169,7 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 	m->ret = avformat_alloc_output_context2(&m->fc, oformat, nullptr, nullptr);
 	if (!m->fc) {
 		fprintf(stderr, "avformat_alloc_output_context2 failed\n");
+		close_context();
 		return false;
 	}
 
@@ -647,17 +1186,35 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 		av_channel_layout_default(&m->audio_st->codecpar->ch_layout, m->aopt.channels);
 	}
 
-	if (m->video_st && !open_video(m->video_codec_context, video_codec, m->video_st, m->vopt)) return false;
-	if (m->audio_st && !open_audio(m->audio_codec_context, audio_codec, m->audio_st, m->aopt)) return false;
+	if ((m->video_st && !open_video(m->video_codec_context, video_codec, m->video_st, m->vopt)) || (m->audio_st && !open_audio(m->audio_codec_context, audio_codec, m->audio_st, m->aopt))) {
+		close_context();
+		return false;
+	}
 
-	m->fc->pb = io_context;
+	m->fc->pb = m->io_context;
 	m->fc->flags |= AVFMT_GLOBALHEADER;
 	m->ret = avformat_write_header(m->fc, nullptr);
 	if (m->ret < 0) {
 		fprintf(stderr, "avformat_write_header failed\n");
+		close_context();
 		return false;
 	}
 
+	if (m->video_st) {
+		m->convert_interrupted = false;
+		m->convert_thread = std::thread([&](){
+			convert_video_frames();
+		});
+		m->video_thread = std::thread([&](){
+			encode_video();
+		});
+	}
+	if (m->audio_st) {
+		m->audio_thread = std::thread([&](){
+			encode_audio();
+		});
+	}
+
 	std::thread th([&](){ // start recording thread
 		run();
 	});
@@ -668,31 +1225,68 @@ bool FFmpegVideoEncoder::create(std::string const &filepath, Format format, cons
 
 void FFmpegVideoEncoder::close()
 {
-	m->is_video_recording = false;
-	m->is_audio_recording = false;
-	m->cond.notify_all();
+	{
+		std::lock_guard lock(m->mutex);
+		m->is_video_recording = false;
+		m->is_audio_recording = false;
+		m->cond.notify_all();
+	}
 	if (m->thread.joinable()) {
 		m->thread.join();
 	}
 }
 
+// 変換を待つフレームの合計が vopt.queue_bytes を超えないように積む。超えるときは overflow_policy に従う
 bool FFmpegVideoEncoder::put_video_frame(const VideoFrame &img)
 {
-	if (img) {
-		std::lock_guard lock(m->mutex);
-		if (m->is_video_recording) {
-			m->input_video_frames.push_back(img);
-//			fprintf(stderr, "video queue:%d\n", m->input_video_frames.size());
-			if (m->vopt.drop_if_overflow) {
-				while (m->input_video_frames.size() > 100) {
-					m->input_video_frames.pop_front();
-				}
+	if (!img) return false;
+
+	VideoFrame frame = img;
+	size_t bytes = image_bytes(frame.image);
+	std::unique_lock lock(m->mutex);
+	auto fits = [&](){
+		return m->input_video_frames.empty() || m->queued_bytes + bytes <= m->vopt.queue_bytes;
+	};
+	if (!m->is_video_recording) return false;
+	if (!fits()) {
+		switch (m->vopt.overflow_policy) {
+		case OverflowPolicy::Block:
+			while (m->is_video_recording && !fits()) {
+				m->cond.wait(lock);
 			}
-			m->cond.notify_all();
-			return true;
+			if (!m->is_video_recording) return false;
+			break;
+		case OverflowPolicy::DropNewest:
+			m->dropped_video_frames++;
+			return false;
+		case OverflowPolicy::Degrade:
+			if (!frame.degraded) {
+				lock.unlock(); // 縮めている間も変換スレッドが取り出せるように
+				frame.image = std::as_const(frame.image).halfSize();
+				frame.degraded = true;
+				bytes = image_bytes(frame.image);
+				lock.lock();
+				if (!m->is_video_recording) return false;
+				m->degraded_video_frames++;
+			}
+			break;
+		case OverflowPolicy::DropOldest:
+			break;
 		}
 	}
-	return false;
+	// 縮めても収まらないときは古いフレームから捨てる
+	while (!fits()) {
+		m->queued_bytes -= image_bytes(m->input_video_frames.front().image);
+		m->input_video_frames.pop_front();
+		m->dropped_video_frames++;
+	}
+	frame.enqueued = std::chrono::steady_clock::now();
+	m->input_video_frames.push_back(std::move(frame));
+	m->queued_bytes += bytes;
+	m->max_queued_bytes = std::max(m->max_queued_bytes, m->queued_bytes);
+	m->max_video_queue = std::max(m->max_video_queue, m->input_video_frames.size());
+	m->cond.notify_all();
+	return true;
 }
 
 bool FFmpegVideoEncoder::put_audio_frame(AudioFrame const &pcm)
@@ -700,6 +1294,8 @@ bool FFmpegVideoEncoder::put_audio_frame(AudioFrame const &pcm)
 	if (pcm) {
 		std::lock_guard lock(m->mutex);
 		if (m->is_audio_recording) {
+			const int64_t n = pcm.samples.size() / (m->aopt.channels * sizeof(int16_t));
+			m->audio_input_end = (pcm.position ? *pcm.position : m->audio_input_end) + n;
 			m->input_audio_frames.push_back(pcm);
 //			fprintf(stderr, "audio queue:%d\n", m->input_audio_frames.size());
 			if (m->aopt.drop_if_overflow) {
@@ -718,12 +1314,26 @@ void FFmpegVideoEncoder::put_frame(const VideoFrameData &frame)
 {
 	if (!m->recording_ready) return;
 
+	// 最初のフレームの時刻を 0 として、入力装置の時刻から pts と音声の位置を決める
+	const int64_t scale = frame.d->time_scale;
+	if (scale > 0 && m->time_origin < 0) {
+		m->time_origin = frame.d->stream_time;
+	}
+
 	VideoFrame v;
 	v.image = frame.d->image;
+	v.top_field_first = frame.isTopFieldFirst();
+	if (scale > 0) {
+		v.time = frame.d->stream_time - m->time_origin;
+		v.time_scale = scale;
+	}
 	put_video_frame(v);
 
 	AudioFrame a;
 	a.samples = frame.d->audio;
+	if (scale > 0) {
+		a.position = av_rescale_q_rnd(frame.d->audio_time - m->time_origin, {1, (int)scale}, {1, m->aopt.sample_rate}, (AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+	}
 	put_audio_frame(a);
 }
 
@@ -737,3 +1347,36 @@ const VideoOption *FFmpegVideoEncoder::video_option() const
 	return &m->vopt;
 }
 
+FFmpegVideoEncoder::Stats FFmpegVideoEncoder::stats() const
+{
+	Stats t;
+	{
+		std::lock_guard lock(m->mutex);
+		t.video_queue = m->input_video_frames.size();
+		t.converted_queue = m->converted_video_frames.size();
+		t.audio_queue = m->input_audio_frames.size();
+		t.queued_bytes = m->queued_bytes;
+		t.max_queued_bytes = m->max_queued_bytes;
+		t.max_video_queue = m->max_video_queue;
+	}
+	{
+		std::lock_guard lock(m->mux_mutex);
+		t.packet_queue = m->video_packets.size() + m->audio_packets.size();
+	}
+	t.video_frames = m->encoded_frames;
+	t.dropped_video_frames = m->dropped_video_frames;
+	t.degraded_video_frames = m->degraded_video_frames;
+	t.latency_ms = t.video_frames > 0 ? m->latency_nanoseconds / 1000000.0 / t.video_frames : 0;
+	t.max_latency_ms = m->max_latency_nanoseconds / 1000000.0;
+	AsyncFileWriter::Stats w = m->writer.stats();
+	t.written_bytes = w.bytes;
+	t.write_mbps = w.mbps;
+	t.write_queue = w.pending_blocks;
+	t.write_stalls = w.stalls;
+	t.max_write_ms = w.max_write_ms;
+	const uint64_t converted = m->converted_frames;
+	t.convert_ms = converted > 0 ? m->convert_nanoseconds / 1000000.0 / converted : 0;
+	t.encode_ms = t.video_frames > 0 ? m->encode_nanoseconds / 1000000.0 / t.video_frames : 0;
+	return t;
+}
+
@@ -9,11 +9,16 @@
 #include <vector>
 #include <QByteArray>
 #include <functional>
+#include <optional>
+#include <chrono>
+#include <deque>
 
 struct AVCodecContext;
 struct AVFormatContext;
 struct AVCodec;
 struct AVStream;
+struct AVPacket;
+struct AVFrame;
 
 class VideoFrameData;
 
@@ -21,6 +26,7 @@ namespace VideoEncoderInternal {
 class AudioFrame {
 public:
 	QByteArray samples;
+	std::optional<int64_t> position; // 記録を始めてからのサンプル数で表した最初のサンプルの位置
 	operator bool () const
 	{
 		return !samples.isEmpty();
@@ -29,6 +35,11 @@ public:
 class VideoFrame {
 public:
 	Image image;
+	bool top_field_first = true;
+	int64_t time = 0; // 記録を始めてからの時刻（time_scale 分の1秒単位）
+	int64_t time_scale = 0; // 0 なら時刻は不明
+	bool degraded = false; // 溢れそうになって縦横半分に縮めたフレーム
+	std::chrono::steady_clock::time_point enqueued; // 待ち行列に積んだ時刻
 	operator bool () const
 	{
 		return (bool)image;
@@ -46,20 +57,50 @@ public:
 
 class FFmpegVideoEncoder {
 public:
-	class MyPicture;
+	struct Stats {
+		size_t video_queue = 0; // 変換を待つフレーム
+		size_t converted_queue = 0; // 符号化を待つフレーム
+		size_t audio_queue = 0;
+		size_t packet_queue = 0; // 符号化を終えて書き出しを待つパケット
+		size_t queued_bytes = 0; // 変換を待つフレームの合計
+		size_t max_queued_bytes = 0; // 記録を始めてからの最大
+		size_t max_video_queue = 0;
+		uint64_t video_frames = 0; // 符号化したフレーム
+		uint64_t dropped_video_frames = 0;
+		uint64_t degraded_video_frames = 0;
+		double convert_ms = 0; // 1フレームあたりの平均
+		double encode_ms = 0;
+		double latency_ms = 0; // 積んでから符号化器に渡すまでの平均
+		double max_latency_ms = 0;
+		uint64_t written_bytes = 0;
+		double write_mbps = 0; // 記録を始めてからの平均 (MiB/s)
+		size_t write_queue = 0; // ファイルへの書き込みを待つブロック
+		uint64_t write_stalls = 0; // 書き込みが追いつかずに書き出しを待たせた回数
+		double max_write_ms = 0;
+	};
 private:
 	struct Private;
 	Private *m;
 
 	bool is_interruption_requested() const;
 	bool get_audio_frame(int16_t *samples, int frame_size, int nb_channels);
-	bool get_video_frame(MyPicture *pict);
+	int64_t video_pts(const VideoEncoderInternal::VideoFrame &frame);
+	bool get_video_frame(Image *out, int64_t *pts, std::chrono::steady_clock::time_point *enqueued);
+	bool convert_video_frame(Image const &image, AVFrame *src, AVFrame *dst);
+	void convert_video_frames();
+	void stop_video_conversion();
 	bool open_audio(AVCodecContext *cc, AVCodec const *codec, AVStream *st, const VideoEncoderOption::AudioOption &opt);
-	bool next_audio_frame(AVCodecContext *cc, AVFormatContext *fc, AVStream *st, bool flush);
+	void receive_packets(AVCodecContext *cc, AVStream *st, std::deque<AVPacket *> *queue);
+	bool next_audio_frame(AVCodecContext *cc, AVStream *st, bool flush);
+	bool is_audio_frame_ready(int frame_size) const;
+	void encode_audio();
 	void close_audio();
 	bool open_video(AVCodecContext *cc, const AVCodec *codec, AVStream *st, const VideoEncoderOption::VideoOption &opt);
-	bool next_video_frame(AVCodecContext *cc, AVFormatContext *fc, AVStream *st, bool flush);
+	bool next_video_frame(AVCodecContext *cc, AVStream *st, bool flush);
+	void encode_video();
 	void close_video();
+	AVPacket *take_packet();
+	void close_context();
 	void run();
 	bool put_video_frame(const VideoEncoderInternal::VideoFrame &img);
 	bool put_audio_frame(const VideoEncoderInternal::AudioFrame &pcm);
@@ -69,12 +110,13 @@ private:
 public:
 	FFmpegVideoEncoder();
 	virtual ~FFmpegVideoEncoder();
-	bool create(std::string const &filepath, VideoEncoderOption::Format format, VideoEncoderOption::VideoOption const &vopt, VideoEncoderOption::AudioOption const &aopt);
+	bool create(std::string const &filepath, VideoEncoderOption::Format format, VideoEncoderOption::VideoOption const &vopt, VideoEncoderOption::AudioOption const &aopt, VideoEncoderOption::OutputOption const &oopt = {});
 	void close();
 	bool is_recording() const;
 	void put_frame(const VideoFrameData &frame);
 	VideoEncoderOption::AudioOption const *audio_option() const;
 	VideoEncoderOption::VideoOption const *video_option() const;
+	Stats stats() const;
 };
 
 #endif // FFMPEGVIDEOENCODER_H
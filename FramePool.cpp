@@ -0,0 +1,108 @@
+#include "FramePool.h"
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// これより小さいブロックはmallocに任せる
+const size_t MIN_POOLED_SIZE = 64 * 1024;
+
+}
+
+struct FramePool::Private {
+	std::mutex mutex;
+	std::map<size_t, std::vector<void *>> free_blocks;
+	int max_blocks_per_size = 8;
+	size_t max_bytes = 512 * 1024 * 1024;
+	size_t pooled_blocks = 0;
+	size_t pooled_bytes = 0;
+	std::atomic_uint64_t hits = 0;
+	std::atomic_uint64_t misses = 0;
+	std::atomic_uint64_t discards = 0;
+};
+
+FramePool::Private *FramePool::instance()
+{
+	static Private pool;
+	return &pool;
+}
+
+void *FramePool::allocate(size_t size)
+{
+	if (size >= MIN_POOLED_SIZE) {
+		Private *m = instance();
+		{
+			std::lock_guard lock(m->mutex);
+			auto it = m->free_blocks.find(size);
+			if (it != m->free_blocks.end() && !it->second.empty()) {
+				void *p = it->second.back();
+				it->second.pop_back();
+				m->pooled_blocks--;
+				m->pooled_bytes -= size;
+				m->hits++;
+				return p;
+			}
+		}
+		m->misses++;
+	}
+	return malloc(size);
+}
+
+void FramePool::deallocate(void *ptr, size_t size)
+{
+	if (!ptr) return;
+	if (size >= MIN_POOLED_SIZE) {
+		Private *m = instance();
+		std::lock_guard lock(m->mutex);
+		std::vector<void *> *v = &m->free_blocks[size];
+		if ((int)v->size() < m->max_blocks_per_size && m->pooled_bytes + size <= m->max_bytes) {
+			v->push_back(ptr);
+			m->pooled_blocks++;
+			m->pooled_bytes += size;
+			return;
+		}
+		m->discards++;
+	}
+	free(ptr);
+}
+
+void FramePool::setLimits(int max_blocks_per_size, size_t max_bytes)
+{
+	Private *m = instance();
+	{
+		std::lock_guard lock(m->mutex);
+		m->max_blocks_per_size = max_blocks_per_size;
+		m->max_bytes = max_bytes;
+	}
+	clear();
+}
+
+void FramePool::clear()
+{
+	Private *m = instance();
+	std::lock_guard lock(m->mutex);
+	for (auto &pair : m->free_blocks) {
+		for (void *p : pair.second) {
+			free(p);
+		}
+	}
+	m->free_blocks.clear();
+	m->pooled_blocks = 0;
+	m->pooled_bytes = 0;
+}
+
+FramePool::Stats FramePool::stats()
+{
+	Private *m = instance();
+	Stats s;
+	s.hits = m->hits;
+	s.misses = m->misses;
+	s.discards = m->discards;
+	std::lock_guard lock(m->mutex);
+	s.pooled_blocks = m->pooled_blocks;
+	s.pooled_bytes = m->pooled_bytes;
+	return s;
+}
@@ -0,0 +1,28 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 画像バッファ用のサイズ別フリーリスト
+class FramePool {
+public:
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t discards = 0;
+		size_t pooled_blocks = 0;
+		size_t pooled_bytes = 0;
+	};
+private:
+	struct Private;
+	static Private *instance();
+public:
+	static void *allocate(size_t size);
+	static void deallocate(void *ptr, size_t size);
+	static void setLimits(int max_blocks_per_size, size_t max_bytes);
+	static void clear();
+	static Stats stats();
+};
+
+#endif // FRAMEPOOL_H
@@ -1,10 +1,14 @@
 
 #include "FrameProcessThread.h"
-#include "ImageUtil.h"
+#include "FrameRing.h"
+#include "ImageKernels.h"
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <optional>
 #include <thread>
-#include <deque>
 #include <QDebug>
 #include "Deinterlace.h"
 
@@ -14,20 +18,149 @@ extern "C" {
 }
 #endif
 
+namespace {
+
+struct Request {
+	std::optional<VideoFrameData> frame;
+	std::optional<VideoFrameData> second_field; // フィールドごとに出力するときの後のフィールド
+	QSize size;
+	uint64_t sequence = 0; // 投入順の通し番号
+	bool deinterlace = false;
+};
+
+typedef FrameRing<Request, 16> RequestRing;
+
+// 処理待ちのフレームがこの数を超えたら捨てる
+const size_t MAX_PENDING = 4;
+
+// パイプラインの1段。投入されたフレームを複数のスレッドで処理し、投入順に output へ渡す
+class Stage {
+public:
+	typedef std::function<void (Request &req)> Func;
+private:
+	RequestRing ring_;
+	std::mutex mutex_; // 処理スレッドの休止と再開にのみ使う
+	std::mutex claim_mutex_;
+	std::condition_variable cond_;
+	std::atomic_int sleepers_ = 0;
+	std::atomic_bool interrupted_ = false;
+	std::vector<std::thread> threads_;
+	Func claimed_;
+	Func process_;
+	Func output_;
+	std::atomic<uint64_t> frames_ = 0;
+	std::atomic<uint64_t> nanoseconds_ = 0;
+
+	bool claim(uint64_t *index, Request *req)
+	{
+		if (!claimed_) return ring_.claim(index, req);
+		// 取り出した順に claimed_ を呼ぶ
+		std::lock_guard lock(claim_mutex_);
+		if (!ring_.claim(index, req)) return false;
+		claimed_(*req);
+		return true;
+	}
+
+	void run()
+	{
+		while (!interrupted_) {
+			uint64_t index;
+			Request req;
+			if (!claim(&index, &req)) {
+				std::unique_lock lock(mutex_);
+				sleepers_++;
+				while (!interrupted_ && !ring_.hasPending()) {
+					cond_.wait(lock);
+				}
+				sleepers_--;
+				continue;
+			}
+
+			auto t0 = std::chrono::steady_clock::now();
+			process_(req);
+			auto t1 = std::chrono::steady_clock::now();
+			nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+			frames_++;
+
+			ring_.complete(index, std::move(req));
+			ring_.drain(output_);
+		}
+	}
+public:
+	// claimed は取り出した順に、処理を始める前に呼ばれる
+	void start(int threads, Func process, Func output, Func claimed = {})
+	{
+		stop();
+		claimed_ = claimed;
+		process_ = process;
+		output_ = output;
+		interrupted_ = false;
+		threads_.resize(threads);
+		for (size_t i = 0; i < threads_.size(); i++) {
+			threads_[i] = std::thread([this](){
+				run();
+			});
+		}
+	}
+	void stop()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			interrupted_ = true;
+		}
+		cond_.notify_all();
+		for (size_t i = 0; i < threads_.size(); i++) {
+			if (threads_[i].joinable()) {
+				threads_[i].join();
+			}
+		}
+		threads_.clear();
+		ring_.clear();
+	}
+	bool push(Request &&req)
+	{
+		if (!ring_.push(std::move(req))) return false;
+		if (sleepers_ > 0) {
+			std::lock_guard lock(mutex_);
+			cond_.notify_one();
+		}
+		return true;
+	}
+	void setDropPolicy(RequestRing::DropPolicy policy, size_t max_pending)
+	{
+		ring_.setDropPolicy(policy, max_pending);
+	}
+	FrameProcessThread::StageTiming timing() const
+	{
+		FrameProcessThread::StageTiming t;
+		t.frames = frames_;
+		t.dropped = ring_.stats().dropped;
+		t.average_ms = t.frames > 0 ? nanoseconds_ / 1000000.0 / t.frames : 0;
+		return t;
+	}
+};
+
+// 各段のスレッド数
+const int DEINTERLACE_THREADS = 2;
+const int SCALE_THREADS = 2;
+
+}
+
 struct FrameProcessThread::Private {
-	std::mutex mutex;
-	std::condition_variable cond;
-	bool interrupted = false;
-	std::vector<std::thread> thread;
-	std::deque<std::shared_ptr<VideoFrameData>> requested_frames;
-	QSize scaled_size;
+	Stage deinterlace_stage;
+	Stage scale_stage;
 	Deinterlace di;
-	bool deinterlace_enabled = true;
+	std::atomic_bool deinterlace_enabled = true;
+	std::atomic_bool field_rate = false;
+	uint64_t sequence = 0;
 };
 
 FrameProcessThread::FrameProcessThread()
 	: m(new Private)
 {
+	setDropPolicy(DropPolicy::DropOldest);
+	// 前段から投入順に渡されるので、後段の入口では捨てずに受け取る
+	m->scale_stage.setDropPolicy(RequestRing::DropPolicy::DropNewest, 16);
 }
 
 FrameProcessThread::~FrameProcessThread()
@@ -36,8 +169,42 @@ FrameProcessThread::~FrameProcessThread()
 	delete m;
 }
 
-static QImage scale(Image const &srcimg, int w, int h, QImage::Format f)
+namespace {
+
+#ifdef USE_FFMPEG
+struct ScalerCache {
+	SwsContext *context = nullptr;
+	~ScalerCache()
+	{
+		sws_freeContext(context);
+	}
+};
+#endif
+
+void release_pooled_qimage(void *cookie)
+{
+	delete (Image *)cookie;
+}
+
+// 画素バッファを FramePool から借りた QImage を作る。QImage が解放されるとバッファはプールに戻る
+QImage pooled_qimage(int w, int h, QImage::Format f)
 {
+	Image *buf = new Image(w, h, f == QImage::Format_Grayscale8 ? Image::Format::UINT8 : Image::Format::RGB8);
+	return QImage(buf->bits(), w, h, buf->bytesPerLine(), f, release_pooled_qimage, buf);
+}
+
+}
+
+QImage FrameProcessThread::scale(Image const &srcimg, int w, int h, QImage::Format f, bool reuse)
+{
+	// UYVY/YUYV は RGB への変換と縮小を同時に行う
+	if ((srcimg.format() == Image::Format::UYVY8 || srcimg.format() == Image::Format::YUYV8) && f == QImage::Format_RGB888) {
+		QImage newimg = reuse ? pooled_qimage(w, h, f) : QImage(w, h, f);
+		if (ImageKernels::scaleYUV422ToRGB(srcimg.bits(), srcimg.width(), srcimg.height(), srcimg.bytesPerLine(), srcimg.format() == Image::Format::UYVY8, newimg.bits(), w, h, newimg.bytesPerLine())) {
+			return newimg;
+		}
+	}
+
 #ifdef USE_FFMPEG
 	AVPixelFormat sf = AV_PIX_FMT_NONE;
 	AVPixelFormat df = AV_PIX_FMT_NONE;
@@ -52,6 +219,9 @@ static QImage scale(Image const &srcimg, int w, int h, QImage::Format f)
 	case Image::Format::YUYV8:
 		sf = AV_PIX_FMT_YUYV422;
 		break;
+	case Image::Format::YUYV16:
+		sf = AV_PIX_FMT_Y210LE;
+		break;
 	case Image::Format::UINT8:
 		sf = AV_PIX_FMT_GRAY8;
 		break;
@@ -70,15 +240,19 @@ static QImage scale(Image const &srcimg, int w, int h, QImage::Format f)
 		return {};
 	}
 
-	QImage newimg(w, h, f);
+	QImage newimg = reuse ? pooled_qimage(w, h, f) : QImage(w, h, f);
 
-	SwsContext *c = sws_getContext(srcimg.width(), srcimg.height(), sf, w, h, df, SWS_POINT, nullptr, nullptr, nullptr);
+	// 処理スレッドごとに変換器を持ち、条件が変わったとき（ウィンドウの大きさを変えたときなど）だけ作り直す
+	thread_local ScalerCache cache;
+	ScalerCache fresh;
+	ScalerCache &scaler = reuse ? cache : fresh;
+	scaler.context = sws_getCachedContext(scaler.context, srcimg.width(), srcimg.height(), sf, w, h, df, SWS_POINT, nullptr, nullptr, nullptr);
+	if (!scaler.context) return {};
 	uint8_t const *srcdata[] = { srcimg.bits() };
 	uint8_t *dstdata[] = { newimg.bits() };
 	int srclines[] = { srcimg.bytesPerLine() };
 	int dstlines[] = { newimg.bytesPerLine() };
-	sws_scale(c, srcdata, srclines, 0, srcimg.height(), dstdata, dstlines);
-	sws_freeContext(c);
+	sws_scale(scaler.context, srcdata, srclines, 0, srcimg.height(), dstdata, dstlines);
 #else
 	Image tmpimg = srcimg.convertToFormat(Image::Format::RGB8);
 	QImage newimg(tmpimg.width(), tmpimg.height(), QImage::Format_RGB888);
@@ -93,98 +267,100 @@ static QImage scale(Image const &srcimg, int w, int h, QImage::Format f)
 	return newimg;
 }
 
-void FrameProcessThread::run()
+void FrameProcessThread::start()
 {
-	while (1) {
-		std::shared_ptr<VideoFrameData> frame;
-		{
-			std::unique_lock lock(m->mutex);
-			if (m->interrupted) break;
-			for (size_t i = 0; i < m->requested_frames.size(); i++) {
-				if (m->requested_frames[i]->d->state == VideoFrameData::Idle) {
-					frame = m->requested_frames[i];
-					frame->d->state = VideoFrameData::Busy;
-					break;
-				}
-			}
-			if (!frame) {
-				m->cond.wait(lock);
-			}
-		}
-		if (frame) {
-			if (m->deinterlace_enabled) {
-				frame->d->image = m->di.deinterlace(frame->d->image);
-			}
+	stop();
 
-			// 画面表示用画像
-#ifdef USE_FFMPEG
-			frame->d->image_for_view = scale(frame->d->image, m->scaled_size.width(), m->scaled_size.height(), QImage::Format_RGB888);
-#else
-			frame->d->image_for_view = ImageUtil::qimage(frame->d->image).scaled(m->scaled_size, Qt::IgnoreAspectRatio, Qt::FastTransformation);
-#endif
-			frame->d->state = VideoFrameData::Ready;
+	// 後段：縮小して画面表示用の画像を作る
+	m->scale_stage.start(SCALE_THREADS, [](Request &req){
+		VideoFrameData &frame = *req.frame;
+		frame.d->image_for_view = scale(frame.d->image, req.size.width(), req.size.height(), QImage::Format_RGB888);
+		if (req.second_field) {
+			VideoFrameData &second = *req.second_field;
+			second.d->image_for_view = scale(second.d->image, req.size.width(), req.size.height(), QImage::Format_RGB888);
 		}
+	}, [&](Request &req){
+		emit ready(*req.frame);
+		if (req.second_field) {
+			emit ready(*req.second_field);
+		}
+	});
 
-		std::deque<std::shared_ptr<VideoFrameData>> results;
-		{
-			std::unique_lock lock(m->mutex);
-			while (!m->requested_frames.empty()) {
-				if (m->requested_frames.front()->d->state != VideoFrameData::Ready) break;
-				frame = m->requested_frames.front();
-				m->requested_frames.pop_front();
-				results.push_back(frame);
+	// 前段：デインタレース
+	m->deinterlace_stage.start(DEINTERLACE_THREADS, [&](Request &req){
+		if (req.deinterlace) {
+			VideoFrameData &frame = *req.frame;
+			if (m->field_rate) {
+				std::vector<Image> fields = m->di.deinterlaceFields(frame.d->image, req.sequence, frame.isTopFieldFirst());
+				if (fields.size() == 2) {
+					frame.d->image = fields[0];
+					// 後のフィールドは音声を持たない
+					VideoFrameData second;
+					*second.d = *frame.d;
+					second.d->audio = {};
+					second.d->image = fields[1];
+					second.d->second_field = true;
+					req.second_field = second;
+				}
+			} else {
+				frame.d->image = m->di.deinterlace(frame.d->image, req.sequence);
 			}
 		}
-		while (!results.empty()) {
-			frame = results.front();
-			results.pop_front();
-			emit ready(*frame);
+	}, [&](Request &req){
+		m->scale_stage.push(std::move(req));
+	}, [&](Request &req){
+		// 前後のフレームを正しく参照できるように、投入順に予約する
+		// プログレッシブ (PsF を含む) の入力はデインタレースしない。それ以外でも縞がなければ Deinterlace がそのまま返す
+		req.deinterlace = m->deinterlace_enabled && !req.frame->isProgressive();
+		if (req.deinterlace) {
+			m->di.reserve(req.sequence);
 		}
-	}
-}
-
-void FrameProcessThread::start()
-{
-	stop();
-	m->thread.resize(4);
-	for (size_t i = 0; i < m->thread.size(); i++) {
-		m->thread[i] = std::thread([&](){
-			run();
-		});
-	}
+	});
 }
 
 void FrameProcessThread::stop()
 {
-	{
-		std::lock_guard lock(m->mutex);
-		m->interrupted = true;
-		m->requested_frames = {};
-	}
-	m->cond.notify_all();
-	for (size_t i = 0; i < m->thread.size(); i++) {
-		if (m->thread[i].joinable()) {
-			m->thread[i].join();
-		}
-	}
-	m->thread.clear();
-	m->interrupted = false;
+	m->deinterlace_stage.stop();
+	m->scale_stage.stop();
 }
 
 void FrameProcessThread::request(VideoFrameData const &image, const QSize &size)
 {
 	if (image && size.width() > 0 && size.height() > 0) {
-		std::lock_guard lock(m->mutex);
-		while (m->requested_frames.size() > 4) {
-			m->requested_frames.pop_back(); // drop
-		}
-		m->requested_frames.push_back(std::make_shared<VideoFrameData>(image));
-		m->scaled_size = size;
-		m->cond.notify_all();
+		Request req;
+		req.frame = image;
+		req.size = size;
+		req.sequence = m->sequence++;
+		m->deinterlace_stage.push(std::move(req));
 	}
 }
 
+void FrameProcessThread::setDropPolicy(DropPolicy policy)
+{
+	m->deinterlace_stage.setDropPolicy(policy == DropPolicy::DropNewest ? RequestRing::DropPolicy::DropNewest : RequestRing::DropPolicy::DropOldest, MAX_PENDING);
+}
+
+FrameProcessThread::StageTiming FrameProcessThread::deinterlaceTiming() const
+{
+	return m->deinterlace_stage.timing();
+}
+
+FrameProcessThread::StageTiming FrameProcessThread::scaleTiming() const
+{
+	return m->scale_stage.timing();
+}
+
+Deinterlace::MotionMap FrameProcessThread::motionMap() const
+{
+	return m->di.motionMap();
+}
+
 void FrameProcessThread::enableDeinterlace(bool enable)
 {
 	m->deinterlace_enabled = enable;
 }
+
+void FrameProcessThread::enableFieldRate(bool enable)
+{
+	m->field_rate = enable;
+}
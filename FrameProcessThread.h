@@ -1,6 +1,7 @@
 #ifndef FRAMEPROCESSTHREAD_H
 #define FRAMEPROCESSTHREAD_H
 
+#include "Deinterlace.h"
 #include "Image.h"
 #include "VideoFrameData.h"
 #include <QImage>
@@ -12,17 +13,34 @@ class VideoFrameData;
 
 class FrameProcessThread : public QObject {
 	Q_OBJECT
+public:
+	enum class DropPolicy {
+		DropOldest,
+		DropNewest,
+	};
+	struct StageTiming {
+		uint64_t frames = 0;
+		uint64_t dropped = 0;
+		double average_ms = 0;
+	};
 private:
 	struct Private;
 	Private *m;
-	void run();
 public:
 	FrameProcessThread();
 	~FrameProcessThread() override;
 	void start();
 	void stop();
 	void request(const VideoFrameData &image, QSize const &size);
+	void setDropPolicy(DropPolicy policy);
+	StageTiming deinterlaceTiming() const;
+	StageTiming scaleTiming() const;
+	Deinterlace::MotionMap motionMap() const;
 	void enableDeinterlace(bool enable);
+	// インタレースの入力をフィールドごとに補間し、2倍のフレームレートで出力する
+	void enableFieldRate(bool enable);
+	// 画面表示用に縮小する。reuse が false なら変換器と出力のバッファを毎回作る（pipelinebench で比べるため）
+	static QImage scale(Image const &srcimg, int w, int h, QImage::Format f, bool reuse = true);
 signals:
 	void ready(VideoFrameData const &image);
 };
@@ -0,0 +1,178 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// 1つの生産者と複数の処理スレッドで使う固定長のリングバッファ
+// 投入(push)した順に処理スレッドが取り出し(claim)、処理の終わった要素を投入順に取り出す(drain)
+template <typename T, size_t N> class FrameRing {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+public:
+	enum class DropPolicy {
+		DropOldest, // 未処理の最も古い要素を捨てて投入する
+		DropNewest, // 投入しようとした要素を捨てる
+	};
+	enum State {
+		Empty,
+		Queued,
+		Busy,
+		Ready,
+		Dropped,
+		Draining,
+	};
+	struct Stats {
+		uint64_t pushed = 0;
+		uint64_t dropped = 0;
+		uint64_t completed = 0;
+	};
+private:
+	static const size_t CACHE_LINE = 64;
+	// 状態には位置も含める。周回した後の同じスロットと取り違えないようにするため
+	struct alignas(CACHE_LINE) Slot {
+		std::atomic<uint64_t> tag{0};
+		T item;
+	};
+	struct alignas(CACHE_LINE) Counter {
+		std::atomic<uint64_t> value{0};
+	};
+	Slot slots_[N];
+	Counter head_;  // 次に投入する位置（生産者のみが書く）
+	Counter claim_; // 次に処理スレッドが取り出す位置
+	Counter tail_;  // 次に drain する位置
+	Counter pushed_;
+	Counter dropped_;
+	Counter completed_;
+	DropPolicy policy_ = DropPolicy::DropOldest;
+	size_t max_pending_ = N;
+
+	Slot &slot(uint64_t i)
+	{
+		return slots_[i & (N - 1)];
+	}
+	static uint64_t tag(uint64_t index, State state)
+	{
+		return (index << 3) | state;
+	}
+	bool drop_oldest()
+	{
+		uint64_t c = claim_.value.load();
+		while (c < head_.value.load()) {
+			if (claim_.value.compare_exchange_weak(c, c + 1)) {
+				Slot &s = slot(c);
+				s.item = {};
+				s.tag.store(tag(c, Dropped));
+				dropped_.value++;
+				return true;
+			}
+		}
+		return false;
+	}
+public:
+	FrameRing() = default;
+	FrameRing(FrameRing const &) = delete;
+	void operator = (FrameRing const &) = delete;
+
+	// 未処理の要素がこの数を超えたら policy に従って捨てる
+	void setDropPolicy(DropPolicy policy, size_t max_pending)
+	{
+		policy_ = policy;
+		max_pending_ = max_pending < 1 ? 1 : (max_pending > N ? N : max_pending);
+	}
+
+	// 生産者スレッドから呼ぶ。捨てた場合は false
+	bool push(T &&item)
+	{
+		const uint64_t h = head_.value.load();
+		pushed_.value++;
+		if (h - claim_.value.load() >= max_pending_) {
+			if (policy_ == DropPolicy::DropNewest || !drop_oldest()) {
+				dropped_.value++;
+				return false;
+			}
+		}
+		if (h - tail_.value.load() >= N) { // 処理中の要素で埋まっている
+			dropped_.value++;
+			return false;
+		}
+		Slot &s = slot(h);
+		s.item = std::move(item);
+		s.tag.store(tag(h, Queued));
+		head_.value.store(h + 1);
+		return true;
+	}
+
+	bool hasPending() const
+	{
+		return claim_.value.load() < head_.value.load();
+	}
+
+	// 処理スレッドから呼ぶ。取り出した位置を *index に返す
+	bool claim(uint64_t *index, T *item)
+	{
+		uint64_t c = claim_.value.load();
+		while (c < head_.value.load()) {
+			if (claim_.value.compare_exchange_weak(c, c + 1)) {
+				Slot &s = slot(c);
+				*item = std::move(s.item);
+				s.tag.store(tag(c, Busy));
+				*index = c;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// claim した要素の処理結果を戻す
+	void complete(uint64_t index, T &&item)
+	{
+		Slot &s = slot(index);
+		s.item = std::move(item);
+		s.tag.store(tag(index, Ready));
+		completed_.value++;
+	}
+
+	// 先頭から処理の終わった要素を順に fn に渡す。どのスレッドから呼んでもよい
+	template <typename F> void drain(F fn)
+	{
+		while (1) {
+			const uint64_t t = tail_.value.load();
+			if (t >= claim_.value.load()) break;
+			Slot &s = slot(t);
+			uint64_t st = s.tag.load();
+			if (st != tag(t, Ready) && st != tag(t, Dropped)) break;
+			if (!s.tag.compare_exchange_strong(st, tag(t, Draining))) continue;
+			if (st == tag(t, Ready)) {
+				fn(s.item);
+			}
+			s.item = {};
+			s.tag.store(tag(t, Empty));
+			tail_.value.store(t + 1);
+		}
+	}
+
+	// すべてのスレッドが停止しているときに呼ぶ
+	void clear()
+	{
+		for (size_t i = 0; i < N; i++) {
+			slots_[i].item = {};
+			slots_[i].tag.store(0);
+		}
+		head_.value = 0;
+		claim_.value = 0;
+		tail_.value = 0;
+	}
+
+	Stats stats() const
+	{
+		Stats s;
+		s.pushed = pushed_.value;
+		s.dropped = dropped_.value;
+		s.completed = completed_.value;
+		return s;
+	}
+};
+
+#endif // FRAMERING_H
@@ -1,339 +1,145 @@
 #include "Image.h"
+#include "ImageKernels.h"
 #include <cstdint>
 #include <algorithm>
 #include <QElapsedTimer>
 #include <QDebug>
 
-static inline uint8_t clamp_uint8(int v)
-{
-	return v < 0 ? 0 : (v > 255 ? 255 : v);
-}
-
-static inline uint8_t gray(int r, int g, int b)
-{
-	return (r * 306 + g * 601 + b * 117) / 1024;
-}
+namespace {
 
-Image Image::convertToFormat(Image::Format dformat) const
+// 変換関数を選ぶ。対応しない組み合わせは nullptr
+ImageKernels::RowFunc row_func(ImageKernels::Table const *t, Image::Format sformat, Image::Format dformat)
 {
-	Image::Format sformat = format();
-
-	if (sformat == dformat) return *this;
-
-	const int w = width();
-	const int h = height();
+	using Format = Image::Format;
 
 	if ((sformat == Format::UYVY8 && dformat == Format::YUYV8) || (sformat == Format::YUYV8 && dformat == Format::UYVY8)) {
-		Image newimage(w, h, dformat);
-		for (int y = 0; y < h; y++) {
-			uint8_t const *s = scanLine(y);
-			uint8_t *d = newimage.scanLine(y);
-			for (int x = 0; x < w; x++) {
-				d[0] = s[1];
-				d[1] = s[0];
-				s += 2;
-				d += 2;
-			}
-		}
-		return newimage;
+		return t->swap_yuv422;
 	}
 
 	if (dformat == Format::RGB8) {
-		if (sformat == Format::UYVY8) {
-			Image newimage(w, h, dformat);
-//			if (cuda) {
-//				cuda->convert_uyvy_to_rgb(w, h, this->bits(), newimage.bits());
-//			} else
-			{
-				for (int y = 0; y < h; y++) {
-					uint8_t const *s = scanLine(y);
-					uint8_t *d = newimage.scanLine(y);
-					uint8_t Y, U, V;
-					U = V = 0;
-					int w2 = w / 2;
-					for (int x = 0; x < w2; x++) {
-						int R, G, B;
-						U = s[0];
-						V = s[2];
-						Y = s[1];
-						R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[0] = clamp_uint8(R);
-						d[1] = clamp_uint8(G);
-						d[2] = clamp_uint8(B);
-						Y = s[3];
-						R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[3] = clamp_uint8(R);
-						d[4] = clamp_uint8(G);
-						d[5] = clamp_uint8(B);
-						s += 4;
-						d += 6;
-					}
-					if (w & 1) {
-						int U = s[0];
-						int Y = s[1];
-						int R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						int G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						int B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[0] = clamp_uint8(R);
-						d[1] = clamp_uint8(G);
-						d[2] = clamp_uint8(B);
-					}
-				}
-			}
-			return newimage;
-		}
-		if (sformat == Format::YUYV8) {
-			Image newimage(w, h, dformat);
-//			if (cuda) {
-//				cuda->convert_yuyv_to_rgb(w, h, this->bits(), newimage.bits());
-//			} else
-			{
-				for (int y = 0; y < h; y++) {
-					uint8_t const *s = scanLine(y);
-					uint8_t *d = newimage.scanLine(y);
-					uint8_t Y, U, V;
-					U = V = 0;
-					int w2 = w / 2;
-					for (int x = 0; x < w2; x++) {
-						int R, G, B;
-						U = s[1];
-						V = s[3];
-						Y = s[0];
-						R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[0] = clamp_uint8(R);
-						d[1] = clamp_uint8(G);
-						d[2] = clamp_uint8(B);
-						Y = s[2];
-						R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[3] = clamp_uint8(R);
-						d[4] = clamp_uint8(G);
-						d[5] = clamp_uint8(B);
-						s += 4;
-						d += 6;
-					}
-					if (w & 1) {
-						int U = s[1];
-						int Y = s[0];
-						int R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
-						int G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
-						int B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
-						d[0] = clamp_uint8(R);
-						d[1] = clamp_uint8(G);
-						d[2] = clamp_uint8(B);
-					}
-				}
-			}
-			return newimage;
-		}
-		if (sformat == Format::UINT8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					d[0] = d[1] = d[2] = *s++;
-					d += 3;
-				}
-			}
-			return newimage;
+		switch (sformat) {
+		case Format::UYVY8: return t->uyvy_to_rgb;
+		case Format::YUYV8: return t->yuyv_to_rgb;
+		case Format::UINT8: return t->gray_to_rgb;
+		default: break;
 		}
 	}
 
 	if (dformat == Format::UINT8) {
-		if (sformat == Format::RGB8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					int R = s[0];
-					int G = s[1];
-					int B = s[2];
-					*d++ = gray(R, G, B);
-					s += 3;
-				}
-			}
-			return newimage;
-		}
-		if (sformat == Format::UYVY8) {
-			Image newimage(w, h, dformat);
-//			if (cuda) {
-//				cuda->convert_uyvy_to_gray(w, h, this->bits(), newimage.bits());
-//			} else
-			{
-				for (int y = 0; y < h; y++) {
-					uint8_t const *s = scanLine(y);
-					uint8_t *d = newimage.scanLine(y);
-					uint8_t Y, U, V;
-					U = V = 0;
-					int w2 = w / 2;
-					for (int x = 0; x < w2; x++) {
-						int R, G, B;
-						U = s[0];
-						V = s[2];
-						Y = s[1];
-						R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d++ = gray(R, G, B);
-						Y = s[3];
-						R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d++ = gray(R, G, B);
-						s += 4;
-					}
-					if (w & 1) {
-						U = s[0];
-						Y = s[1];
-						int R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						int G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						int B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d = gray(R, G, B);
-					}
-				}
-			}
-			return newimage;
-		}
-		if (sformat == Format::YUYV8) {
-			Image newimage(w, h, dformat);
-//			if (cuda) {
-//				cuda->convert_yuyv_to_gray(w, h, this->bits(), newimage.bits());
-//			} else
-			{
-				for (int y = 0; y < h; y++) {
-					uint8_t const *s = scanLine(y);
-					uint8_t *d = newimage.scanLine(y);
-					uint8_t Y, U, V;
-					U = V = 0;
-					int w2 = w / 2;
-					for (int x = 0; x < w2; x++) {
-						int R, G, B;
-						U = s[1];
-						V = s[3];
-						Y = s[0];
-						R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d++ = gray(R, G, B);
-						Y = s[2];
-						R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d++ = gray(R, G, B);
-						s += 4;
-					}
-					if (w & 1) {
-						U = s[1];
-						Y = s[0];
-						int R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
-						int G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
-						int B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
-						*d = gray(R, G, B);
-					}
-				}
-			}
-			return newimage;
+		switch (sformat) {
+		case Format::RGB8:  return t->rgb_to_gray;
+		case Format::UYVY8: return t->uyvy_to_gray;
+		case Format::YUYV8: return t->yuyv_to_gray;
+		default: break;
 		}
 	}
 
 	if (dformat == Format::UYVY8) {
-		if (sformat == Format::RGB8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
-				for (int x = 0; x < w / 2; x++) {
-					d[1] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
-					d[3] = ( 263 * s[3] + 516 * s[4] + 100 * s[5]) / 1024 + 16;
-					int R = (s[0] + s[3]) / 2;
-					int G = (s[1] + s[4]) / 2;
-					int B = (s[2] + s[5]) / 2;
-					int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
-					int V = ( 450 * R - 377 * G -  73 * B) / 1024 + 128;
-					d[0] = U;
-					d[2] = V;
-					s += 6;
-					d += 4;
-				}
-				if (w & 1) {
-					d[1] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
-					int R = s[0];
-					int G = s[1];
-					int B = s[2];
-					int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
-					d[0] = U;
-				}
-			}
-			return newimage;
-		}
-		if (sformat == Format::UINT8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
-				for (int x = 0; x < w; x++) {
-					d[1] = (*s++) * 225 / 256 + 16;
-					d[0] = 128;
-					d += 2;
-				}
-			}
-			return newimage;
+		switch (sformat) {
+		case Format::RGB8:  return t->rgb_to_uyvy;
+		case Format::UINT8: return t->gray_to_uyvy;
+		default: break;
 		}
 	}
 
 	if (dformat == Format::YUYV8) {
-		if (sformat == Format::RGB8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
-				for (int x = 0; x < w / 2; x++) {
-					d[0] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
-					d[2] = ( 263 * s[3] + 516 * s[4] + 100 * s[5]) / 1024 + 16;
-					int R = (s[0] + s[3]) / 2;
-					int G = (s[1] + s[4]) / 2;
-					int B = (s[2] + s[5]) / 2;
-					int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
-					int V = ( 450 * R - 377 * G -  73 * B) / 1024 + 128;
-					d[1] = U;
-					d[3] = V;
-					s += 6;
-					d += 4;
-				}
-				if (w & 1) {
-					d[0] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
-					int R = s[0];
-					int G = s[1];
-					int B = s[2];
-					int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
-					d[1] = U;
-				}
-			}
-			return newimage;
+		switch (sformat) {
+		case Format::RGB8:   return t->rgb_to_yuyv;
+		case Format::UINT8:  return t->gray_to_yuyv;
+		case Format::YUYV16: return t->yuyv16_to_yuyv;
+		default: break;
 		}
-		if (sformat == Format::UINT8) {
-			Image newimage(w, h, dformat);
-			for (int y = 0; y < h; y++) {
-				uint8_t const *s = scanLine(y);
-				uint8_t *d = newimage.scanLine(y);
+	}
+
+	if (dformat == Format::YUYV16 && sformat == Format::YUYV8) {
+		return t->yuyv_to_yuyv16;
+	}
+
+	return nullptr;
+}
+
+// YUV422 の2つのマクロピクセル（4画素）から1つを作る。色差は前のマクロピクセルのもの、輝度は1画素おきに取る
+// y0, y1 はマクロピクセルの中の輝度の位置
+template <typename T, int y0, int y1> void half_yuv422_row(uint8_t const *src, uint8_t *dst, int w)
+{
+	T const *s = (T const *)src;
+	T *d = (T *)dst;
+	for (int x = 0; x < w; x += 2) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+		d[y1] = s[4 + y0];
+		d += 4;
+		s += 8;
+	}
+}
+
+} // namespace
+
+Image Image::convertToFormat(Image::Format dformat) const
+{
+	Image::Format sformat = format();
+
+	if (sformat == dformat) return *this;
+
+	ImageKernels::RowFunc func = row_func(ImageKernels::table(), sformat, dformat);
+	if (!func) {
+		// 10ビットの画像は8ビットの YUYV を経由して変換する
+		if (sformat == Format::YUYV16 || (dformat == Format::YUYV16 && sformat != Format::YUYV8)) {
+			Image tmp = convertToFormat(Format::YUYV8);
+			return tmp ? tmp.convertToFormat(dformat) : Image();
+		}
+		return {};
+	}
+
+	const int w = width();
+	const int h = height();
+
+	Image newimage(w, h, dformat);
+	uint8_t *dst = newimage.bits();
+	const int dstride = newimage.bytesPerLine();
+	ImageKernels::parallelRows(h, w * (bytesPerPixel() + newimage.bytesPerPixel()), [&](int y0, int y1){
+		for (int y = y0; y < y1; y++) {
+			func(scanLine(y), dst + dstride * y, w);
+		}
+	});
+	return newimage;
+}
+
+// 縦横を半分にする。画素を間引くだけなので、速いが折り返しが出る
+Image Image::halfSize() const
+{
+	const Format f = format();
+	const bool yuv422 = f == Format::UYVY8 || f == Format::YUYV8 || f == Format::YUYV16;
+	const int w = yuv422 ? width() / 4 * 2 : width() / 2;
+	const int h = height() / 2;
+	if (w < 1 || h < 1) return {};
+
+	void (*func)(uint8_t const *src, uint8_t *dst, int w) = nullptr;
+	switch (f) {
+	case Format::UYVY8:  func = half_yuv422_row<uint8_t, 1, 3>; break;
+	case Format::YUYV8:  func = half_yuv422_row<uint8_t, 0, 2>; break;
+	case Format::YUYV16: func = half_yuv422_row<uint16_t, 0, 2>; break;
+	default: break;
+	}
+
+	Image newimage(w, h, f);
+	uint8_t *dst = newimage.bits();
+	const int dstride = newimage.bytesPerLine();
+	const int bpp = bytesPerPixel();
+	ImageKernels::parallelRows(h, w * bpp * 3, [&](int y0, int y1){
+		for (int y = y0; y < y1; y++) {
+			uint8_t const *s = scanLine(y * 2);
+			uint8_t *d = dst + dstride * y;
+			if (func) {
+				func(s, d, w);
+			} else {
 				for (int x = 0; x < w; x++) {
-					d[0] = (*s++) * 225 / 256 + 16;
-					d[1] = 128;
-					d += 2;
+					memcpy(d + bpp * x, s + bpp * x * 2, bpp);
 				}
 			}
-			return newimage;
 		}
-	}
-
-	return {};
+	});
+	return newimage;
 }
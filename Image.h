@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <utility>
 #include <atomic>
+#include "FramePool.h"
 
 class RefCounter {
 private:
@@ -36,6 +37,7 @@ public:
 		RGB8,
 		UYVY8,
 		YUYV8,
+		YUYV16, // 10ビットの値を16ビットの上位に詰めた YUYV (Y210)
 		UINT8,
 		UINT16,
 		UINT32,
@@ -51,20 +53,34 @@ public:
 		case Format::YUYV8:
 		case Format::UINT16:
 			return 2;
+		case Format::YUYV16:
 		case Format::UINT32:
 			return 4;
 		}
 		return 0;
 	}
+	static const int ALIGNMENT = 64;
+	static int alignedBytesPerLine(int w, Format f, int padding = 0)
+	{
+		int n = bytesPerPixel(f) * (w + padding * 2);
+		return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
 private:
 	struct Core {
 		RefCounter ref;
 		int width = 0;
 		int height = 0;
+		int bytes_per_line = 0;
+		int padding = 0; // 左右の余白（ピクセル数）
+		size_t offset = 0; // ブロック先頭から(0,0)の画素までのバイト数
 		enum Format format = Format::RGB8;
+		size_t blocksize = 0;
+		uint8_t *external = nullptr; // 外部バッファを参照する場合
+		void (*release)(void *cookie) = nullptr;
+		void *cookie = nullptr;
 		char *data() const
 		{
-			return (char *)this + sizeof(Core);
+			return external ? (char *)external : (char *)this + offset;
 		}
 //		char data[0];
 	};
@@ -78,24 +94,28 @@ private:
 			if (core_->ref > 1) {
 				core_->ref--;
 			} else {
+				if (core_->release) {
+					core_->release(core_->cookie);
+				}
+				size_t blocksize = core_->blocksize;
 				core_->~Core();
-				free(core_);
+				FramePool::deallocate(core_, blocksize);
 			}
 		}
 		core_ = p;
 	}
 	void copy_on_write()
 	{
-		if (core_ && core_->ref > 1) {
+		if (core_ && (core_->ref > 1 || core_->external)) { // 外部バッファは読み取り専用として扱う
 			Image img = copy();
 			assign(img.core_);
 		}
 	}
 public:
 	Image() = default;
-	Image(int w, int h, Format format)
+	Image(int w, int h, Format format, int padding = 0)
 	{
-		create(w, h, format);
+		create(w, h, format, padding);
 	}
 	~Image()
 	{
@@ -121,16 +141,44 @@ public:
 	{
 		return !isNull();
 	}
-	void create(int w, int h, Format format)
+	// 各行の(0,0)画素は ALIGNMENT バイト境界に揃う。padding は左右に確保する余白
+	void create(int w, int h, Format format, int padding = 0)
+	{
+		const size_t padbytes = bytesPerPixel(format) * padding;
+		const int stride = alignedBytesPerLine(w, format, padding);
+		size_t blocksize = sizeof(Core) + padbytes + ALIGNMENT - 1 + (size_t)stride * h;
+		Core *p = (Core *)FramePool::allocate(blocksize);
+		*p = {};
+		uintptr_t top = (uintptr_t)p + sizeof(Core) + padbytes;
+		top = (top + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1);
+		p->offset = top - (uintptr_t)p;
+		p->blocksize = blocksize;
+		p->width = w;
+		p->height = h;
+		p->bytes_per_line = stride;
+		p->padding = padding;
+		p->format = format;
+		assign(p);
+	}
+	// 外部バッファを複製せずに参照する。最後の参照が外れたとき release(cookie) が呼ばれる
+	void wrap(int w, int h, Format format, int bytes_per_line, uint8_t *data, void (*release)(void *cookie), void *cookie)
 	{
-		size_t datalen = bytesPerPixel(format) * w * h;
-		Core *p = (Core *)malloc(sizeof(Core) + datalen);
+		Core *p = (Core *)FramePool::allocate(sizeof(Core));
 		*p = {};
+		p->blocksize = sizeof(Core);
 		p->width = w;
 		p->height = h;
+		p->bytes_per_line = bytes_per_line;
 		p->format = format;
+		p->external = data;
+		p->release = release;
+		p->cookie = cookie;
 		assign(p);
 	}
+	bool isExternal() const
+	{
+		return core_ && core_->external;
+	}
 	int width() const
 	{
 		return core_ ? core_->width : 0;
@@ -149,7 +197,11 @@ public:
 	}
 	int bytesPerLine() const
 	{
-		return bytesPerPixel() * width();
+		return core_ ? core_->bytes_per_line : 0;
+	}
+	int padding() const
+	{
+		return core_ ? core_->padding : 0;
 	}
 	uint8_t const *scanLine(int y) const
 	{
@@ -176,12 +228,18 @@ public:
 			int w = width();
 			int h = height();
 			Format f = format();
-			newimg.create(w, h, f);
-			memcpy(newimg.core_->data(), core_->data(), bytesPerPixel(f) * w * h);
+			int pad = padding();
+			newimg.create(w, h, f, pad);
+			const int padbytes = bytesPerPixel(f) * pad;
+			const int len = bytesPerPixel(f) * (w + pad * 2);
+			for (int y = 0; y < h; y++) {
+				memcpy(newimg.scanLine(y) - padbytes, scanLine(y) - padbytes, len);
+			}
 		}
 		return newimg;
 	}
 	Image convertToFormat(Image::Format dformat) const;
+	Image halfSize() const;
 
 	void swap(Image &r)
 	{
@@ -0,0 +1,1583 @@
+#include "ImageKernels.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <omp.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+inline uint8_t clamp_uint8(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+inline uint8_t gray(int r, int g, int b)
+{
+	return (r * 306 + g * 601 + b * 117) / 1024;
+}
+
+// scalar
+// x 画素目から w 画素目までを変換する（x は偶数）。SIMD版の端数処理にも使う
+
+void swap_yuv422_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x * 2;
+	d += x * 2;
+	for (; x < w; x++) {
+		d[0] = s[1];
+		d[1] = s[0];
+		s += 2;
+		d += 2;
+	}
+}
+
+template <int U_, int Y0_, int V_, int Y1_> void yuv422_to_rgb_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x * 2;
+	d += x * 3;
+	uint8_t Y, U, V;
+	U = 0;
+	V = x > 0 ? s[V_ - 4] : 0;
+	int w2 = w / 2;
+	for (x /= 2; x < w2; x++) {
+		int R, G, B;
+		U = s[U_];
+		V = s[V_];
+		Y = s[Y0_];
+		R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
+		G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
+		B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
+		d[0] = clamp_uint8(R);
+		d[1] = clamp_uint8(G);
+		d[2] = clamp_uint8(B);
+		Y = s[Y1_];
+		R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
+		G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
+		B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
+		d[3] = clamp_uint8(R);
+		d[4] = clamp_uint8(G);
+		d[5] = clamp_uint8(B);
+		s += 4;
+		d += 6;
+	}
+	if (w & 1) {
+		int U = s[U_];
+		int Y = s[Y0_];
+		int R = ((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024;
+		int G = ((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024;
+		int B = ((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024;
+		d[0] = clamp_uint8(R);
+		d[1] = clamp_uint8(G);
+		d[2] = clamp_uint8(B);
+	}
+}
+
+template <int U_, int Y0_, int V_, int Y1_> void yuv422_to_gray_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x * 2;
+	d += x;
+	uint8_t Y, U, V;
+	U = 0;
+	V = x > 0 ? s[V_ - 4] : 0;
+	int w2 = w / 2;
+	for (x /= 2; x < w2; x++) {
+		int R, G, B;
+		U = s[U_];
+		V = s[V_];
+		Y = s[Y0_];
+		R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
+		G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
+		B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
+		*d++ = gray(R, G, B);
+		Y = s[Y1_];
+		R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
+		G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
+		B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
+		*d++ = gray(R, G, B);
+		s += 4;
+	}
+	if (w & 1) {
+		U = s[U_];
+		Y = s[Y0_];
+		int R = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
+		int G = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
+		int B = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
+		*d = gray(R, G, B);
+	}
+}
+
+void gray_to_rgb_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x;
+	d += x * 3;
+	for (; x < w; x++) {
+		d[0] = d[1] = d[2] = *s++;
+		d += 3;
+	}
+}
+
+void rgb_to_gray_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x * 3;
+	d += x;
+	for (; x < w; x++) {
+		int R = s[0];
+		int G = s[1];
+		int B = s[2];
+		*d++ = gray(R, G, B);
+		s += 3;
+	}
+}
+
+template <int U_, int Y0_, int V_, int Y1_> void rgb_to_yuv422_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x * 3;
+	d += x * 2;
+	for (x /= 2; x < w / 2; x++) {
+		d[Y0_] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
+		d[Y1_] = ( 263 * s[3] + 516 * s[4] + 100 * s[5]) / 1024 + 16;
+		int R = (s[0] + s[3]) / 2;
+		int G = (s[1] + s[4]) / 2;
+		int B = (s[2] + s[5]) / 2;
+		int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
+		int V = ( 450 * R - 377 * G -  73 * B) / 1024 + 128;
+		d[U_] = U;
+		d[V_] = V;
+		s += 6;
+		d += 4;
+	}
+	if (w & 1) {
+		d[Y0_] = ( 263 * s[0] + 516 * s[1] + 100 * s[2]) / 1024 + 16;
+		int R = s[0];
+		int G = s[1];
+		int B = s[2];
+		int U = (-152 * R - 298 * G + 450 * B) / 1024 + 128;
+		d[U_] = U;
+	}
+}
+
+template <int C_, int Y_> void gray_to_yuv422_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x;
+	d += x * 2;
+	for (; x < w; x++) {
+		d[Y_] = (*s++) * 225 / 256 + 16;
+		d[C_] = 128;
+		d += 2;
+	}
+}
+
+// v210 は6画素を32ビット語4つ (Cb0 Y0 Cr0 | Y1 Cb1 Y2 | Cr1 Y3 Cb2 | Y4 Cr2 Y5) に詰めている（x は6の倍数）
+void v210_to_yuyv16_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	s += x / 6 * 16;
+	uint16_t *p = (uint16_t *)d + x * 2;
+	for (; x < w; x += 6) {
+		uint16_t t[12];
+		for (int i = 0; i < 4; i++) {
+			uint32_t v = s[0] | (s[1] << 8) | (s[2] << 16) | ((uint32_t)s[3] << 24);
+			t[3 * i + 0] = v & 0x3ff;
+			t[3 * i + 1] = (v >> 10) & 0x3ff;
+			t[3 * i + 2] = (v >> 20) & 0x3ff;
+			s += 4;
+		}
+		const int n = std::min(w - x, 6);
+		for (int i = 0; i < n; i++) {
+			p[0] = t[2 * i + 1] << 6;
+			p[1] = t[2 * i + 0] << 6;
+			p += 2;
+		}
+	}
+}
+
+void yuyv16_to_yuyv_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	for (x *= 2; x < w * 2; x++) {
+		d[x] = s[2 * x + 1];
+	}
+}
+
+void yuyv_to_yuyv16_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	for (x *= 2; x < w * 2; x++) {
+		d[2 * x + 0] = 0;
+		d[2 * x + 1] = s[x];
+	}
+}
+
+template <int Y_> void get_luma_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	for (; x < w; x++) {
+		d[x] = s[2 * x + Y_];
+	}
+}
+
+template <int Y_> void set_luma_c(uint8_t const *s, uint8_t *d, int x, int w)
+{
+	for (; x < w; x++) {
+		d[2 * x + Y_] = s[x];
+	}
+}
+
+// 縮小用の縦方向の処理。n はバイト数
+
+void accumulate_row_c(uint8_t const *s, uint16_t *acc, int n)
+{
+	for (int i = 0; i < n; i++) {
+		acc[i] += s[i];
+	}
+}
+
+void blend_rows_c(uint8_t const *a, uint8_t const *b, int f, uint8_t *d, int n)
+{
+	for (int i = 0; i < n; i++) {
+		d[i] = (a[i] * (256 - f) + b[i] * f + 128) >> 8;
+	}
+}
+
+// 横方向の補間。出力の各バイトを入力の2つの標本から作る。w[j] は下位16ビットが i0[j] の重み、上位16ビットが i1[j] の重み（和は256）
+void interpolate_row_c(uint8_t const *s, int sn, uint8_t *d, int n, int32_t const *i0, int32_t const *i1, int32_t const *w)
+{
+	for (int j = 0; j < n; j++) {
+		d[j] = (s[i0[j]] * (w[j] & 0xffff) + s[i1[j]] * (w[j] >> 16) + 128) >> 8;
+	}
+}
+
+// 縮小用の横方向の処理。縦方向に処理済みの1行から出力の幅の UYVY の1行を作る
+// 出力の幅が奇数のときは最後の組の2画素目に1画素目を複写する
+
+inline void yuv_to_rgb_c(int Y, int U, int V, uint8_t *d)
+{
+	d[0] = clamp_uint8(((Y - 16) * 1192 +                    (V - 128) * 1634) / 1024);
+	d[1] = clamp_uint8(((Y - 16) * 1192 - (U - 128) * 400  - (V - 128) * 832 ) / 1024);
+	d[2] = clamp_uint8(((Y - 16) * 1192 + (U - 128) * 2065                   ) / 1024);
+}
+
+// kx 画素ずつの合計を平均する。色差は出力の2画素分の範囲で平均する
+template <int U_, int Y0_, int V_, int Y1_> void box_row_to_uyvy_c(uint16_t const *acc, uint8_t *d, int dw, int kx, int ky)
+{
+	const int div = kx * ky;
+	const uint32_t r1 = (65536 + div / 2) / div; // 1/div
+	const uint32_t r2 = (65536 + div) / (2 * div); // 1/(2*div)
+	auto sum = [&](int x, uint32_t *Y, uint32_t *U, uint32_t *V){
+		int p = x * kx;
+		const int e = p + kx;
+		if (!(kx & 1)) {
+			for (; p < e; p += 2) {
+				uint16_t const *q = acc + p * 2;
+				*Y += q[Y0_] + q[Y1_];
+				*U += q[U_] * 2;
+				*V += q[V_] * 2;
+			}
+		} else {
+			for (; p < e; p++) {
+				uint16_t const *q = acc + (p & ~1) * 2;
+				*Y += q[(p & 1) ? Y1_ : Y0_];
+				*U += q[U_];
+				*V += q[V_];
+			}
+		}
+	};
+	for (int x = 0; x < dw; x += 2) {
+		uint32_t Y0 = 0;
+		uint32_t Y1 = 0;
+		uint32_t U = 0;
+		uint32_t V = 0;
+		uint32_t rc = r1;
+		sum(x, &Y0, &U, &V);
+		Y0 = (Y0 * r1 + 32768) >> 16;
+		if (x + 1 < dw) {
+			sum(x + 1, &Y1, &U, &V);
+			Y1 = (Y1 * r1 + 32768) >> 16;
+			rc = r2;
+		} else {
+			Y1 = Y0;
+		}
+		d[0] = (U * rc + 32768) >> 16;
+		d[1] = Y0;
+		d[2] = (V * rc + 32768) >> 16;
+		d[3] = Y1;
+		d += 4;
+	}
+}
+
+// 補間に使う2つの標本と重み（0..255）
+struct Tap {
+	int i0;
+	int i1;
+	int f;
+};
+
+// 出力の x 番目の画素の中心に対応する入力の位置。1/256 単位
+inline int64_t source_position(int x, int src, int dst)
+{
+	int64_t pos = (int64_t)(2 * x + 1) * src * 256 / (2 * dst) - 128;
+	return pos < 0 ? 0 : pos;
+}
+
+inline Tap make_tap(int64_t pos, int n)
+{
+	int i = (int)(pos >> 8);
+	if (i >= n - 1) return {n - 1, n - 1, 0};
+	return {i, i + 1, (int)(pos & 255)};
+}
+
+template <void (*F)(uint8_t const *, uint8_t *, int, int)> void row_c(uint8_t const *s, uint8_t *d, int w)
+{
+	F(s, d, 0, w);
+}
+
+#define UYVY_ 0, 1, 2, 3
+#define YUYV_ 1, 0, 3, 2
+
+ImageKernels::Table make_scalar_table()
+{
+	ImageKernels::Table t;
+	t.swap_yuv422 = row_c<swap_yuv422_c>;
+	t.uyvy_to_rgb = row_c<yuv422_to_rgb_c<UYVY_>>;
+	t.yuyv_to_rgb = row_c<yuv422_to_rgb_c<YUYV_>>;
+	t.gray_to_rgb = row_c<gray_to_rgb_c>;
+	t.rgb_to_gray = row_c<rgb_to_gray_c>;
+	t.uyvy_to_gray = row_c<yuv422_to_gray_c<UYVY_>>;
+	t.yuyv_to_gray = row_c<yuv422_to_gray_c<YUYV_>>;
+	t.rgb_to_uyvy = row_c<rgb_to_yuv422_c<UYVY_>>;
+	t.rgb_to_yuyv = row_c<rgb_to_yuv422_c<YUYV_>>;
+	t.gray_to_uyvy = row_c<gray_to_yuv422_c<0, 1>>;
+	t.gray_to_yuyv = row_c<gray_to_yuv422_c<1, 0>>;
+	t.v210_to_yuyv16 = row_c<v210_to_yuyv16_c>;
+	t.yuyv16_to_yuyv = row_c<yuyv16_to_yuyv_c>;
+	t.yuyv_to_yuyv16 = row_c<yuyv_to_yuyv16_c>;
+	t.uyvy_get_luma = row_c<get_luma_c<1>>;
+	t.yuyv_get_luma = row_c<get_luma_c<0>>;
+	t.uyvy_set_luma = row_c<set_luma_c<1>>;
+	t.yuyv_set_luma = row_c<set_luma_c<0>>;
+	t.accumulate_row = accumulate_row_c;
+	t.blend_rows = blend_rows_c;
+	t.interpolate_row = interpolate_row_c;
+	return t;
+}
+
+ImageKernels::Table const *scalar_table()
+{
+	static const ImageKernels::Table t = make_scalar_table();
+	return &t;
+}
+
+#ifdef USE_X86_SIMD
+
+// SSSE3
+// 16画素単位で処理する。端数はスカラー版で変換する
+
+TARGET_SSSE3 inline __m128i coef(int lo, int hi)
+{
+	return _mm_set1_epi32((int)(((uint32_t)(uint16_t)hi << 16) | (uint16_t)lo));
+}
+
+// C の除算と同じく0方向へ切り捨てる
+TARGET_SSSE3 inline __m128i div1024(__m128i x)
+{
+	return _mm_srai_epi32(_mm_add_epi32(x, _mm_and_si128(_mm_srai_epi32(x, 31), _mm_set1_epi32(1023))), 10);
+}
+
+// 32バイトのUYVY/YUYVから、輝度16画素と色差8組を16ビット値で取り出す
+template <bool UYVY> TARGET_SSSE3 inline void load_yuv422(uint8_t const *s, __m128i *y0, __m128i *y1, __m128i *u, __m128i *v)
+{
+	const __m128i lo = _mm_set1_epi16(0x00ff);
+	__m128i a = _mm_loadu_si128((__m128i const *)s);
+	__m128i b = _mm_loadu_si128((__m128i const *)(s + 16));
+	__m128i c;
+	if (UYVY) {
+		*y0 = _mm_srli_epi16(a, 8);
+		*y1 = _mm_srli_epi16(b, 8);
+		c = _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo));
+	} else {
+		*y0 = _mm_and_si128(a, lo);
+		*y1 = _mm_and_si128(b, lo);
+		c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+	}
+	*u = _mm_and_si128(c, lo);
+	*v = _mm_srli_epi16(c, 8);
+}
+
+// 輝度16画素(8ビット)と色差8組(16ビット)をUYVY/YUYVで書き出す
+template <bool UYVY> TARGET_SSSE3 inline void store_yuv422(uint8_t *d, __m128i y, __m128i u, __m128i v)
+{
+	__m128i c = _mm_or_si128(u, _mm_slli_epi16(v, 8));
+	if (UYVY) {
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(c, y));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi8(c, y));
+	} else {
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(y, c));
+		_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi8(y, c));
+	}
+}
+
+TARGET_SSSE3 inline void load_rgb(uint8_t const *s, __m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i s0 = _mm_loadu_si128((__m128i const *)s);
+	__m128i s1 = _mm_loadu_si128((__m128i const *)(s + 16));
+	__m128i s2 = _mm_loadu_si128((__m128i const *)(s + 32));
+	*r = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(s0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+	*g = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(s0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+	*b = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(s0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+TARGET_SSSE3 inline void store_rgb(uint8_t *d, __m128i r, __m128i g, __m128i b)
+{
+	__m128i d0 = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(r, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+		_mm_shuffle_epi8(g, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+		_mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+	__m128i d1 = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(r, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+		_mm_shuffle_epi8(g, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+		_mm_shuffle_epi8(b, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+	__m128i d2 = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(r, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+		_mm_shuffle_epi8(g, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+		_mm_shuffle_epi8(b, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+	_mm_storeu_si128((__m128i *)d, d0);
+	_mm_storeu_si128((__m128i *)(d + 16), d1);
+	_mm_storeu_si128((__m128i *)(d + 32), d2);
+}
+
+// 8画素分。y, u, v は画素ごとの16ビット値。結果は符号付き16ビット
+TARGET_SSSE3 inline void yuv_to_rgb_8(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+	__m128i yv0 = _mm_unpacklo_epi16(y, v);
+	__m128i yv1 = _mm_unpackhi_epi16(y, v);
+	__m128i yu0 = _mm_unpacklo_epi16(y, u);
+	__m128i yu1 = _mm_unpackhi_epi16(y, u);
+	__m128i v0 = _mm_unpacklo_epi16(v, zero);
+	__m128i v1 = _mm_unpackhi_epi16(v, zero);
+	*r = _mm_packs_epi32(div1024(_mm_madd_epi16(yv0, coef(1192, 1634))), div1024(_mm_madd_epi16(yv1, coef(1192, 1634))));
+	*b = _mm_packs_epi32(div1024(_mm_madd_epi16(yu0, coef(1192, 2065))), div1024(_mm_madd_epi16(yu1, coef(1192, 2065))));
+	__m128i g0 = _mm_add_epi32(_mm_madd_epi16(yu0, coef(1192, -400)), _mm_madd_epi16(v0, coef(-832, 0)));
+	__m128i g1 = _mm_add_epi32(_mm_madd_epi16(yu1, coef(1192, -400)), _mm_madd_epi16(v1, coef(-832, 0)));
+	*g = _mm_packs_epi32(div1024(g0), div1024(g1));
+}
+
+// 16画素分。色差は2画素で共有する8組
+TARGET_SSSE3 inline void yuv_to_rgb_16(__m128i y0, __m128i y1, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+	__m128i r0, g0, b0, r1, g1, b1;
+	yuv_to_rgb_8(y0, _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v), &r0, &g0, &b0);
+	yuv_to_rgb_8(y1, _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v), &r1, &g1, &b1);
+	*r = _mm_packus_epi16(r0, r1);
+	*g = _mm_packus_epi16(g0, g1);
+	*b = _mm_packus_epi16(b0, b1);
+}
+
+TARGET_SSSE3 inline __m128i gray_8(__m128i r, __m128i g, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i rg0 = _mm_unpacklo_epi16(r, g);
+	__m128i rg1 = _mm_unpackhi_epi16(r, g);
+	__m128i b0 = _mm_unpacklo_epi16(b, zero);
+	__m128i b1 = _mm_unpackhi_epi16(b, zero);
+	__m128i t0 = _mm_add_epi32(_mm_madd_epi16(rg0, coef(306, 601)), _mm_madd_epi16(b0, coef(117, 0)));
+	__m128i t1 = _mm_add_epi32(_mm_madd_epi16(rg1, coef(306, 601)), _mm_madd_epi16(b1, coef(117, 0)));
+	return _mm_packs_epi32(_mm_srli_epi32(t0, 10), _mm_srli_epi32(t1, 10));
+}
+
+TARGET_SSSE3 inline __m128i gray_16(__m128i r, __m128i g, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = gray_8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i hi = gray_8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_packus_epi16(lo, hi);
+}
+
+// 8画素分の輝度と、4組分の色差(2画素の平均から求める)
+TARGET_SSSE3 inline void rgb_to_yuv_8(__m128i r, __m128i g, __m128i b, __m128i *y, __m128i *u, __m128i *v)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i rg0 = _mm_unpacklo_epi16(r, g);
+	__m128i rg1 = _mm_unpackhi_epi16(r, g);
+	__m128i b0 = _mm_unpacklo_epi16(b, zero);
+	__m128i b1 = _mm_unpackhi_epi16(b, zero);
+	__m128i y0 = _mm_add_epi32(_mm_madd_epi16(rg0, coef(263, 516)), _mm_madd_epi16(b0, coef(100, 0)));
+	__m128i y1 = _mm_add_epi32(_mm_madd_epi16(rg1, coef(263, 516)), _mm_madd_epi16(b1, coef(100, 0)));
+	*y = _mm_add_epi16(_mm_packs_epi32(_mm_srli_epi32(y0, 10), _mm_srli_epi32(y1, 10)), _mm_set1_epi16(16));
+	__m128i ra = _mm_srli_epi32(_mm_madd_epi16(r, one), 1);
+	__m128i ga = _mm_srli_epi32(_mm_madd_epi16(g, one), 1);
+	__m128i ba = _mm_srli_epi32(_mm_madd_epi16(b, one), 1);
+	__m128i rga = _mm_or_si128(ra, _mm_slli_epi32(ga, 16));
+	__m128i u0 = _mm_add_epi32(_mm_madd_epi16(rga, coef(-152, -298)), _mm_madd_epi16(ba, coef(450, 0)));
+	__m128i v0 = _mm_add_epi32(_mm_madd_epi16(rga, coef(450, -377)), _mm_madd_epi16(ba, coef(-73, 0)));
+	*u = _mm_add_epi32(div1024(u0), _mm_set1_epi32(128));
+	*v = _mm_add_epi32(div1024(v0), _mm_set1_epi32(128));
+}
+
+template <bool UYVY> TARGET_SSSE3 inline void rgb_to_yuv_16(__m128i r, __m128i g, __m128i b, uint8_t *d)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i y0, u0, v0, y1, u1, v1;
+	rgb_to_yuv_8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero), &y0, &u0, &v0);
+	rgb_to_yuv_8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero), &y1, &u1, &v1);
+	store_yuv422<UYVY>(d, _mm_packus_epi16(y0, y1), _mm_packs_epi32(u0, u1), _mm_packs_epi32(v0, v1));
+}
+
+TARGET_SSSE3 void swap_yuv422_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x * 2));
+		_mm_storeu_si128((__m128i *)(d + x * 2), _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8)));
+	}
+	swap_yuv422_c(s, d, n, w);
+}
+
+template <bool UYVY> TARGET_SSSE3 void yuv422_to_rgb_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i y0, y1, u, v, r, g, b;
+		load_yuv422<UYVY>(s + x * 2, &y0, &y1, &u, &v);
+		yuv_to_rgb_16(y0, y1, u, v, &r, &g, &b);
+		store_rgb(d + x * 3, r, g, b);
+	}
+	if (UYVY) {
+		yuv422_to_rgb_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_rgb_c<YUYV_>(s, d, n, w);
+	}
+}
+
+template <bool UYVY> TARGET_SSSE3 void yuv422_to_gray_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i y0, y1, u, v, r, g, b;
+		load_yuv422<UYVY>(s + x * 2, &y0, &y1, &u, &v);
+		yuv_to_rgb_16(y0, y1, u, v, &r, &g, &b);
+		_mm_storeu_si128((__m128i *)(d + x), gray_16(r, g, b));
+	}
+	if (UYVY) {
+		yuv422_to_gray_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_gray_c<YUYV_>(s, d, n, w);
+	}
+}
+
+TARGET_SSSE3 void gray_to_rgb_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x));
+		uint8_t *p = d + x * 3;
+		_mm_storeu_si128((__m128i *)p, _mm_shuffle_epi8(a, _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5)));
+		_mm_storeu_si128((__m128i *)(p + 16), _mm_shuffle_epi8(a, _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10)));
+		_mm_storeu_si128((__m128i *)(p + 32), _mm_shuffle_epi8(a, _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15)));
+	}
+	gray_to_rgb_c(s, d, n, w);
+}
+
+TARGET_SSSE3 void rgb_to_gray_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i r, g, b;
+		load_rgb(s + x * 3, &r, &g, &b);
+		_mm_storeu_si128((__m128i *)(d + x), gray_16(r, g, b));
+	}
+	rgb_to_gray_c(s, d, n, w);
+}
+
+template <bool UYVY> TARGET_SSSE3 void rgb_to_yuv422_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i r, g, b;
+		load_rgb(s + x * 3, &r, &g, &b);
+		rgb_to_yuv_16<UYVY>(r, g, b, d + x * 2);
+	}
+	if (UYVY) {
+		rgb_to_yuv422_c<UYVY_>(s, d, n, w);
+	} else {
+		rgb_to_yuv422_c<YUYV_>(s, d, n, w);
+	}
+}
+
+template <bool UYVY> TARGET_SSSE3 void gray_to_yuv422_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c = _mm_set1_epi8((char)128);
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x));
+		__m128i y0 = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_set1_epi16(225)), 8);
+		__m128i y1 = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_set1_epi16(225)), 8);
+		__m128i y = _mm_add_epi8(_mm_packus_epi16(y0, y1), _mm_set1_epi8(16));
+		uint8_t *p = d + x * 2;
+		if (UYVY) {
+			_mm_storeu_si128((__m128i *)p, _mm_unpacklo_epi8(c, y));
+			_mm_storeu_si128((__m128i *)(p + 16), _mm_unpackhi_epi8(c, y));
+		} else {
+			_mm_storeu_si128((__m128i *)p, _mm_unpacklo_epi8(y, c));
+			_mm_storeu_si128((__m128i *)(p + 16), _mm_unpackhi_epi8(y, c));
+		}
+	}
+	if (UYVY) {
+		gray_to_yuv422_c<0, 1>(s, d, n, w);
+	} else {
+		gray_to_yuv422_c<1, 0>(s, d, n, w);
+	}
+}
+
+TARGET_SSSE3 void v210_to_yuyv16_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	const __m128i mask = _mm_set1_epi32(0x3ff);
+	int n = w / 6 * 6;
+	for (int x = 0; x < n; x += 6) {
+		__m128i v = _mm_loadu_si128((__m128i const *)(s + x / 6 * 16));
+		__m128i a = _mm_and_si128(v, mask);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(v, 10), mask);
+		__m128i c = _mm_and_si128(_mm_srli_epi32(v, 20), mask);
+		__m128i ab = _mm_packs_epi32(a, b); // a0 a1 a2 a3 b0 b1 b2 b3
+		__m128i cc = _mm_packs_epi32(c, c); // c0 c1 c2 c3 ...
+		// Y0 Cb0 Y1 Cr0 Y2 Cb1 Y3 Cr1 = b0 a0 a1 c0 c1 b1 b2 a2
+		__m128i o0 = _mm_or_si128(
+			_mm_shuffle_epi8(ab, _mm_setr_epi8(8, 9, 0, 1, 2, 3, -1, -1, -1, -1, 10, 11, 12, 13, 4, 5)),
+			_mm_shuffle_epi8(cc, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 0, 1, 2, 3, -1, -1, -1, -1, -1, -1)));
+		// Y4 Cb2 Y5 Cr2 = a3 c2 c3 b3
+		__m128i o1 = _mm_or_si128(
+			_mm_shuffle_epi8(ab, _mm_setr_epi8(6, 7, -1, -1, -1, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1)),
+			_mm_shuffle_epi8(cc, _mm_setr_epi8(-1, -1, 4, 5, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+		uint8_t *p = d + x * 4;
+		_mm_storeu_si128((__m128i *)p, _mm_slli_epi16(o0, 6));
+		_mm_storel_epi64((__m128i *)(p + 16), _mm_slli_epi16(o1, 6));
+	}
+	v210_to_yuyv16_c(s, d, n, w);
+}
+
+TARGET_SSSE3 void yuyv16_to_yuyv_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x * 4));
+		__m128i b = _mm_loadu_si128((__m128i const *)(s + x * 4 + 16));
+		_mm_storeu_si128((__m128i *)(d + x * 2), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+	yuyv16_to_yuyv_c(s, d, n, w);
+}
+
+TARGET_SSSE3 void yuyv_to_yuyv16_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x * 2));
+		_mm_storeu_si128((__m128i *)(d + x * 4), _mm_unpacklo_epi8(zero, a));
+		_mm_storeu_si128((__m128i *)(d + x * 4 + 16), _mm_unpackhi_epi8(zero, a));
+	}
+	yuyv_to_yuyv16_c(s, d, n, w);
+}
+
+template <bool UYVY> TARGET_SSSE3 void get_luma_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i a = _mm_loadu_si128((__m128i const *)(s + x * 2));
+		__m128i b = _mm_loadu_si128((__m128i const *)(s + x * 2 + 16));
+		if (UYVY) {
+			a = _mm_srli_epi16(a, 8);
+			b = _mm_srli_epi16(b, 8);
+		} else {
+			a = _mm_and_si128(a, mask);
+			b = _mm_and_si128(b, mask);
+		}
+		_mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(a, b));
+	}
+	get_luma_c<UYVY ? 1 : 0>(s, d, n, w);
+}
+
+template <bool UYVY> TARGET_SSSE3 void set_luma_ssse3(uint8_t const *s, uint8_t *d, int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i chroma = _mm_set1_epi16(UYVY ? 0x00ff : (short)0xff00);
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i y = _mm_loadu_si128((__m128i const *)(s + x));
+		__m128i lo = UYVY ? _mm_unpacklo_epi8(zero, y) : _mm_unpacklo_epi8(y, zero);
+		__m128i hi = UYVY ? _mm_unpackhi_epi8(zero, y) : _mm_unpackhi_epi8(y, zero);
+		__m128i *p = (__m128i *)(d + x * 2);
+		_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(p), chroma), lo));
+		_mm_storeu_si128(p + 1, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(p + 1), chroma), hi));
+	}
+	set_luma_c<UYVY ? 1 : 0>(s, d, n, w);
+}
+
+TARGET_SSSE3 void accumulate_row_ssse3(uint8_t const *s, uint16_t *acc, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int m = n & ~15;
+	for (int i = 0; i < m; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i const *)(s + i));
+		__m128i *p = (__m128i *)(acc + i);
+		_mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p), _mm_unpacklo_epi8(v, zero)));
+		_mm_storeu_si128(p + 1, _mm_add_epi16(_mm_loadu_si128(p + 1), _mm_unpackhi_epi8(v, zero)));
+	}
+	accumulate_row_c(s + m, acc + m, n - m);
+}
+
+TARGET_SSSE3 void blend_rows_ssse3(uint8_t const *a, uint8_t const *b, int f, uint8_t *d, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wa = _mm_set1_epi16(256 - f);
+	const __m128i wb = _mm_set1_epi16(f);
+	const __m128i round = _mm_set1_epi16(128);
+	int m = n & ~15;
+	for (int i = 0; i < m; i += 16) {
+		__m128i va = _mm_loadu_si128((__m128i const *)(a + i));
+		__m128i vb = _mm_loadu_si128((__m128i const *)(b + i));
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(lo, hi));
+	}
+	blend_rows_c(a + m, b + m, f, d + m, n - m);
+}
+
+// gather がないので2つの標本は1つずつ読んで32ビットの組にし、重み付けは8バイトずつ _mm_madd_epi16 で行う
+TARGET_SSSE3 void interpolate_row_ssse3(uint8_t const *s, int sn, uint8_t *d, int n, int32_t const *i0, int32_t const *i1, int32_t const *w)
+{
+	const __m128i round = _mm_set1_epi32(128);
+	auto pair = [&](int j){
+		return s[i0[j]] | (s[i1[j]] << 16);
+	};
+	int m = n & ~7;
+	for (int j = 0; j < m; j += 8) {
+		__m128i lo = _mm_setr_epi32(pair(j), pair(j + 1), pair(j + 2), pair(j + 3));
+		__m128i hi = _mm_setr_epi32(pair(j + 4), pair(j + 5), pair(j + 6), pair(j + 7));
+		lo = _mm_madd_epi16(lo, _mm_loadu_si128((__m128i const *)(w + j)));
+		hi = _mm_madd_epi16(hi, _mm_loadu_si128((__m128i const *)(w + j + 4)));
+		lo = _mm_srli_epi32(_mm_add_epi32(lo, round), 8);
+		hi = _mm_srli_epi32(_mm_add_epi32(hi, round), 8);
+		__m128i v = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *)(d + j), _mm_packus_epi16(v, v));
+	}
+	interpolate_row_c(s, sn, d + m, n - m, i0 + m, i1 + m, w + m);
+}
+
+ImageKernels::Table make_ssse3_table()
+{
+	ImageKernels::Table t;
+	t.swap_yuv422 = swap_yuv422_ssse3;
+	t.uyvy_to_rgb = yuv422_to_rgb_ssse3<true>;
+	t.yuyv_to_rgb = yuv422_to_rgb_ssse3<false>;
+	t.gray_to_rgb = gray_to_rgb_ssse3;
+	t.rgb_to_gray = rgb_to_gray_ssse3;
+	t.uyvy_to_gray = yuv422_to_gray_ssse3<true>;
+	t.yuyv_to_gray = yuv422_to_gray_ssse3<false>;
+	t.rgb_to_uyvy = rgb_to_yuv422_ssse3<true>;
+	t.rgb_to_yuyv = rgb_to_yuv422_ssse3<false>;
+	t.gray_to_uyvy = gray_to_yuv422_ssse3<true>;
+	t.gray_to_yuyv = gray_to_yuv422_ssse3<false>;
+	t.v210_to_yuyv16 = v210_to_yuyv16_ssse3;
+	t.yuyv16_to_yuyv = yuyv16_to_yuyv_ssse3;
+	t.yuyv_to_yuyv16 = yuyv_to_yuyv16_ssse3;
+	t.uyvy_get_luma = get_luma_ssse3<true>;
+	t.yuyv_get_luma = get_luma_ssse3<false>;
+	t.uyvy_set_luma = set_luma_ssse3<true>;
+	t.yuyv_set_luma = set_luma_ssse3<false>;
+	t.accumulate_row = accumulate_row_ssse3;
+	t.blend_rows = blend_rows_ssse3;
+	t.interpolate_row = interpolate_row_ssse3;
+	return t;
+}
+
+ImageKernels::Table const *ssse3_table()
+{
+	static const ImageKernels::Table t = make_ssse3_table();
+	return &t;
+}
+
+// AVX2
+// 入出力の並べ替えはSSSE3版と共通で、演算部分を256ビットで行う
+
+TARGET_AVX2 inline __m256i coef256(int lo, int hi)
+{
+	return _mm256_set1_epi32((int)(((uint32_t)(uint16_t)hi << 16) | (uint16_t)lo));
+}
+
+TARGET_AVX2 inline __m256i div1024(__m256i x)
+{
+	return _mm256_srai_epi32(_mm256_add_epi32(x, _mm256_and_si256(_mm256_srai_epi32(x, 31), _mm256_set1_epi32(1023))), 10);
+}
+
+TARGET_AVX2 inline __m256i combine(__m128i lo, __m128i hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+TARGET_AVX2 inline __m128i packus256(__m256i a)
+{
+	return _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+}
+
+TARGET_AVX2 inline void yuv_to_rgb_16_avx2(__m128i y0, __m128i y1, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i Y = _mm256_sub_epi16(combine(y0, y1), _mm256_set1_epi16(16));
+	__m256i U = _mm256_sub_epi16(combine(_mm_unpacklo_epi16(u, u), _mm_unpackhi_epi16(u, u)), _mm256_set1_epi16(128));
+	__m256i V = _mm256_sub_epi16(combine(_mm_unpacklo_epi16(v, v), _mm_unpackhi_epi16(v, v)), _mm256_set1_epi16(128));
+	__m256i yv0 = _mm256_unpacklo_epi16(Y, V);
+	__m256i yv1 = _mm256_unpackhi_epi16(Y, V);
+	__m256i yu0 = _mm256_unpacklo_epi16(Y, U);
+	__m256i yu1 = _mm256_unpackhi_epi16(Y, U);
+	__m256i v0 = _mm256_unpacklo_epi16(V, zero);
+	__m256i v1 = _mm256_unpackhi_epi16(V, zero);
+	__m256i R = _mm256_packs_epi32(div1024(_mm256_madd_epi16(yv0, coef256(1192, 1634))), div1024(_mm256_madd_epi16(yv1, coef256(1192, 1634))));
+	__m256i B = _mm256_packs_epi32(div1024(_mm256_madd_epi16(yu0, coef256(1192, 2065))), div1024(_mm256_madd_epi16(yu1, coef256(1192, 2065))));
+	__m256i g0 = _mm256_add_epi32(_mm256_madd_epi16(yu0, coef256(1192, -400)), _mm256_madd_epi16(v0, coef256(-832, 0)));
+	__m256i g1 = _mm256_add_epi32(_mm256_madd_epi16(yu1, coef256(1192, -400)), _mm256_madd_epi16(v1, coef256(-832, 0)));
+	__m256i G = _mm256_packs_epi32(div1024(g0), div1024(g1));
+	*r = packus256(R);
+	*g = packus256(G);
+	*b = packus256(B);
+}
+
+TARGET_AVX2 inline __m128i gray_16_avx2(__m128i r, __m128i g, __m128i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i R = _mm256_cvtepu8_epi16(r);
+	__m256i G = _mm256_cvtepu8_epi16(g);
+	__m256i B = _mm256_cvtepu8_epi16(b);
+	__m256i t0 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(R, G), coef256(306, 601)), _mm256_madd_epi16(_mm256_unpacklo_epi16(B, zero), coef256(117, 0)));
+	__m256i t1 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(R, G), coef256(306, 601)), _mm256_madd_epi16(_mm256_unpackhi_epi16(B, zero), coef256(117, 0)));
+	return packus256(_mm256_packs_epi32(_mm256_srli_epi32(t0, 10), _mm256_srli_epi32(t1, 10)));
+}
+
+template <bool UYVY> TARGET_AVX2 inline void rgb_to_yuv_16_avx2(__m128i r, __m128i g, __m128i b, uint8_t *d)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	__m256i R = _mm256_cvtepu8_epi16(r);
+	__m256i G = _mm256_cvtepu8_epi16(g);
+	__m256i B = _mm256_cvtepu8_epi16(b);
+	__m256i y0 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(R, G), coef256(263, 516)), _mm256_madd_epi16(_mm256_unpacklo_epi16(B, zero), coef256(100, 0)));
+	__m256i y1 = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(R, G), coef256(263, 516)), _mm256_madd_epi16(_mm256_unpackhi_epi16(B, zero), coef256(100, 0)));
+	__m256i Y = _mm256_add_epi16(_mm256_packs_epi32(_mm256_srli_epi32(y0, 10), _mm256_srli_epi32(y1, 10)), _mm256_set1_epi16(16));
+	__m256i ra = _mm256_srli_epi32(_mm256_madd_epi16(R, one), 1);
+	__m256i ga = _mm256_srli_epi32(_mm256_madd_epi16(G, one), 1);
+	__m256i ba = _mm256_srli_epi32(_mm256_madd_epi16(B, one), 1);
+	__m256i rga = _mm256_or_si256(ra, _mm256_slli_epi32(ga, 16));
+	__m256i u = _mm256_add_epi32(_mm256_madd_epi16(rga, coef256(-152, -298)), _mm256_madd_epi16(ba, coef256(450, 0)));
+	__m256i v = _mm256_add_epi32(_mm256_madd_epi16(rga, coef256(450, -377)), _mm256_madd_epi16(ba, coef256(-73, 0)));
+	u = _mm256_add_epi32(div1024(u), _mm256_set1_epi32(128));
+	v = _mm256_add_epi32(div1024(v), _mm256_set1_epi32(128));
+	__m128i U = _mm_packs_epi32(_mm256_castsi256_si128(u), _mm256_extracti128_si256(u, 1));
+	__m128i V = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	store_yuv422<UYVY>(d, packus256(Y), U, V);
+}
+
+template <bool UYVY> TARGET_AVX2 void yuv422_to_rgb_avx2(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i y0, y1, u, v, r, g, b;
+		load_yuv422<UYVY>(s + x * 2, &y0, &y1, &u, &v);
+		yuv_to_rgb_16_avx2(y0, y1, u, v, &r, &g, &b);
+		store_rgb(d + x * 3, r, g, b);
+	}
+	if (UYVY) {
+		yuv422_to_rgb_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_rgb_c<YUYV_>(s, d, n, w);
+	}
+}
+
+template <bool UYVY> TARGET_AVX2 void yuv422_to_gray_avx2(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i y0, y1, u, v, r, g, b;
+		load_yuv422<UYVY>(s + x * 2, &y0, &y1, &u, &v);
+		yuv_to_rgb_16_avx2(y0, y1, u, v, &r, &g, &b);
+		_mm_storeu_si128((__m128i *)(d + x), gray_16_avx2(r, g, b));
+	}
+	if (UYVY) {
+		yuv422_to_gray_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_gray_c<YUYV_>(s, d, n, w);
+	}
+}
+
+TARGET_AVX2 void rgb_to_gray_avx2(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i r, g, b;
+		load_rgb(s + x * 3, &r, &g, &b);
+		_mm_storeu_si128((__m128i *)(d + x), gray_16_avx2(r, g, b));
+	}
+	rgb_to_gray_c(s, d, n, w);
+}
+
+template <bool UYVY> TARGET_AVX2 void rgb_to_yuv422_avx2(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		__m128i r, g, b;
+		load_rgb(s + x * 3, &r, &g, &b);
+		rgb_to_yuv_16_avx2<UYVY>(r, g, b, d + x * 2);
+	}
+	if (UYVY) {
+		rgb_to_yuv422_c<UYVY_>(s, d, n, w);
+	} else {
+		rgb_to_yuv422_c<YUYV_>(s, d, n, w);
+	}
+}
+
+TARGET_AVX2 void accumulate_row_avx2(uint8_t const *s, uint16_t *acc, int n)
+{
+	int m = n & ~31;
+	for (int i = 0; i < m; i += 32) {
+		__m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(s + i)));
+		__m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(s + i + 16)));
+		__m256i *p = (__m256i *)(acc + i);
+		_mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), lo));
+		_mm256_storeu_si256(p + 1, _mm256_add_epi16(_mm256_loadu_si256(p + 1), hi));
+	}
+	accumulate_row_c(s + m, acc + m, n - m);
+}
+
+TARGET_AVX2 void blend_rows_avx2(uint8_t const *a, uint8_t const *b, int f, uint8_t *d, int n)
+{
+	const __m256i wa = _mm256_set1_epi16(256 - f);
+	const __m256i wb = _mm256_set1_epi16(f);
+	const __m256i round = _mm256_set1_epi16(128);
+	int m = n & ~15;
+	for (int i = 0; i < m; i += 16) {
+		__m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(a + i)));
+		__m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const *)(b + i)));
+		__m256i v = _mm256_add_epi16(_mm256_mullo_epi16(va, wa), _mm256_mullo_epi16(vb, wb));
+		v = _mm256_srli_epi16(_mm256_add_epi16(v, round), 8);
+		__m128i r = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		_mm_storeu_si128((__m128i *)(d + i), r);
+	}
+	blend_rows_c(a + m, b + m, f, d + m, n - m);
+}
+
+// 2つの標本を gather で8バイト分ずつ読む。gather は4バイト読むので、行の最後の3バイトを指す組はスカラーで処理する
+TARGET_AVX2 void interpolate_row_avx2(uint8_t const *s, int sn, uint8_t *d, int n, int32_t const *i0, int32_t const *i1, int32_t const *w)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	const __m256i round = _mm256_set1_epi32(128);
+	const __m256i last = _mm256_set1_epi32(sn - 4);
+	const __m256i order = _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+	int m = n & ~7;
+	for (int j = 0; j < m; j += 8) {
+		__m256i a = _mm256_loadu_si256((__m256i const *)(i0 + j));
+		__m256i b = _mm256_loadu_si256((__m256i const *)(i1 + j));
+		if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi32(a, last), _mm256_cmpgt_epi32(b, last)))) {
+			interpolate_row_c(s, sn, d + j, 8, i0 + j, i1 + j, w + j);
+			continue;
+		}
+		a = _mm256_and_si256(_mm256_i32gather_epi32((int const *)s, a, 1), mask);
+		b = _mm256_and_si256(_mm256_i32gather_epi32((int const *)s, b, 1), mask);
+		__m256i v = _mm256_madd_epi16(_mm256_or_si256(a, _mm256_slli_epi32(b, 16)), _mm256_loadu_si256((__m256i const *)(w + j)));
+		v = _mm256_srli_epi32(_mm256_add_epi32(v, round), 8);
+		v = _mm256_packs_epi32(v, v);
+		v = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(v, v), order); // 各レーンの先頭の4バイトを並べる
+		_mm_storel_epi64((__m128i *)(d + j), _mm256_castsi256_si128(v));
+	}
+	interpolate_row_c(s, sn, d + m, n - m, i0 + m, i1 + m, w + m);
+}
+
+ImageKernels::Table make_avx2_table()
+{
+	ImageKernels::Table t = make_ssse3_table();
+	t.uyvy_to_rgb = yuv422_to_rgb_avx2<true>;
+	t.yuyv_to_rgb = yuv422_to_rgb_avx2<false>;
+	t.rgb_to_gray = rgb_to_gray_avx2;
+	t.uyvy_to_gray = yuv422_to_gray_avx2<true>;
+	t.yuyv_to_gray = yuv422_to_gray_avx2<false>;
+	t.rgb_to_uyvy = rgb_to_yuv422_avx2<true>;
+	t.rgb_to_yuyv = rgb_to_yuv422_avx2<false>;
+	t.accumulate_row = accumulate_row_avx2;
+	t.blend_rows = blend_rows_avx2;
+	t.interpolate_row = interpolate_row_avx2;
+	return t;
+}
+
+ImageKernels::Table const *avx2_table()
+{
+	static const ImageKernels::Table t = make_avx2_table();
+	return &t;
+}
+
+#endif // USE_X86_SIMD
+
+#ifdef USE_NEON
+
+// NEON
+// UYVY/YUYV は vld4 で32画素ずつ、RGB/GRAY は16画素ずつ処理する
+
+inline int32x4_t div1024(int32x4_t x)
+{
+	return vshrq_n_s32(vaddq_s32(x, vandq_s32(vshrq_n_s32(x, 31), vdupq_n_s32(1023))), 10);
+}
+
+inline uint8x8_t narrow_clamp(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovun_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+}
+
+// 8画素分。y, u, v は画素ごとの値
+inline void yuv_to_rgb_8(uint8x8_t y8, uint8x8_t u8, uint8x8_t v8, uint8x8_t *r, uint8x8_t *g, uint8x8_t *b)
+{
+	int16x8_t y = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16));
+	int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128));
+	int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128));
+	int32x4_t y0 = vmull_n_s16(vget_low_s16(y), 1192);
+	int32x4_t y1 = vmull_n_s16(vget_high_s16(y), 1192);
+	int32x4_t r0 = vmlal_n_s16(y0, vget_low_s16(v), 1634);
+	int32x4_t r1 = vmlal_n_s16(y1, vget_high_s16(v), 1634);
+	int32x4_t g0 = vmlal_n_s16(vmlal_n_s16(y0, vget_low_s16(u), -400), vget_low_s16(v), -832);
+	int32x4_t g1 = vmlal_n_s16(vmlal_n_s16(y1, vget_high_s16(u), -400), vget_high_s16(v), -832);
+	int32x4_t b0 = vmlal_n_s16(y0, vget_low_s16(u), 2065);
+	int32x4_t b1 = vmlal_n_s16(y1, vget_high_s16(u), 2065);
+	*r = narrow_clamp(div1024(r0), div1024(r1));
+	*g = narrow_clamp(div1024(g0), div1024(g1));
+	*b = narrow_clamp(div1024(b0), div1024(b1));
+}
+
+inline uint8x8_t gray_8(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+	uint16x8_t R = vmovl_u8(r);
+	uint16x8_t G = vmovl_u8(g);
+	uint16x8_t B = vmovl_u8(b);
+	uint32x4_t t0 = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_low_u16(R), 306), vget_low_u16(G), 601), vget_low_u16(B), 117);
+	uint32x4_t t1 = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_high_u16(R), 306), vget_high_u16(G), 601), vget_high_u16(B), 117);
+	return vmovn_u16(vcombine_u16(vshrn_n_u32(t0, 10), vshrn_n_u32(t1, 10)));
+}
+
+// 32画素を偶数画素と奇数画素に分けて変換し、画素順に並べ直す
+template <bool UYVY> inline void yuv422_to_rgb_32(uint8_t const *s, uint8x16x3_t *lo, uint8x16x3_t *hi)
+{
+	uint8x16x4_t a = vld4q_u8(s);
+	uint8x16_t U = UYVY ? a.val[0] : a.val[1];
+	uint8x16_t Y0 = UYVY ? a.val[1] : a.val[0];
+	uint8x16_t V = UYVY ? a.val[2] : a.val[3];
+	uint8x16_t Y1 = UYVY ? a.val[3] : a.val[2];
+	uint8x8_t er[2], eg[2], eb[2], orr[2], og[2], ob[2];
+	yuv_to_rgb_8(vget_low_u8(Y0), vget_low_u8(U), vget_low_u8(V), &er[0], &eg[0], &eb[0]);
+	yuv_to_rgb_8(vget_high_u8(Y0), vget_high_u8(U), vget_high_u8(V), &er[1], &eg[1], &eb[1]);
+	yuv_to_rgb_8(vget_low_u8(Y1), vget_low_u8(U), vget_low_u8(V), &orr[0], &og[0], &ob[0]);
+	yuv_to_rgb_8(vget_high_u8(Y1), vget_high_u8(U), vget_high_u8(V), &orr[1], &og[1], &ob[1]);
+	uint8x16x2_t r = vzipq_u8(vcombine_u8(er[0], er[1]), vcombine_u8(orr[0], orr[1]));
+	uint8x16x2_t g = vzipq_u8(vcombine_u8(eg[0], eg[1]), vcombine_u8(og[0], og[1]));
+	uint8x16x2_t b = vzipq_u8(vcombine_u8(eb[0], eb[1]), vcombine_u8(ob[0], ob[1]));
+	lo->val[0] = r.val[0];
+	lo->val[1] = g.val[0];
+	lo->val[2] = b.val[0];
+	hi->val[0] = r.val[1];
+	hi->val[1] = g.val[1];
+	hi->val[2] = b.val[1];
+}
+
+void swap_yuv422_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		vst1q_u8(d + x * 2, vrev16q_u8(vld1q_u8(s + x * 2)));
+	}
+	swap_yuv422_c(s, d, n, w);
+}
+
+template <bool UYVY> void yuv422_to_rgb_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~31;
+	for (int x = 0; x < n; x += 32) {
+		uint8x16x3_t lo, hi;
+		yuv422_to_rgb_32<UYVY>(s + x * 2, &lo, &hi);
+		vst3q_u8(d + x * 3, lo);
+		vst3q_u8(d + x * 3 + 48, hi);
+	}
+	if (UYVY) {
+		yuv422_to_rgb_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_rgb_c<YUYV_>(s, d, n, w);
+	}
+}
+
+template <bool UYVY> void yuv422_to_gray_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~31;
+	for (int x = 0; x < n; x += 32) {
+		uint8x16x3_t lo, hi;
+		yuv422_to_rgb_32<UYVY>(s + x * 2, &lo, &hi);
+		vst1q_u8(d + x, vcombine_u8(gray_8(vget_low_u8(lo.val[0]), vget_low_u8(lo.val[1]), vget_low_u8(lo.val[2])), gray_8(vget_high_u8(lo.val[0]), vget_high_u8(lo.val[1]), vget_high_u8(lo.val[2]))));
+		vst1q_u8(d + x + 16, vcombine_u8(gray_8(vget_low_u8(hi.val[0]), vget_low_u8(hi.val[1]), vget_low_u8(hi.val[2])), gray_8(vget_high_u8(hi.val[0]), vget_high_u8(hi.val[1]), vget_high_u8(hi.val[2]))));
+	}
+	if (UYVY) {
+		yuv422_to_gray_c<UYVY_>(s, d, n, w);
+	} else {
+		yuv422_to_gray_c<YUYV_>(s, d, n, w);
+	}
+}
+
+void gray_to_rgb_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16_t a = vld1q_u8(s + x);
+		uint8x16x3_t t = { a, a, a };
+		vst3q_u8(d + x * 3, t);
+	}
+	gray_to_rgb_c(s, d, n, w);
+}
+
+void rgb_to_gray_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16x3_t a = vld3q_u8(s + x * 3);
+		uint8x8_t lo = gray_8(vget_low_u8(a.val[0]), vget_low_u8(a.val[1]), vget_low_u8(a.val[2]));
+		uint8x8_t hi = gray_8(vget_high_u8(a.val[0]), vget_high_u8(a.val[1]), vget_high_u8(a.val[2]));
+		vst1q_u8(d + x, vcombine_u8(lo, hi));
+	}
+	rgb_to_gray_c(s, d, n, w);
+}
+
+// 2画素の平均 (8組) から色差を求める
+inline uint8x8_t chroma_8(uint16x8_t r, uint16x8_t g, uint16x8_t b, int cr, int cg, int cb)
+{
+	int16x8_t R = vreinterpretq_s16_u16(r);
+	int16x8_t G = vreinterpretq_s16_u16(g);
+	int16x8_t B = vreinterpretq_s16_u16(b);
+	int32x4_t t0 = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(vget_low_s16(R), cr), vget_low_s16(G), cg), vget_low_s16(B), cb);
+	int32x4_t t1 = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(vget_high_s16(R), cr), vget_high_s16(G), cg), vget_high_s16(B), cb);
+	t0 = vaddq_s32(div1024(t0), vdupq_n_s32(128));
+	t1 = vaddq_s32(div1024(t1), vdupq_n_s32(128));
+	return narrow_clamp(t0, t1);
+}
+
+template <bool UYVY> void rgb_to_yuv422_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16x3_t a = vld3q_u8(s + x * 3);
+		uint8x8_t y[2];
+		for (int i = 0; i < 2; i++) {
+			uint8x8_t r = i == 0 ? vget_low_u8(a.val[0]) : vget_high_u8(a.val[0]);
+			uint8x8_t g = i == 0 ? vget_low_u8(a.val[1]) : vget_high_u8(a.val[1]);
+			uint8x8_t b = i == 0 ? vget_low_u8(a.val[2]) : vget_high_u8(a.val[2]);
+			uint16x8_t R = vmovl_u8(r);
+			uint16x8_t G = vmovl_u8(g);
+			uint16x8_t B = vmovl_u8(b);
+			uint32x4_t t0 = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_low_u16(R), 263), vget_low_u16(G), 516), vget_low_u16(B), 100);
+			uint32x4_t t1 = vmlal_n_u16(vmlal_n_u16(vmull_n_u16(vget_high_u16(R), 263), vget_high_u16(G), 516), vget_high_u16(B), 100);
+			y[i] = vadd_u8(vmovn_u16(vcombine_u16(vshrn_n_u32(t0, 10), vshrn_n_u32(t1, 10))), vdup_n_u8(16));
+		}
+		uint16x8_t ra = vshrq_n_u16(vpaddlq_u8(a.val[0]), 1);
+		uint16x8_t ga = vshrq_n_u16(vpaddlq_u8(a.val[1]), 1);
+		uint16x8_t ba = vshrq_n_u16(vpaddlq_u8(a.val[2]), 1);
+		uint8x8x2_t ys = vuzp_u8(y[0], y[1]);
+		uint8x8x4_t t;
+		uint8x8_t U = chroma_8(ra, ga, ba, -152, -298, 450);
+		uint8x8_t V = chroma_8(ra, ga, ba, 450, -377, -73);
+		if (UYVY) {
+			t.val[0] = U;
+			t.val[1] = ys.val[0];
+			t.val[2] = V;
+			t.val[3] = ys.val[1];
+		} else {
+			t.val[0] = ys.val[0];
+			t.val[1] = U;
+			t.val[2] = ys.val[1];
+			t.val[3] = V;
+		}
+		vst4_u8(d + x * 2, t);
+	}
+	if (UYVY) {
+		rgb_to_yuv422_c<UYVY_>(s, d, n, w);
+	} else {
+		rgb_to_yuv422_c<YUYV_>(s, d, n, w);
+	}
+}
+
+template <bool UYVY> void gray_to_yuv422_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16_t a = vld1q_u8(s + x);
+		uint8x8_t lo = vadd_u8(vshrn_n_u16(vmull_u8(vget_low_u8(a), vdup_n_u8(225)), 8), vdup_n_u8(16));
+		uint8x8_t hi = vadd_u8(vshrn_n_u16(vmull_u8(vget_high_u8(a), vdup_n_u8(225)), 8), vdup_n_u8(16));
+		uint8x16x2_t t;
+		t.val[UYVY ? 0 : 1] = vdupq_n_u8(128);
+		t.val[UYVY ? 1 : 0] = vcombine_u8(lo, hi);
+		vst2q_u8(d + x * 2, t);
+	}
+	if (UYVY) {
+		gray_to_yuv422_c<0, 1>(s, d, n, w);
+	} else {
+		gray_to_yuv422_c<1, 0>(s, d, n, w);
+	}
+}
+
+void yuyv16_to_yuyv_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		uint16_t const *p = (uint16_t const *)(s + x * 4);
+		vst1q_u8(d + x * 2, vcombine_u8(vshrn_n_u16(vld1q_u16(p), 8), vshrn_n_u16(vld1q_u16(p + 8), 8)));
+	}
+	yuyv16_to_yuyv_c(s, d, n, w);
+}
+
+void yuyv_to_yuyv16_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~7;
+	for (int x = 0; x < n; x += 8) {
+		uint8x16_t a = vld1q_u8(s + x * 2);
+		uint16_t *p = (uint16_t *)(d + x * 4);
+		vst1q_u16(p, vshll_n_u8(vget_low_u8(a), 8));
+		vst1q_u16(p + 8, vshll_n_u8(vget_high_u8(a), 8));
+	}
+	yuyv_to_yuyv16_c(s, d, n, w);
+}
+
+template <bool UYVY> void get_luma_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16x2_t v = vld2q_u8(s + x * 2);
+		vst1q_u8(d + x, v.val[UYVY ? 1 : 0]);
+	}
+	get_luma_c<UYVY ? 1 : 0>(s, d, n, w);
+}
+
+template <bool UYVY> void set_luma_neon(uint8_t const *s, uint8_t *d, int w)
+{
+	int n = w & ~15;
+	for (int x = 0; x < n; x += 16) {
+		uint8x16x2_t v = vld2q_u8(d + x * 2);
+		v.val[UYVY ? 1 : 0] = vld1q_u8(s + x);
+		vst2q_u8(d + x * 2, v);
+	}
+	set_luma_c<UYVY ? 1 : 0>(s, d, n, w);
+}
+
+void accumulate_row_neon(uint8_t const *s, uint16_t *acc, int n)
+{
+	int m = n & ~15;
+	for (int i = 0; i < m; i += 16) {
+		uint8x16_t v = vld1q_u8(s + i);
+		vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(v)));
+		vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(v)));
+	}
+	accumulate_row_c(s + m, acc + m, n - m);
+}
+
+void blend_rows_neon(uint8_t const *a, uint8_t const *b, int f, uint8_t *d, int n)
+{
+	int m = n & ~7;
+	for (int i = 0; i < m; i += 8) {
+		uint16x8_t v = vmulq_n_u16(vmovl_u8(vld1_u8(a + i)), 256 - f);
+		v = vmlaq_n_u16(v, vmovl_u8(vld1_u8(b + i)), f);
+		vst1_u8(d + i, vrshrn_n_u16(v, 8));
+	}
+	blend_rows_c(a + m, b + m, f, d + m, n - m);
+}
+
+// gather がないので2つの標本は1つずつ読み、重み付けは8バイトずつ行う。和は最大65280なので16ビットに収まる
+void interpolate_row_neon(uint8_t const *s, int sn, uint8_t *d, int n, int32_t const *i0, int32_t const *i1, int32_t const *w)
+{
+	int m = n & ~7;
+	for (int j = 0; j < m; j += 8) {
+		uint8_t a[8];
+		uint8_t b[8];
+		for (int k = 0; k < 8; k++) {
+			a[k] = s[i0[j + k]];
+			b[k] = s[i1[j + k]];
+		}
+		uint16x8x2_t f = vld2q_u16((uint16_t const *)(w + j)); // val[0] が i0 の重み、val[1] が i1 の重み
+		uint16x8_t v = vmulq_u16(vmovl_u8(vld1_u8(a)), f.val[0]);
+		v = vmlaq_u16(v, vmovl_u8(vld1_u8(b)), f.val[1]);
+		vst1_u8(d + j, vrshrn_n_u16(v, 8));
+	}
+	interpolate_row_c(s, sn, d + m, n - m, i0 + m, i1 + m, w + m);
+}
+
+ImageKernels::Table make_neon_table()
+{
+	ImageKernels::Table t;
+	t.swap_yuv422 = swap_yuv422_neon;
+	t.uyvy_to_rgb = yuv422_to_rgb_neon<true>;
+	t.yuyv_to_rgb = yuv422_to_rgb_neon<false>;
+	t.gray_to_rgb = gray_to_rgb_neon;
+	t.rgb_to_gray = rgb_to_gray_neon;
+	t.uyvy_to_gray = yuv422_to_gray_neon<true>;
+	t.yuyv_to_gray = yuv422_to_gray_neon<false>;
+	t.rgb_to_uyvy = rgb_to_yuv422_neon<true>;
+	t.rgb_to_yuyv = rgb_to_yuv422_neon<false>;
+	t.gray_to_uyvy = gray_to_yuv422_neon<true>;
+	t.gray_to_yuyv = gray_to_yuv422_neon<false>;
+	t.v210_to_yuyv16 = row_c<v210_to_yuyv16_c>;
+	t.yuyv16_to_yuyv = yuyv16_to_yuyv_neon;
+	t.yuyv_to_yuyv16 = yuyv_to_yuyv16_neon;
+	t.uyvy_get_luma = get_luma_neon<true>;
+	t.yuyv_get_luma = get_luma_neon<false>;
+	t.uyvy_set_luma = set_luma_neon<true>;
+	t.yuyv_set_luma = set_luma_neon<false>;
+	t.accumulate_row = accumulate_row_neon;
+	t.blend_rows = blend_rows_neon;
+	t.interpolate_row = interpolate_row_neon;
+	return t;
+}
+
+ImageKernels::Table const *neon_table()
+{
+	static const ImageKernels::Table t = make_neon_table();
+	return &t;
+}
+
+#endif // USE_NEON
+
+std::atomic<ImageKernels::Table const *> current_table{nullptr};
+std::atomic<ImageKernels::Level> current_level{ImageKernels::Level::Scalar};
+std::atomic_int thread_count{0};
+std::atomic_int threads_in_use{0}; // ThreadBudget が貸し出しているスレッドの数
+
+// 1つの帯の入出力がこの大きさに収まるようにする
+const int BAND_BYTES = 256 * 1024;
+const int MIN_BAND_HEIGHT = 8;
+
+} // namespace
+
+ImageKernels::Level ImageKernels::detect()
+{
+#if defined(USE_X86_SIMD)
+	if (__builtin_cpu_supports("avx2")) return Level::AVX2;
+	if (__builtin_cpu_supports("ssse3")) return Level::SSSE3;
+#elif defined(USE_NEON)
+	return Level::NEON;
+#endif
+	return Level::Scalar;
+}
+
+bool ImageKernels::isSupported(Level level)
+{
+	switch (level) {
+	case Level::Scalar:
+		return true;
+#if defined(USE_X86_SIMD)
+	case Level::SSSE3:
+		return __builtin_cpu_supports("ssse3");
+	case Level::AVX2:
+		return __builtin_cpu_supports("avx2");
+#elif defined(USE_NEON)
+	case Level::NEON:
+		return true;
+#endif
+	default:
+		break;
+	}
+	return false;
+}
+
+ImageKernels::Table const *ImageKernels::table(Level level)
+{
+	if (!isSupported(level)) return nullptr;
+	switch (level) {
+#if defined(USE_X86_SIMD)
+	case Level::SSSE3:
+		return ssse3_table();
+	case Level::AVX2:
+		return avx2_table();
+#elif defined(USE_NEON)
+	case Level::NEON:
+		return neon_table();
+#endif
+	default:
+		break;
+	}
+	return scalar_table();
+}
+
+ImageKernels::Table const *ImageKernels::table()
+{
+	Table const *t = current_table;
+	if (!t) {
+		setLevel(detect());
+		t = current_table;
+	}
+	return t;
+}
+
+void ImageKernels::setLevel(Level level)
+{
+	Table const *t = table(level);
+	if (!t) {
+		level = Level::Scalar;
+		t = scalar_table();
+	}
+	current_level = level;
+	current_table = t;
+}
+
+ImageKernels::Level ImageKernels::level()
+{
+	table();
+	return current_level;
+}
+
+void ImageKernels::setThreadCount(int n)
+{
+	thread_count = std::max(n, 0);
+}
+
+int ImageKernels::threadCount()
+{
+	int n = thread_count;
+	return n > 0 ? n : omp_get_num_procs();
+}
+
+ImageKernels::ThreadBudget::ThreadBudget(int wanted)
+{
+	// 並列領域の中から呼ばれたときは、外側の領域がすでに借りている
+	if (omp_in_parallel()) return;
+	const int limit = threadCount();
+	int used = threads_in_use.load();
+	int n;
+	do {
+		n = std::clamp(limit - used, 1, std::max(wanted, 1));
+	} while (!threads_in_use.compare_exchange_weak(used, used + n));
+	count_ = n;
+	borrowed_ = true;
+}
+
+ImageKernels::ThreadBudget::~ThreadBudget()
+{
+	if (borrowed_) {
+		threads_in_use -= count_;
+	}
+}
+
+void ImageKernels::parallelRows(int h, int bytes_per_row, std::function<void (int y0, int y1)> const &fn)
+{
+	const int band = std::max(BAND_BYTES / std::max(bytes_per_row, 1), MIN_BAND_HEIGHT);
+	const int bands = (h + band - 1) / band;
+	ThreadBudget budget(std::min(threadCount(), bands));
+	const int threads = budget.count();
+	if (threads < 2) {
+		fn(0, h);
+		return;
+	}
+#pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for (int i = 0; i < bands; i++) {
+		const int y0 = i * band;
+		fn(y0, std::min(y0 + band, h));
+	}
+}
+
+bool ImageKernels::scaleYUV422ToRGB(uint8_t const *src, int sw, int sh, int src_stride, bool uyvy, uint8_t *dst, int dw, int dh, int dst_stride)
+{
+	if (sw < 2 || (sw & 1) || sh < 1 || dw < 1 || dh < 1) return false;
+
+	Table const *t = table();
+	const int n = sw * 2; // 入力の1行のバイト数
+	const int m = (dw + 1) / 2 * 4; // 縮小した UYVY の1行のバイト数
+
+	// 縮小した UYVY の1行を RGB に変換する
+	auto output_row = [&](uint8_t const *s, uint8_t *d){
+		t->uyvy_to_rgb(s, d, dw & ~1);
+		if (dw & 1) {
+			uint8_t const *q = s + m - 4;
+			yuv_to_rgb_c(q[1], q[0], q[2], d + (dw - 1) * 3);
+		}
+	};
+
+	const int kx = sw / dw;
+	const int ky = sh / dh;
+	if (kx * dw == sw && ky * dh == sh && ky <= 256) { // 縦横とも整数分の1なら平均をとる
+		auto box_row = uyvy ? box_row_to_uyvy_c<UYVY_> : box_row_to_uyvy_c<YUYV_>;
+		parallelRows(dh, n * ky, [&](int y0, int y1){
+			std::vector<uint16_t> acc(n);
+			std::vector<uint8_t> tmp(m);
+			for (int y = y0; y < y1; y++) {
+				std::fill(acc.begin(), acc.end(), 0);
+				for (int i = 0; i < ky; i++) {
+					t->accumulate_row(src + (size_t)src_stride * (y * ky + i), acc.data(), n);
+				}
+				box_row(acc.data(), tmp.data(), dw, kx, ky);
+				output_row(tmp.data(), dst + (size_t)dst_stride * y);
+			}
+		});
+		return true;
+	}
+
+	// それ以外は双線形補間。縮小した UYVY の1行の各バイトを、入力の行のどの2バイトからどの重みで作るかを先に求めておく
+	std::vector<int32_t> i0(m);
+	std::vector<int32_t> i1(m);
+	std::vector<int32_t> weight(m);
+	auto set_tap = [&](int j, Tap const &t){
+		i0[j] = t.i0;
+		i1[j] = t.i1;
+		weight[j] = (256 - t.f) | (t.f << 16);
+	};
+	auto luma_offset = [&](int i){
+		return (i & ~1) * 2 + (i & 1) * 2 + (uyvy ? 1 : 0);
+	};
+	const int u_offset = uyvy ? 0 : 1;
+	const int v_offset = uyvy ? 2 : 3;
+	for (int x = 0; x < dw; x++) {
+		Tap t = make_tap(source_position(x, sw, dw), sw);
+		const Tap luma = {luma_offset(t.i0), luma_offset(t.i1), t.f};
+		set_tap(x * 2 + 1, luma);
+		if (x + 1 == dw && !(x & 1)) {
+			set_tap(x * 2 + 3, luma); // 幅が奇数のときは最後の組の2画素目に1画素目を複写する
+		}
+	}
+	for (int x = 0; x < dw; x += 2) {
+		Tap t = make_tap(source_position(x, sw, dw) / 2, sw / 2);
+		set_tap(x * 2, {t.i0 * 4 + u_offset, t.i1 * 4 + u_offset, t.f});
+		set_tap(x * 2 + 2, {t.i0 * 4 + v_offset, t.i1 * 4 + v_offset, t.f});
+	}
+	parallelRows(dh, n * 2, [&](int y0, int y1){
+		std::vector<uint8_t> row(n);
+		std::vector<uint8_t> tmp(m);
+		for (int y = y0; y < y1; y++) {
+			Tap ty = make_tap(source_position(y, sh, dh), sh);
+			uint8_t const *s = src + (size_t)src_stride * ty.i0;
+			if (ty.f != 0) {
+				t->blend_rows(s, src + (size_t)src_stride * ty.i1, ty.f, row.data(), n);
+				s = row.data();
+			}
+			t->interpolate_row(s, n, tmp.data(), m, i0.data(), i1.data(), weight.data());
+			output_row(tmp.data(), dst + (size_t)dst_stride * y);
+		}
+	});
+	return true;
+}
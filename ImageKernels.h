@@ -0,0 +1,75 @@
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <cstdint>
+#include <functional>
+
+// Image::convertToFormat で使う1行単位の変換関数
+class ImageKernels {
+public:
+	enum class Level {
+		Scalar,
+		SSSE3,
+		AVX2,
+		NEON,
+	};
+	typedef void (*RowFunc)(uint8_t const *src, uint8_t *dst, int width);
+	struct Table {
+		RowFunc swap_yuv422 = nullptr; // UYVY <-> YUYV
+		RowFunc uyvy_to_rgb = nullptr;
+		RowFunc yuyv_to_rgb = nullptr;
+		RowFunc gray_to_rgb = nullptr;
+		RowFunc rgb_to_gray = nullptr;
+		RowFunc uyvy_to_gray = nullptr;
+		RowFunc yuyv_to_gray = nullptr;
+		RowFunc rgb_to_uyvy = nullptr;
+		RowFunc rgb_to_yuyv = nullptr;
+		RowFunc gray_to_uyvy = nullptr;
+		RowFunc gray_to_yuyv = nullptr;
+		RowFunc v210_to_yuyv16 = nullptr; // DeckLink bmdFormat10BitYUV
+		RowFunc yuyv16_to_yuyv = nullptr;
+		RowFunc yuyv_to_yuyv16 = nullptr;
+		RowFunc uyvy_get_luma = nullptr; // 輝度だけを取り出す
+		RowFunc yuyv_get_luma = nullptr;
+		RowFunc uyvy_set_luma = nullptr; // dst の輝度だけを src で置き換える
+		RowFunc yuyv_set_luma = nullptr;
+		void (*accumulate_row)(uint8_t const *src, uint16_t *acc, int n) = nullptr; // acc += src（n バイト）
+		void (*blend_rows)(uint8_t const *a, uint8_t const *b, int f, uint8_t *dst, int n) = nullptr; // (a * (256 - f) + b * f) / 256
+		void (*interpolate_row)(uint8_t const *src, int sn, uint8_t *dst, int n, int32_t const *i0, int32_t const *i1, int32_t const *w) = nullptr; // dst[j] = (src[i0[j]] * (w[j] & 0xffff) + src[i1[j]] * (w[j] >> 16)) / 256。src は sn バイト
+	};
+	static Level detect();
+	static bool isSupported(Level level);
+	static Table const *table(Level level);
+	static Table const *table();
+	static void setLevel(Level level);
+	static Level level();
+
+	// 行単位の処理を L2 に収まる高さの帯に分けて OpenMP で並列に実行する
+	static void setThreadCount(int n); // 0 のときはプロセッサ数
+	static int threadCount();
+
+	// 並列処理に使うスレッドをプロセス全体の threadCount() 本から借りる
+	// パイプラインの各スレッドが同時に並列処理を始めても、合わせて threadCount() 本を超えないようにする
+	// 呼び出したスレッド自身は常に1本として数え、残りがなければ count() は 1 になる
+	class ThreadBudget {
+	private:
+		int count_ = 1;
+		bool borrowed_ = false;
+	public:
+		explicit ThreadBudget(int wanted);
+		~ThreadBudget();
+		ThreadBudget(ThreadBudget const &) = delete;
+		void operator = (ThreadBudget const &) = delete;
+		int count() const
+		{
+			return count_;
+		}
+	};
+	static void parallelRows(int h, int bytes_per_row, std::function<void (int y0, int y1)> const &fn);
+
+	// UYVY/YUYV を RGB に変換しながら拡大縮小する。縦横とも整数分の1のときは平均、それ以外は双線形補間
+	// 入力の幅は偶数であること。扱えない場合は false
+	static bool scaleYUV422ToRGB(uint8_t const *src, int sw, int sh, int src_stride, bool uyvy, uint8_t *dst, int dw, int dh, int dst_stride);
+};
+
+#endif // IMAGEKERNELS_H
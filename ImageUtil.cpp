@@ -16,6 +16,7 @@ QImage ImageUtil::qimage(const Image &image)
 		switch (image.format()) {
 		case Image::Format::UYVY8:
 		case Image::Format::YUYV8:
+		case Image::Format::YUYV16:
 		case Image::Format::RGB8:
 			newimage = QImage(w, h, QImage::Format_RGB888);
 			srcimage = image.convertToFormat(Image::Format::RGB8);
@@ -25,9 +26,10 @@ QImage ImageUtil::qimage(const Image &image)
 			srcimage = image;
 			break;
 		}
-		int stride = srcimage.bytesPerLine();
+		const Image &src = srcimage;
+		int stride = w * src.bytesPerPixel();
 		for (int y = 0; y < h; y++) {
-			uint8_t const *s = srcimage.scanLine(y);
+			uint8_t const *s = src.scanLine(y);
 			uint8_t *d = newimage.scanLine(y);
 			memcpy(d, s, stride);
 		}
@@ -45,7 +47,7 @@ Image ImageUtil::image(const QImage &image, Image::Format format)
 	if (format == Image::Format::YUYV8 || format == Image::Format::UYVY8) {
 		const QImage srcimage = image.convertToFormat(QImage::Format_RGB888);
 		Image newimage(w, h, Image::Format::RGB8);
-		int stride = newimage.bytesPerLine();
+		int stride = w * newimage.bytesPerPixel();
 		for (int y = 0; y < h; y++) {
 			uint8_t const *s = srcimage.scanLine(y);
 			uint8_t *d = newimage.scanLine(y);
@@ -65,7 +67,7 @@ Image ImageUtil::image(const QImage &image, Image::Format format)
 		if (qf != QImage::Format_Invalid) {
 			const QImage srcimage = image.convertToFormat(qf);
 			Image newimage(w, h, format);
-			int stride = newimage.bytesPerLine();
+			int stride = w * newimage.bytesPerPixel();
 			for (int y = 0; y < h; y++) {
 				uint8_t const *s = srcimage.scanLine(y);
 				uint8_t *d = newimage.scanLine(y);
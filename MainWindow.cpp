@@ -5,6 +5,7 @@
 #include "FrameProcessThread.h"
 #include "FrameRateCounter.h"
 #include "GlobalData.h"
+#include "ImageKernels.h"
 #include "MySettings.h"
 #include "Rational.h"
 #include "RecordingDialog.h"
@@ -92,6 +93,7 @@ struct MainWindow::Private {
 	FrameRateCounter frame_rate_counter_;
 
 	QString recording_file_path;
+	VideoEncoderOption::Format recording_format = VideoEncoderOption::Format::MPEG4;
 	QDateTime recording_start_time;
 	qint64 recording_seconds = 0;
 
@@ -162,6 +164,13 @@ MainWindow::MainWindow(QWidget *parent)
 		}
 	}
 
+	{
+		MySettings s;
+		s.beginGroup("Global");
+		ImageKernels::setThreadCount(s.value("ConversionThreads", 0).toInt()); // 0: 自動
+		s.endGroup();
+	}
+
 
 	checkBox_audio()->setChecked(true);
 	checkBox_display_mode_auto_detection()->setChecked(true);
@@ -252,6 +261,11 @@ QCheckBox *MainWindow::checkBox_deinterlace()
 	return ui->widget_ui->checkBox_deinterlace();
 }
 
+QCheckBox *MainWindow::checkBox_field_rate()
+{
+	return ui->widget_ui->checkBox_field_rate();
+}
+
 QCheckBox *MainWindow::checkBox_display_mode_auto_detection()
 {
 	return ui->widget_ui->checkBox_display_mode_auto_detection();
@@ -304,6 +318,14 @@ void MainWindow::updateStatusLabel()
 	QString s;
 	s = m->selected_device_name + " / " + m->selected_input_connection_text;
 	s = s + " / " + (m->valid_signal ? m->pixfmt_text : tr("No valid input signal"));
+#ifdef USE_FFMPEG
+	if (m->video_encoder) {
+		// 符号化が追いついているかを見られるように、待ち行列の状態を出す
+		FFmpegVideoEncoder::Stats t = m->video_encoder->stats();
+		s = s + " / " + QString::asprintf("queue %zu (%.0f MB, peak %.0f MB) dropped %llu degraded %llu latency %.0f ms (max %.0f ms)", t.video_queue, t.queued_bytes / (1024.0 * 1024.0), t.max_queued_bytes / (1024.0 * 1024.0), (unsigned long long)t.dropped_video_frames, (unsigned long long)t.degraded_video_frames, t.latency_ms, t.max_latency_ms);
+		s = s + " / " + QString::asprintf("write %.1f MB/s", t.write_mbps);
+	}
+#endif
 	setStatusBarText(s);
 }
 
@@ -719,6 +741,17 @@ void MainWindow::on_checkBox_audio_stateChanged(int arg1)
 void MainWindow::on_checkBox_deinterlace_stateChanged(int arg1)
 {
 	m->frame_process_thread.enableDeinterlace(arg1 == Qt::Checked);
+	checkBox_field_rate()->setEnabled(arg1 == Qt::Checked);
+}
+
+void MainWindow::on_checkBox_field_rate_stateChanged(int arg1)
+{
+	m->frame_process_thread.enableFieldRate(arg1 == Qt::Checked);
+}
+
+bool MainWindow::isFieldRateEnabled() const
+{
+	return ui->widget_ui->checkBox_deinterlace()->isChecked() && ui->widget_ui->checkBox_field_rate()->isChecked();
 }
 
 ImageWidget *MainWindow::currentImageWidget()
@@ -729,7 +762,8 @@ ImageWidget *MainWindow::currentImageWidget()
 void MainWindow::ready(VideoFrameData const &frame)
 {
 	if (frame) {
-		while (m->prepared_frames.size() > 2) {
+		const size_t max = isFieldRateEnabled() ? 4 : 2; // フィールドごとのときは1回の入力に2枚ずつ届く
+		while (m->prepared_frames.size() > max) {
 			m->prepared_frames.pop_front();
 		}
 		m->prepared_frames.push_back(frame);
@@ -742,6 +776,14 @@ void MainWindow::newFrame(VideoFrameData const &frame)
 
 	if (frame) {
 		m->frame_rate_counter_.increment();
+		m->field_dominance = frame.d->field_dominance; // 入力の形式が自動で切り替わったときのため
+
+#ifdef USE_FFMPEG
+		// 処理スレッドが画像を置き換える前に渡す
+		if (m->video_encoder) {
+			m->video_encoder->put_frame(frame);
+		}
+#endif
 
 		QSize size;
 		if (isFullScreen()) {
@@ -751,12 +793,6 @@ void MainWindow::newFrame(VideoFrameData const &frame)
 		}
 		m->frame_process_thread.request(frame, size);
 
-#ifdef USE_FFMPEG
-		if (m->video_encoder) {
-			m->video_encoder->put_frame(frame);
-		}
-#endif
-
 		if (m->pixfmt != frame.d->pixfmt) {
 			m->pixfmt = frame.d->pixfmt;
 			BMDPixelFormat pixfmt = frame.d->pixfmt;
@@ -781,19 +817,34 @@ void MainWindow::newFrame(VideoFrameData const &frame)
 		}
 	}
 
+	showPreparedFrame();
+
+	// 後のフィールドは半フレーム後に表示する
+	if (!m->prepared_frames.empty() && m->prepared_frames.front().d->second_field && m->fps.num > 0) {
+		int ms = int(500 * m->fps.den / m->fps.num);
+		QTimer::singleShot(ms, this, [&](){
+			if (!m->prepared_frames.empty() && m->prepared_frames.front().d->second_field) {
+				showPreparedFrame();
+			}
+		});
+	}
+
+	updateStatusLabel();
+}
+
+void MainWindow::showPreparedFrame()
+{
 	if (!m->prepared_frames.empty()) {
 		VideoFrameData f = m->prepared_frames.front();
 		m->prepared_frames.pop_front();
 
 		if (f) {
-			if (m->audio_output_device) {
+			if (m->audio_output_device && !f.d->audio.isEmpty()) {
 				m->audio_output_device->write(f.d->audio);
 			}
 			currentImageWidget()->setImage(f.d->image_for_view);
 		}
 	}
-
-	updateStatusLabel();
 }
 
 bool MainWindow::isRecording() const
@@ -836,12 +887,14 @@ void MainWindow::toggleRecord()
 		aopt.active = true;
 		vopt.src_w = m->video_width;
 		vopt.src_h = m->video_height;
+		vopt.bit_depth = m->pixfmt == bmdFormat10BitYUV ? 10 : 8;
 		vopt.fps = m->fps;
+		vopt.field_rate = isFieldRateEnabled() && m->field_dominance != bmdProgressiveFrame && m->field_dominance != bmdProgressiveSegmentedFrame;
 		m->video_encoder = std::make_shared<FFmpegVideoEncoder>();
 #ifdef Q_OS_WIN
-		m->video_encoder->create(m->recording_file_path.toStdString(), VideoEncoderOption::Format::MPEG4, vopt, aopt);
+		m->video_encoder->create(m->recording_file_path.toStdString(), m->recording_format, vopt, aopt);
 #else
-		m->video_encoder->create(m->recording_file_path.toStdString(), VideoEncoderOption::Format::MPEG4, vopt, aopt);
+		m->video_encoder->create(m->recording_file_path.toStdString(), m->recording_format, vopt, aopt);
 #endif
 		notifyRecordingProgress(0, m->recording_seconds);
 	}
@@ -979,6 +1032,7 @@ void MainWindow::startRecord()
 		stopRecord();
 
 		m->recording_file_path = dlg.path();
+		m->recording_format = dlg.format();
 
 		QTime t = dlg.maximumLength();
 		m->recording_seconds = seconds(t);
@@ -38,6 +38,7 @@ private:
 	QListWidget *listWidget_display_mode();
 	QCheckBox *checkBox_audio();
 	QCheckBox *checkBox_deinterlace();
+	QCheckBox *checkBox_field_rate();
 	QCheckBox *checkBox_display_mode_auto_detection();
 
 	void setStatusBarText(const QString &text);
@@ -55,6 +56,8 @@ private:
 	void setFullScreen(bool f);
 	ImageWidget *currentImageWidget();
 	void updateStatusLabel();
+	bool isFieldRateEnabled() const;
+	void showPreparedFrame();
 protected:
 	void timerEvent(QTimerEvent *event) override;
 	void mouseDoubleClickEvent(QMouseEvent *event) override;
@@ -98,6 +101,7 @@ private slots:
 	void on_action_view_small_lq_triggered();
 	void on_checkBox_audio_stateChanged(int arg1);
 	void on_checkBox_deinterlace_stateChanged(int arg1);
+	void on_checkBox_field_rate_stateChanged(int arg1);
 	void on_checkBox_display_mode_auto_detection_clicked(bool checked);
 	void on_listWidget_display_mode_currentRowChanged(int currentRow);
 	void on_listWidget_display_mode_itemDoubleClicked(QListWidgetItem *item);
@@ -3,6 +3,23 @@
 #include "MySettings.h"
 #include <QFileDialog>
 
+namespace {
+
+struct FormatItem {
+	VideoEncoderOption::Format format;
+	char const *name; // 設定に保存する名前
+	char const *text;
+};
+
+const FormatItem FORMAT_ITEMS[] = {
+	{VideoEncoderOption::Format::MPEG4, "mpeg4", QT_TR_NOOP("MPEG-4 (MP4)")},
+	{VideoEncoderOption::Format::RAWVIDEO, "rawvideo", QT_TR_NOOP("Uncompressed UYVY / v210 (MKV)")},
+	{VideoEncoderOption::Format::FFV1, "ffv1", QT_TR_NOOP("FFV1 lossless (MKV)")},
+	{VideoEncoderOption::Format::UTVIDEO, "utvideo", QT_TR_NOOP("Ut Video lossless (MKV)")},
+};
+
+} // namespace
+
 RecordingDialog::RecordingDialog(QWidget *parent)
 	: QDialog(parent)
 	, ui(new Ui::RecoringDialog)
@@ -13,6 +30,10 @@ RecordingDialog::RecordingDialog(QWidget *parent)
 
 	ui->timeEdit->setTime(QTime(3, 0, 0));
 
+	for (FormatItem const &t : FORMAT_ITEMS) {
+		ui->comboBox_format->addItem(tr(t.text));
+	}
+
 	{
 		MySettings s;
 		s.beginGroup("Global");
@@ -30,6 +51,14 @@ RecordingDialog::RecordingDialog(QWidget *parent)
 			}
 			ui->timeEdit->setTime({h, m, s});
 		}
+		{
+			QString name = s.value("RecordingFormat").toString();
+			for (int i = 0; i < (int)(sizeof(FORMAT_ITEMS) / sizeof(*FORMAT_ITEMS)); i++) {
+				if (name == FORMAT_ITEMS[i].name) {
+					ui->comboBox_format->setCurrentIndex(i);
+				}
+			}
+		}
 		s.endGroup();
 	}
 }
@@ -49,6 +78,12 @@ QString RecordingDialog::path() const
 	return ui->lineEdit_path->text();
 }
 
+VideoEncoderOption::Format RecordingDialog::format() const
+{
+	int i = ui->comboBox_format->currentIndex();
+	return i >= 0 ? FORMAT_ITEMS[i].format : VideoEncoderOption::Format::MPEG4;
+}
+
 void RecordingDialog::on_pushButton_browse_clicked()
 {
 	QString path = ui->lineEdit_path->text();
@@ -66,6 +101,10 @@ void RecordingDialog::done(int v)
 		s.beginGroup("Global");
 		s.setValue("SaveVideoPath", path());
 		s.setValue("MaximumLength", QString::asprintf("%d:%02d:%02d", t.hour(), t.minute(), t.second()));
+		int i = ui->comboBox_format->currentIndex();
+		if (i >= 0) {
+			s.setValue("RecordingFormat", FORMAT_ITEMS[i].name);
+		}
 		s.endGroup();
 	}
 	QDialog::done(v);
@@ -1,6 +1,7 @@
 #ifndef RECORDINGDIALOG_H
 #define RECORDINGDIALOG_H
 
+#include "VideoEncoderOption.h"
 #include <QDialog>
 
 namespace Ui {
@@ -16,6 +17,7 @@ public:
 	~RecordingDialog();
 	QTime maximumLength() const;
 	QString path() const;
+	VideoEncoderOption::Format format() const;
 private slots:
 	void on_pushButton_browse_clicked();
 public slots:
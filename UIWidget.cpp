@@ -42,6 +42,11 @@ QCheckBox *UIWidget::checkBox_deinterlace()
 	return ui->checkBox_deinterlace;
 }
 
+QCheckBox *UIWidget::checkBox_field_rate()
+{
+	return ui->checkBox_field_rate;
+}
+
 QCheckBox *UIWidget::checkBox_display_mode_auto_detection()
 {
 	return ui->checkBox_display_mode_auto_detection;
@@ -32,6 +32,7 @@ public:
 	QListWidget *listWidget_display_mode();
 	QCheckBox *checkBox_audio();
 	QCheckBox *checkBox_deinterlace();
+	QCheckBox *checkBox_field_rate();
 	QCheckBox *checkBox_display_mode_auto_detection();
 private slots:
 #if 0
@@ -3,6 +3,8 @@
 
 #include "Rational.h"
 #include <functional>
+#include <cstddef>
+#include <cstdint>
 
 namespace VideoEncoderInternal {
 class AudioFrame;
@@ -15,6 +17,17 @@ enum class Format {
 	H264_NVENC,
 	HEVC_NVENC,
 	LIBSVTAV1,
+	// 取り込み用。MKV に書く
+	RAWVIDEO, // 8ビットは UYVY のまま、10ビットは v210
+	FFV1,
+	UTVIDEO,
+};
+// 入力の映像が queue_bytes を超えたときの扱い
+enum class OverflowPolicy {
+	Block, // 空くまで put_frame を待たせる（ファイルからの変換など、取りこぼせないとき）
+	DropOldest, // 古いフレームから捨てる
+	DropNewest, // 新しいフレームを捨てる
+	Degrade, // 新しいフレームを縦横半分に縮めて積む
 };
 struct AudioOption {
 	bool active = false;
@@ -22,14 +35,24 @@ struct AudioOption {
 	int sample_rate = 48000;
 	int channels = 2;
 };
+// 出力ファイルの書き込み。AsyncFileWriter に渡す
+struct OutputOption {
+	size_t buffer_size = 4 * 1024 * 1024;
+	int buffers = 16;
+	bool direct_io = false;
+	int64_t preallocate = 0; // バイト数
+};
 struct VideoOption {
 	bool active = false;
-	bool drop_if_overflow = true;
+	size_t queue_bytes = 512 * 1024 * 1024; // 変換を待つフレームの上限
+	OverflowPolicy overflow_policy = OverflowPolicy::DropOldest;
 	int src_w = 1920;
 	int src_h = 1080;
 	int dst_w = 1920;
 	int dst_h = 1080;
+	int bit_depth = 8; // 10 のとき YUYV16 を受け取り、10ビットの画素形式で符号化する
 	Rational fps = {30, 1};
+	bool field_rate = false; // インタレースの入力をフィールドごとに補間し、fps の2倍のレートで符号化する
 };
 }
 
@@ -11,13 +11,7 @@
 
 class VideoFrameData {
 public:
-	enum State {
-		Idle,
-		Busy,
-		Ready,
-	};
 	struct Data {
-		State state = Idle;
 		Image image;
 		QByteArray audio;
 		QImage image_for_view;
@@ -25,6 +19,13 @@ public:
 
 		AncillaryDataStruct ancillary_data = {};
 		BMDPixelFormat pixfmt = bmdFormatUnspecified;
+		BMDFieldDominance field_dominance = bmdUnknownFieldDominance;
+		bool second_field = false; // フィールドごとに出力するときの後のフィールド
+		// 入力装置の時刻（time_scale 分の1秒単位）。time_scale が 0 なら不明
+		int64_t time_scale = 0;
+		int64_t stream_time = 0; // フレームの時刻
+		int64_t stream_duration = 0;
+		int64_t audio_time = 0; // 音声の最初のサンプルの時刻
 		HDRMetadataStruct hdr_metadata = {};
 	};
 	std::shared_ptr<Data> d;
@@ -44,6 +45,15 @@ public:
 	{
 		return d->image.height();
 	}
+	// ボトムフィールドが先でなければトップフィールドが先とみなす
+	bool isTopFieldFirst() const
+	{
+		return d->field_dominance != bmdLowerFieldFirst;
+	}
+	bool isProgressive() const
+	{
+		return d->field_dominance == bmdProgressiveFrame || d->field_dominance == bmdProgressiveSegmentedFrame;
+	}
 };
 
 Q_DECLARE_METATYPE(VideoFrameData)
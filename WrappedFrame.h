@@ -0,0 +1,41 @@
+#ifndef WRAPPEDFRAME_H
+#define WRAPPEDFRAME_H
+
+#include "Image.h"
+#include <atomic>
+
+// 入力装置のフレームのバッファを複製せずに参照する Image を作る
+// Frame は AddRef() と Release() を持つ参照カウント付きのフレーム（IDeckLinkVideoInputFrame など）
+// 装置のフレームプールを枯渇させないよう、同時に参照するフレームは MAX_WRAPPED_FRAMES までにする
+template <typename Frame>
+class WrappedFrame {
+private:
+	static inline std::atomic_int wrapped_frames = 0;
+	static void release(void *cookie)
+	{
+		reinterpret_cast<Frame *>(cookie)->Release();
+		wrapped_frames--;
+	}
+public:
+	static const int MAX_WRAPPED_FRAMES = 16;
+
+	// 上限に達しているときは空の Image を返す。呼び出し側で複製すること
+	static Image wrap(Frame *frame, int w, int h, Image::Format format, int bytes_per_line, uint8_t *data)
+	{
+		// 確かめてから数えると、複数のスレッドから同時に呼ばれたときに上限を超える
+		if (wrapped_frames.fetch_add(1) >= MAX_WRAPPED_FRAMES) {
+			wrapped_frames--;
+			return {};
+		}
+		frame->AddRef();
+		Image image;
+		image.wrap(w, h, format, bytes_per_line, data, release, frame);
+		return image;
+	}
+	static int count()
+	{
+		return wrapped_frames;
+	}
+};
+
+#endif // WRAPPEDFRAME_H
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = asyncfilewritertest
+CONFIG += c++17 console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+	asyncfilewritertest/main.cpp \
+	AsyncFileWriter.cpp
+
+HEADERS += \
+	AsyncFileWriter.h
+
+unix:LIBS += -lpthread
@@ -0,0 +1,90 @@
+// AsyncFileWriter の書き込み位置とファイルの大きさを確かめる
+// 後から先頭のヘッダを書き直す mux の書き方（先頭へ戻って書き、末尾へ戻って続ける）を再現する。失敗があれば終了コード 1
+
+#include "../AsyncFileWriter.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, std::string const &what)
+{
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+std::vector<uint8_t> pattern(size_t size, int seed)
+{
+	std::vector<uint8_t> v(size);
+	for (size_t i = 0; i < size; i++) {
+		v[i] = uint8_t(i * 13 + seed);
+	}
+	return v;
+}
+
+std::vector<uint8_t> read_file(std::string const &path)
+{
+	std::vector<uint8_t> v;
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp) return v;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		v.insert(v.end(), buf, buf + n);
+	}
+	fclose(fp);
+	return v;
+}
+
+// body バイト書いてから先頭の4バイトを書き直し、SEEK_END で末尾に戻って tail バイト書く
+void test_rewrite_header(std::string const &path, size_t block_size, int blocks, size_t body, size_t tail)
+{
+	const std::string name = "block " + std::to_string(block_size) + ", body " + std::to_string(body);
+	AsyncFileWriter::Option opt;
+	opt.block_size = block_size;
+	opt.blocks = blocks;
+	AsyncFileWriter w;
+	if (!w.open(path, opt)) {
+		check(false, name + ": open " + path);
+		return;
+	}
+	std::vector<uint8_t> expected = pattern(body, 1);
+	const std::vector<uint8_t> header = pattern(4, 2);
+	const std::vector<uint8_t> more = pattern(tail, 3);
+	w.write(expected.data(), expected.size());
+	check(w.seek(0, SEEK_SET) == 0, name + ": seek to start");
+	w.write(header.data(), header.size());
+	const int64_t end = w.seek(0, SEEK_END);
+	check(end == (int64_t)body, name + ": SEEK_END returns " + std::to_string(end));
+	check(w.size() == (int64_t)body, name + ": size " + std::to_string(w.size()));
+	w.write(more.data(), more.size());
+	check(w.seek(0, SEEK_CUR) == (int64_t)(body + tail), name + ": position after the tail");
+	check(w.close(), name + ": close");
+
+	std::copy(header.begin(), header.end(), expected.begin());
+	expected.insert(expected.end(), more.begin(), more.end());
+	check(read_file(path) == expected, name + ": file contents");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	const std::string path = argc > 1 ? argv[1] : "asyncfilewritertest.tmp";
+	test_rewrite_header(path, 4 << 20, 4, 1 << 20, 100); // 本体は1つのブロックに収まる
+	test_rewrite_header(path, 1 << 20, 64, 48 << 20, 100); // 本体の大部分が書き込み待ちのまま末尾へ戻る
+	test_rewrite_header(path, 64 << 10, 4, 4, 10); // 本体とヘッダが重なる
+	remove(path.c_str());
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
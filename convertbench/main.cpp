@@ -0,0 +1,166 @@
+// Image::convertToFormat と v210 の展開（DeckLinkCapture::createImage）の並列化の効き方を測る
+// スレッド数を 1/2/4/8 と変えて、1フレームあたりの時間と1スレッドのときに対する速さを出す
+// --callers N のときは N 本のスレッドが同時に変換し（パイプラインの各段と同じ状況）、全体のスレッド数が threadCount() に収まるかを見る
+
+#include "../Image.h"
+#include "../ImageKernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+	std::vector<int> threads = {1, 2, 4, 8};
+	int frames = 30; // 呼び出しスレッドあたりのフレーム数
+	int callers = 1;
+};
+
+struct FrameSize {
+	char const *name;
+	int width;
+	int height;
+};
+
+const FrameSize FRAME_SIZES[] = {
+	{"1080", 1920, 1080},
+	{"2160", 3840, 2160},
+};
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: convertbench [options]\n"
+		"  --threads N,N,...  thread counts to measure (default 1,2,4,8)\n"
+		"  --frames N         frames converted by each caller (default 30)\n"
+		"  --callers N        threads converting at the same time (default 1)\n");
+}
+
+bool parse_options(int argc, char **argv, Options *opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&](){
+			return i + 1 < argc ? argv[++i] : (char const *)"";
+		};
+		if (arg == "--threads") {
+			opts->threads.clear();
+			std::string list = next();
+			for (size_t pos = 0; pos < list.size();) {
+				size_t end = list.find(',', pos);
+				if (end == std::string::npos) end = list.size();
+				const int n = atoi(list.substr(pos, end - pos).c_str());
+				if (n < 1) return false;
+				opts->threads.push_back(n);
+				pos = end + 1;
+			}
+			if (opts->threads.empty()) return false;
+		} else if (arg == "--frames") {
+			opts->frames = std::max(1, atoi(next()));
+		} else if (arg == "--callers") {
+			opts->callers = std::max(1, atoi(next()));
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void fill(Image *image)
+{
+	const int len = image->width() * image->bytesPerPixel();
+	for (int y = 0; y < image->height(); y++) {
+		uint8_t *p = image->scanLine(y);
+		for (int i = 0; i < len; i++) {
+			p[i] = (uint8_t)(i * 7 + y * 13);
+		}
+	}
+}
+
+struct Case {
+	char const *name;
+	std::function<void ()> convert;
+};
+
+// 全呼び出しスレッドが frames 回ずつ変換するのにかかった時間（秒）
+double run(Options const &opts, Case const &c)
+{
+	std::vector<std::thread> callers;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < opts.callers; i++) {
+		callers.emplace_back([&](){
+			for (int n = 0; n < opts.frames; n++) {
+				c.convert();
+			}
+		});
+	}
+	for (std::thread &t : callers) {
+		t.join();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opts;
+	if (!parse_options(argc, argv, &opts)) {
+		usage();
+		return 2;
+	}
+
+	printf("processors %u, frames %d, callers %d\n", std::thread::hardware_concurrency(), opts.frames, opts.callers);
+	printf("%-5s %-16s %8s %10s %8s\n", "size", "conversion", "threads", "ms/frame", "speedup");
+	for (FrameSize const &fs : FRAME_SIZES) {
+		const int w = fs.width;
+		const int h = fs.height;
+		Image uyvy(w, h, Image::Format::UYVY8);
+		Image rgb(w, h, Image::Format::RGB8);
+		Image yuyv16(w, h, Image::Format::YUYV16);
+		fill(&uyvy);
+		fill(&rgb);
+		fill(&yuyv16);
+
+		// v210 は6画素ごとに16バイト。DeckLink の行は128バイト単位
+		const int v210_stride = (w + 47) / 48 * 128;
+		std::vector<uint8_t> v210((size_t)v210_stride * h);
+		for (size_t i = 0; i < v210.size(); i++) {
+			v210[i] = (uint8_t)(i * 5);
+		}
+
+		const Case cases[] = {
+			{"UYVY8->RGB8", [&](){ uyvy.convertToFormat(Image::Format::RGB8); }},
+			{"RGB8->UYVY8", [&](){ rgb.convertToFormat(Image::Format::UYVY8); }},
+			{"YUYV16->YUYV8", [&](){ yuyv16.convertToFormat(Image::Format::YUYV8); }},
+			{"v210->YUYV16", [&](){
+				Image out(w, h, Image::Format::YUYV16);
+				uint8_t *dst = out.bits();
+				const int stride = out.bytesPerLine();
+				auto func = ImageKernels::table()->v210_to_yuyv16;
+				ImageKernels::parallelRows(h, w * 4 + v210_stride, [&](int y0, int y1){
+					for (int y = y0; y < y1; y++) {
+						func(v210.data() + (size_t)v210_stride * y, dst + (size_t)stride * y, w);
+					}
+				});
+			}},
+		};
+		for (Case const &c : cases) {
+			double base = 0;
+			for (int threads : opts.threads) {
+				ImageKernels::setThreadCount(threads);
+				c.convert(); // 暖機
+				const double ms = run(opts, c) * 1000 / ((double)opts.frames * opts.callers);
+				if (base == 0) base = ms;
+				printf("%-5s %-16s %8d %10.3f %7.2fx\n", fs.name, c.name, threads, ms, base / ms);
+			}
+		}
+	}
+	return 0;
+}
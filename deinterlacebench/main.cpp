@@ -0,0 +1,255 @@
+// Deinterlace を複数のスレッドから呼んだときの速さを測る
+// FrameProcessThread の前段と同じく、各スレッドが次のフレームを取り出して reserve してから deinterlace を呼ぶ
+// スレッド数ごとに1フレームあたりの時間と画素あたりの時間、1スレッドのときに対する速さを出す
+// Linux では perf_event_open で最終段のキャッシュ (LLC) のミスも数える。使えなければ（権限がない、仮想マシンなど）その列は "-" になる
+
+#include "../Deinterlace.h"
+#include "../ImageKernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+struct Options {
+	std::vector<int> workers = {1, 2, 4};
+	int frames = 60;
+	int kernel_threads = 1; // ImageKernels::setThreadCount に渡す。0 ならプロセッサ数
+	int width = 1920;
+	int height = 1080;
+	bool counters = true;
+};
+
+struct FormatCase {
+	char const *name;
+	Image::Format format;
+};
+
+const FormatCase FORMATS[] = {
+	{"UYVY8", Image::Format::UYVY8},
+	{"YUYV16", Image::Format::YUYV16},
+	{"RGB8", Image::Format::RGB8},
+};
+
+// 入力として繰り返し使うフレームの数
+const int PATTERN_FRAMES = 8;
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: deinterlacebench [options]\n"
+		"  --workers N,N,...   calling threads to measure (default 1,2,4)\n"
+		"  --frames N          frames per measurement (default 60)\n"
+		"  --kernel-threads N  OpenMP threads per call, 0 for all processors (default 1)\n"
+		"  --size WxH          frame size (default 1920x1080)\n"
+		"  --no-counters       do not read the hardware cache miss counter\n");
+}
+
+bool parse_list(std::string const &list, std::vector<int> *out)
+{
+	out->clear();
+	for (size_t pos = 0; pos < list.size();) {
+		size_t end = list.find(',', pos);
+		if (end == std::string::npos) end = list.size();
+		const int n = atoi(list.substr(pos, end - pos).c_str());
+		if (n < 1) return false;
+		out->push_back(n);
+		pos = end + 1;
+	}
+	return !out->empty();
+}
+
+bool parse_options(int argc, char **argv, Options *opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&](){
+			return i + 1 < argc ? argv[++i] : (char const *)"";
+		};
+		if (arg == "--workers") {
+			if (!parse_list(next(), &opts->workers)) return false;
+		} else if (arg == "--frames") {
+			opts->frames = std::max(1, atoi(next()));
+		} else if (arg == "--kernel-threads") {
+			opts->kernel_threads = std::max(0, atoi(next()));
+		} else if (arg == "--size") {
+			if (sscanf(next(), "%dx%d", &opts->width, &opts->height) != 2 || opts->width < 2 || opts->height < 2) return false;
+			opts->width &= ~1;
+		} else if (arg == "--no-counters") {
+			opts->counters = false;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// このプロセスと、開いた後に作られたスレッドの LLC ミスの数
+class CacheMissCounter {
+private:
+	int fd_ = -1;
+public:
+	CacheMissCounter() = default;
+	CacheMissCounter(CacheMissCounter const &) = delete;
+	void operator = (CacheMissCounter const &) = delete;
+	~CacheMissCounter()
+	{
+#ifdef __linux__
+		if (fd_ >= 0) {
+			close(fd_);
+		}
+#endif
+	}
+	// スレッドを作る前に開くこと
+	bool open()
+	{
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd_ < 0) {
+			fprintf(stderr, "perf_event_open failed (%s), cache misses are not counted\n", strerror(errno));
+			return false;
+		}
+		ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+		return true;
+#else
+		fprintf(stderr, "cache miss counter is only available on Linux\n");
+		return false;
+#endif
+	}
+	bool isOpen() const
+	{
+		return fd_ >= 0;
+	}
+	uint64_t value() const
+	{
+		uint64_t v = 0;
+#ifdef __linux__
+		if (fd_ >= 0 && read(fd_, &v, sizeof(v)) != sizeof(v)) {
+			v = 0;
+		}
+#endif
+		return v;
+	}
+};
+
+// 横に流れる模様。偶数行は時刻 t * 2、奇数行は t * 2 + 1 のフィールド
+Image make_frame(Image::Format format, int w, int h, int t)
+{
+	Image image(w, h, format);
+	for (int y = 0; y < h; y++) {
+		const int ft = t * 2 + (y & 1);
+		uint8_t *p = image.scanLine(y);
+		for (int x = 0; x < w; x++) {
+			const uint8_t v = 64 + ((x + ft * 6) & 127) - ((y * 3) & 31);
+			switch (format) {
+			case Image::Format::UYVY8:
+				p[2 * x] = 128;
+				p[2 * x + 1] = v;
+				break;
+			case Image::Format::YUYV16:
+				((uint16_t *)p)[2 * x] = v << 8;
+				((uint16_t *)p)[2 * x + 1] = 128 << 8;
+				break;
+			default:
+				p[3 * x + 0] = v;
+				p[3 * x + 1] = 255 - v;
+				p[3 * x + 2] = v / 2;
+				break;
+			}
+		}
+	}
+	return image;
+}
+
+// workers 本のスレッドで frames 枚を処理するのにかかった時間（秒）
+double run(Options const &opts, std::vector<Image> const &input, int workers)
+{
+	Deinterlace d;
+	std::mutex mutex;
+	int next = 0;
+	std::vector<std::thread> threads;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < workers; i++) {
+		threads.emplace_back([&](){
+			while (1) {
+				int n;
+				{
+					std::lock_guard lock(mutex);
+					if (next == opts.frames) break;
+					n = next++;
+					d.reserve(n);
+				}
+				d.deinterlace(input[n % input.size()], n);
+			}
+		});
+	}
+	for (std::thread &t : threads) {
+		t.join();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opts;
+	if (!parse_options(argc, argv, &opts)) {
+		usage();
+		return 2;
+	}
+	ImageKernels::setThreadCount(opts.kernel_threads);
+
+	CacheMissCounter llc;
+	if (opts.counters) {
+		llc.open();
+	}
+
+	const double pixels = (double)opts.width * opts.height * opts.frames;
+	printf("%dx%d, frames %d, processors %u, kernel threads %d\n", opts.width, opts.height, opts.frames, std::thread::hardware_concurrency(), ImageKernels::threadCount());
+	printf("%-7s %8s %10s %8s %8s %9s %14s\n", "format", "workers", "ms/frame", "fps", "ns/pixel", "speedup", "LLC miss/frame");
+	for (FormatCase const &fc : FORMATS) {
+		std::vector<Image> input;
+		for (int t = 0; t < PATTERN_FRAMES; t++) {
+			input.push_back(make_frame(fc.format, opts.width, opts.height, t));
+		}
+		run(opts, input, 1); // 暖機
+		double base = 0;
+		for (int workers : opts.workers) {
+			const uint64_t misses = llc.value();
+			const double sec = run(opts, input, workers);
+			const double ms = sec * 1000 / opts.frames;
+			if (base == 0) base = ms;
+			printf("%-7s %8d %10.3f %8.1f %8.3f %8.2fx ", fc.name, workers, ms, 1000 / ms, sec * 1e9 / pixels, base / ms);
+			if (llc.isOpen()) {
+				printf("%14.0f\n", (double)(llc.value() - misses) / opts.frames);
+			} else {
+				printf("%14s\n", "-");
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+QT += core
+TEMPLATE = app
+TARGET = deinterlacetest
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+linux:QMAKE_CXXFLAGS += -fopenmp
+linux:QMAKE_LFLAGS += -fopenmp
+gcc:QMAKE_CXXFLAGS += -Wno-switch
+
+SOURCES += \
+	deinterlacetest/main.cpp \
+	Deinterlace.cpp \
+	FramePool.cpp \
+	Image.cpp \
+	ImageKernels.cpp
+
+HEADERS += \
+	Deinterlace.h \
+	FramePool.h \
+	Image.h \
+	ImageKernels.h
@@ -0,0 +1,391 @@
+// 合成した静止画、動く画像、テレシネの入力で Deinterlace の出力を確かめる
+// 理想の画像がわかる入力を使い、そのまま返すべきフレームは完全に一致すること、
+// 補間したフレームは縞がなく理想の画像に近いことを調べる。失敗があれば終了コード 1
+
+#include "../Deinterlace.h"
+#include "../ImageKernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const int W = 320;
+const int H = 240;
+
+// 動く模様の輝度。t はフィールド単位の時刻
+typedef std::function<double (int x, int y, double t)> Pattern;
+
+double wave(int x, int y, double t)
+{
+	return 128 + 90 * sin((x - 6 * t) * 0.07) * cos(y * 0.05 + t * 0.1);
+}
+
+// 細かい横縞。静止していれば縞とはみなさずにそのまま返すこと
+double stripes(int x, int y, double)
+{
+	return (y & 1) ? 200 : 40 + (x & 15);
+}
+
+char const *level_name(ImageKernels::Level level)
+{
+	switch (level) {
+	case ImageKernels::Level::Scalar: return "Scalar";
+	case ImageKernels::Level::SSSE3: return "SSSE3";
+	case ImageKernels::Level::AVX2: return "AVX2";
+	case ImageKernels::Level::NEON: return "NEON";
+	}
+	return "?";
+}
+
+int failures = 0;
+
+void check(bool ok, std::string const &what)
+{
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+// 輝度の読み書き（8ビット換算）。色差は中央の値にする
+void set_luma(Image *image, int x, int y, double v)
+{
+	v = std::min(std::max(v, 0.0), 255.0);
+	if (image->format() == Image::Format::YUYV16) {
+		uint16_t *p = (uint16_t *)image->scanLine(y);
+		p[2 * x] = uint16_t(lround(v * 4)) << 6;
+		p[2 * x + 1] = 512 << 6;
+	} else {
+		uint8_t *p = image->scanLine(y);
+		p[2 * x] = 128;
+		p[2 * x + 1] = uint8_t(lround(v));
+	}
+}
+
+double luma(Image const &image, int x, int y)
+{
+	if (image.format() == Image::Format::YUYV16) {
+		return ((uint16_t const *)image.scanLine(y))[2 * x] / 256.0;
+	}
+	return image.scanLine(y)[2 * x + 1];
+}
+
+struct Rect {
+	int x0, y0, x1, y1;
+};
+
+// 偶数行（トップフィールド）は時刻 t0、奇数行は t1 の画像
+Image make_frame(Pattern const &pattern, double t0, double t1, Image::Format format = Image::Format::UYVY8, int w = W, int h = H)
+{
+	Image image(w, h, format);
+	for (int y = 0; y < h; y++) {
+		const double t = (y & 1) ? t1 : t0;
+		for (int x = 0; x < w; x++) {
+			set_luma(&image, x, y, pattern(x, y, t));
+		}
+	}
+	return image;
+}
+
+bool same(Image const &a, Image const &b)
+{
+	if (a.width() != b.width() || a.height() != b.height() || a.format() != b.format()) return false;
+	const int len = a.width() * a.bytesPerPixel();
+	for (int y = 0; y < a.height(); y++) {
+		if (memcmp(a.scanLine(y), b.scanLine(y), len) != 0) return false;
+	}
+	return true;
+}
+
+// y0 から y1 までの行のうち、field の行が同じか
+bool same_rows(Image const &a, Image const &b, int y0, int y1, int field)
+{
+	const int len = a.width() * a.bytesPerPixel();
+	for (int y = y0; y < y1; y++) {
+		if (field >= 0 && (y & 1) != field) continue;
+		if (memcmp(a.scanLine(y), b.scanLine(y), len) != 0) return false;
+	}
+	return true;
+}
+
+bool same_field(Image const &a, Image const &b, int field)
+{
+	return same_rows(a, b, 0, a.height(), field);
+}
+
+// r のうち field でない行の、理想の画像（時刻 t の模様）との差の絶対値の平均
+double interpolation_error(Image const &image, Pattern const &pattern, double t, int field, Rect const &r = {2, 2, W - 2, H - 2})
+{
+	double sum = 0;
+	int n = 0;
+	for (int y = r.y0; y < r.y1; y++) {
+		if ((y & 1) == field) continue;
+		for (int x = r.x0; x < r.x1; x++) {
+			sum += fabs(luma(image, x, y) - std::min(std::max(pattern(x, y, t), 0.0), 255.0));
+			n++;
+		}
+	}
+	return sum / n;
+}
+
+// r のうち、上下の行の両方より明るいか暗い画素の割合（縞の量）
+double comb_ratio(Image const &image, Rect const &r = {0, 1, W, H - 1})
+{
+	int combed = 0;
+	int n = 0;
+	for (int y = r.y0; y < r.y1; y++) {
+		for (int x = r.x0; x < r.x1; x++) {
+			const double a = luma(image, x, y - 1);
+			const double b = luma(image, x, y);
+			const double c = luma(image, x, y + 1);
+			if ((a - b) * (c - b) > 12 * 12) combed++;
+			n++;
+		}
+	}
+	return (double)combed / n;
+}
+
+// 静止している画像は細かい横縞があってもそのまま返す。最初のフレームは比べる相手がないので補間される
+void test_static()
+{
+	Deinterlace d;
+	const Image input = make_frame(stripes, 0, 0);
+	int passed = 0;
+	for (int n = 0; n < 6; n++) {
+		Image out = d.deinterlace(input);
+		if (n >= 1 && same(out, input)) passed++;
+	}
+	check(passed == 5, "static: output equals input (" + std::to_string(passed) + "/5)");
+}
+
+// フィールドの時刻が同じ（プログレッシブ）なら動いていてもそのまま返す。出力は1フレーム遅れる
+void test_progressive()
+{
+	Deinterlace d;
+	std::vector<Image> in;
+	int passed = 0;
+	for (int n = 0; n < 10; n++) {
+		in.push_back(make_frame(wave, n * 2, n * 2));
+		Image out = d.deinterlace(in.back());
+		if (n >= 2 && same(out, in[n - 1])) passed++;
+	}
+	check(passed == 8, "progressive: moving frames pass through (" + std::to_string(passed) + "/8)");
+}
+
+// インタレースの動く画像は残すフィールドをそのまま使い、もう一方のフィールドを同じ時刻の画像に近く補間する
+void test_interlaced(Image::Format format, char const *name)
+{
+	Deinterlace d;
+	double max_error = 0;
+	double max_comb = 0;
+	bool kept = true;
+	std::vector<Image> in;
+	for (int n = 0; n < 10; n++) {
+		in.push_back(make_frame(wave, n * 2, n * 2 + 1, format));
+		Image out = d.deinterlace(in.back());
+		if (n < 2) continue;
+		kept = kept && same_field(out, in[n - 1], 0);
+		max_error = std::max(max_error, interpolation_error(out, wave, (n - 1) * 2, 0));
+		max_comb = std::max(max_comb, comb_ratio(out));
+	}
+	const double input_error = interpolation_error(in[5], wave, 10, 0);
+	const double input_comb = comb_ratio(in[5]);
+	check(kept, std::string(name) + ": kept field is unchanged");
+	check(max_error < 1.5 && max_error < input_error / 10, std::string(name) + ": interpolation error " + std::to_string(max_error) + " (input " + std::to_string(input_error) + ")");
+	check(max_comb < 0.001 && input_comb > 0.1, std::string(name) + ": combing " + std::to_string(max_comb) + " (input " + std::to_string(input_comb) + ")");
+}
+
+// 静止した背景の中の小さな範囲だけがインタレースで動く（テロップなど）。画面に比べて縞のあるブロックが少なくても補間する
+void test_small_region()
+{
+	const int w = 1920;
+	const int h = 1080;
+	const Rect region = {800, 496, 848, 528}; // 6 x 4 ブロック
+	auto pattern = [&](int x, int y, double t){
+		if (x >= region.x0 && x < region.x1 && y >= region.y0 && y < region.y1) {
+			return 128 + 100 * sin((x - 6 * t) * 0.25); // 横に流れる縦縞
+		}
+		return wave(x, y, 0);
+	};
+	Deinterlace d;
+	double max_comb = 0;
+	double max_error = 0;
+	bool kept = true;
+	bool still = true;
+	std::vector<Image> in;
+	for (int n = 0; n < 6; n++) {
+		in.push_back(make_frame(pattern, n * 2, n * 2 + 1, Image::Format::UYVY8, w, h));
+		Image out = d.deinterlace(in.back());
+		if (n < 2) continue;
+		kept = kept && same_field(out, in[n - 1], 0);
+		// 動いている範囲から離れた行は入力のまま
+		still = still && same_rows(out, in[n - 1], 0, region.y0 - 3 * 8, -1) && same_rows(out, in[n - 1], region.y1 + 3 * 8, h, -1);
+		max_comb = std::max(max_comb, comb_ratio(out, region));
+		max_error = std::max(max_error, interpolation_error(out, pattern, (n - 1) * 2, 0, {region.x0, region.y0 + 2, region.x1, region.y1 - 2}));
+	}
+	const double input_comb = comb_ratio(in[3], region);
+	check(kept, "small region: kept field is unchanged");
+	check(still, "small region: static rows are unchanged");
+	check(max_comb < 0.01 && input_comb > 0.3, "small region: combing " + std::to_string(max_comb) + " (input " + std::to_string(input_comb) + ")");
+	check(max_error < 3.0, "small region: interpolation error " + std::to_string(max_error));
+}
+
+// フィールドごとの出力は時間の順に並び、それぞれのフィールドの時刻に近い
+void test_fields(bool tff)
+{
+	Deinterlace d;
+	const std::string name = tff ? "fields (tff)" : "fields (bff)";
+	const int first = tff ? 0 : 1;
+	double max_error = 0;
+	bool kept = true;
+	bool count = true;
+	std::vector<Image> in;
+	for (int n = 0; n < 10; n++) {
+		// 先のフィールドが時刻 n * 2、後のフィールドが n * 2 + 1
+		const double t0 = tff ? n * 2 : n * 2 + 1;
+		const double t1 = tff ? n * 2 + 1 : n * 2;
+		in.push_back(make_frame(wave, t0, t1));
+		std::vector<Image> out = d.deinterlaceFields(in.back(), tff);
+		if (out.size() != 2) {
+			count = false;
+			continue;
+		}
+		if (n < 2) continue;
+		kept = kept && same_field(out[0], in[n - 1], first) && same_field(out[1], in[n - 1], 1 - first);
+		max_error = std::max(max_error, interpolation_error(out[0], wave, (n - 1) * 2, first));
+		max_error = std::max(max_error, interpolation_error(out[1], wave, (n - 1) * 2 + 1, 1 - first));
+	}
+	check(count, name + ": two images per frame");
+	check(kept, name + ": each output keeps its field unchanged");
+	check(max_error < 1.5, name + ": interpolation error " + std::to_string(max_error));
+}
+
+// 3:2 プルダウン (TFF)。フィルムのフレーム F0, F1, ... を AA BB BC CD DD の順にフィールドへ振り分けたものから、元のフレームを取り出す
+void test_telecine()
+{
+	std::vector<Image> film;
+	for (int k = 0; k < 20; k++) {
+		film.push_back(make_frame(wave, k * 2.5, k * 2.5));
+	}
+	const int top[] = {0, 1, 1, 2, 3};
+	const int bottom[] = {0, 1, 2, 3, 3};
+	auto film_frame = [&](int n, int const *field){
+		return n / 5 * 4 + field[n % 5];
+	};
+	Deinterlace d;
+	int matched = 0;
+	for (int n = 0; n < 20; n++) {
+		Image input(W, H, Image::Format::UYVY8);
+		const int kt = film_frame(n, top);
+		const int kb = film_frame(n, bottom);
+		for (int y = 0; y < H; y++) {
+			memcpy(input.scanLine(y), std::as_const(film[(y & 1) ? kb : kt]).scanLine(y), W * 2);
+		}
+		Image out = d.deinterlace(input);
+		if (n >= 2 && same(out, film[film_frame(n - 1, top)])) matched++;
+	}
+	check(matched == 18, "telecine: film frames recovered (" + std::to_string(matched) + "/18)");
+}
+
+// FrameProcessThread と同じく、各スレッドが次の番号を取り出して reserve し、それから deinterlace を呼ぶ
+// 取り出した後に待たせるフレームを作って、deinterlace が番号の順でなく呼ばれるようにする
+// 出力は1つのスレッドで順に処理したときと一致すること
+void test_concurrent(int threads)
+{
+	const int N = 24;
+	std::vector<Image> in;
+	for (int n = 0; n < N; n++) {
+		if (n < 10) {
+			in.push_back(make_frame(wave, n * 2, n * 2 + 1)); // インタレース
+		} else if (n < 17) {
+			in.push_back(make_frame(wave, n * 2, n * 2)); // プログレッシブ
+		} else {
+			in.push_back(make_frame(stripes, 0, 0)); // 静止
+		}
+	}
+
+	std::vector<Image> expected;
+	{
+		Deinterlace d;
+		for (int n = 0; n < N; n++) {
+			expected.push_back(d.deinterlace(in[n], n));
+		}
+	}
+
+	Deinterlace d;
+	std::mutex mutex;
+	int next = 0;
+	std::vector<int> calls; // deinterlace を呼んだ順
+	std::vector<Image> out(N);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back([&](){
+			while (1) {
+				int n;
+				{
+					std::lock_guard lock(mutex);
+					if (next == N) break;
+					n = next++;
+					d.reserve(n);
+				}
+				if (n % 3 == 0) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				}
+				{
+					std::lock_guard lock(mutex);
+					calls.push_back(n);
+				}
+				out[n] = d.deinterlace(in[n], n);
+			}
+		});
+	}
+	for (std::thread &t : workers) {
+		t.join();
+	}
+
+	int matched = 0;
+	for (int n = 0; n < N; n++) {
+		if (same(out[n], expected[n])) matched++;
+	}
+	const std::string name = "concurrent (" + std::to_string(threads) + " threads)";
+	check(!std::is_sorted(calls.begin(), calls.end()), name + ": calls were made out of order");
+	check(matched == N, name + ": output equals sequential (" + std::to_string(matched) + "/" + std::to_string(N) + ")");
+}
+
+} // namespace
+
+int main()
+{
+	// 8ビットの補間は命令セットごとに別の実装を使うので、すべてで確かめる
+	for (ImageKernels::Level level : {ImageKernels::Level::Scalar, ImageKernels::Level::SSSE3, ImageKernels::Level::AVX2, ImageKernels::Level::NEON}) {
+		if (!ImageKernels::isSupported(level)) continue;
+		ImageKernels::setLevel(level);
+		const int before = failures;
+		test_static();
+		test_progressive();
+		test_interlaced(Image::Format::UYVY8, "interlaced 8-bit");
+		test_interlaced(Image::Format::YUYV16, "interlaced 10-bit");
+		test_small_region();
+		test_fields(true);
+		test_fields(false);
+		test_telecine();
+		for (int threads : {2, 3, 4}) {
+			test_concurrent(threads);
+		}
+		printf("%-6s %s\n", level_name(level), failures == before ? "ok" : "FAILED");
+	}
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
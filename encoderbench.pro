@@ -0,0 +1,39 @@
+QT += core gui
+TEMPLATE = app
+TARGET = encoderbench
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DESTDIR = $$PWD/_bin
+
+DEFINES += USE_FFMPEG
+INCLUDEPATH += $$PWD
+
+linux:QMAKE_CXXFLAGS += -fopenmp
+linux:QMAKE_LFLAGS += -fopenmp
+gcc:QMAKE_CXXFLAGS += -Wno-switch
+
+win32:INCLUDEPATH += C:/ffmpeg/include
+win32:LIBS += -LC:/ffmpeg/bin
+macx:INCLUDEPATH += /usr/local/Cellar/ffmpeg/4.1.4_1/include
+macx:LIBS += -L/usr/local/Cellar/ffmpeg/4.1.4_1/lib
+LIBS += -lavutil -lavcodec -lavformat -lswscale -lswresample
+
+SOURCES += \
+	encoderbench/main.cpp \
+	AsyncFileWriter.cpp \
+	Deinterlace.cpp \
+	FFmpegVideoEncoder.cpp \
+	FramePool.cpp \
+	Image.cpp \
+	ImageKernels.cpp
+
+HEADERS += \
+	AsyncFileWriter.h \
+	Deinterlace.h \
+	FFmpegVideoEncoder.h \
+	FramePool.h \
+	Image.h \
+	ImageKernels.h \
+	VideoEncoderOption.h \
+	VideoFrameData.h
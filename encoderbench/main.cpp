@@ -0,0 +1,489 @@
+// キャプチャ装置と GUI なしで FFmpegVideoEncoder の処理速度を測る
+// 動くテストパターンと正弦波の音声を作って put_frame に渡し、毎秒の状態と最後に集計を表示する
+// --output がファイルのときは書き出したものを demux し、--drop で捨てた位置だけ映像の時刻が空いていることと、
+// 音声と映像の終わりが1フレーム以内で揃っていることを確かめる。揃っていなければ終了コード 1
+
+#include "../FFmpegVideoEncoder.h"
+#include "../VideoFrameData.h"
+#include "../includeffmpeg.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace VideoEncoderOption;
+
+namespace {
+
+struct Options {
+	int width = 1920;
+	int height = 1080;
+	Rational fps = {60, 1};
+	int bit_depth = 8;
+	int seconds = 10;
+	bool field_rate = false;
+	bool flat_out = false; // 実時間に合わせず、符号化が追いつく限り速く投入する（policy は Block になる）
+	OverflowPolicy policy = OverflowPolicy::DropOldest;
+	size_t queue_mb = 0; // 0 なら VideoOption の既定値
+	bool direct_io = false;
+	int64_t prealloc_mb = 0;
+	bool audio = true;
+	int drop = 0; // この数ごとに1フレームを（音声とともに）投入せずに捨てる
+	double min_fps = 0; // これを下回ったら終了コード 1
+	std::string output = "/dev/null";
+	std::vector<Format> formats;
+};
+
+struct FormatName {
+	Format format;
+	char const *name;
+};
+
+const FormatName FORMAT_NAMES[] = {
+	{Format::MPEG4, "mpeg4"},
+	{Format::H264_NVENC, "h264_nvenc"},
+	{Format::HEVC_NVENC, "hevc_nvenc"},
+	{Format::LIBSVTAV1, "libsvtav1"},
+	{Format::RAWVIDEO, "rawvideo"},
+	{Format::FFV1, "ffv1"},
+	{Format::UTVIDEO, "utvideo"},
+};
+
+char const *format_name(Format f)
+{
+	for (FormatName const &t : FORMAT_NAMES) {
+		if (t.format == f) return t.name;
+	}
+	return "?";
+}
+
+struct PolicyName {
+	OverflowPolicy policy;
+	char const *name;
+};
+
+const PolicyName POLICY_NAMES[] = {
+	{OverflowPolicy::Block, "block"},
+	{OverflowPolicy::DropOldest, "drop-oldest"},
+	{OverflowPolicy::DropNewest, "drop-newest"},
+	{OverflowPolicy::Degrade, "degrade"},
+};
+
+double megabytes(size_t bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
+
+// パターンを作る時間を測らないように、あらかじめ1周期分のフレームを作っておく
+const int PATTERN_FRAMES = 30;
+
+// 横に流れる縦縞と、斜めに動く箱
+Image make_pattern(int w, int h, int bit_depth, int n)
+{
+	Image image(w, h, bit_depth > 8 ? Image::Format::YUYV16 : Image::Format::UYVY8);
+	const int bx = (w - w / 4) * n / PATTERN_FRAMES;
+	const int by = (h - h / 4) * n / PATTERN_FRAMES;
+	for (int y = 0; y < h; y++) {
+		const bool row_in_box = y >= by && y < by + h / 4;
+		if (bit_depth > 8) {
+			uint16_t *d = (uint16_t *)image.scanLine(y);
+			for (int x = 0; x < w; x++) {
+				const bool box = row_in_box && x >= bx && x < bx + w / 4;
+				int luma = box ? 940 : 64 + ((x + n * 16) % 256) * 876 / 256;
+				int chroma = box ? ((x & 1) ? 240 : 800) : 512;
+				d[2 * x + 0] = luma << 6;
+				d[2 * x + 1] = chroma << 6;
+			}
+		} else {
+			uint8_t *d = image.scanLine(y);
+			for (int x = 0; x < w; x++) {
+				const bool box = row_in_box && x >= bx && x < bx + w / 4;
+				int luma = box ? 235 : 16 + ((x + n * 16) % 256) * 219 / 256;
+				int chroma = box ? ((x & 1) ? 60 : 200) : 128;
+				d[2 * x + 0] = chroma;
+				d[2 * x + 1] = luma;
+			}
+		}
+	}
+	return image;
+}
+
+// 1kHz の正弦波（16ビット、ステレオ）
+QByteArray make_tone(int sample_rate, int64_t first, int count)
+{
+	QByteArray audio(count * 2 * (int)sizeof(int16_t), 0);
+	int16_t *p = (int16_t *)audio.data();
+	for (int i = 0; i < count; i++) {
+		int16_t v = (int16_t)(8000 * sin(2 * M_PI * 1000 * (first + i) / sample_rate));
+		p[2 * i + 0] = v;
+		p[2 * i + 1] = v;
+	}
+	return audio;
+}
+
+struct Result {
+	bool available = false;
+	uint64_t pushed = 0;
+	uint64_t skipped = 0;
+	std::vector<uint64_t> skipped_frames; // 投入せずに捨てたフレームの番号
+	FFmpegVideoEncoder::Stats stats;
+	double seconds = 0;
+	double fps = 0;
+};
+
+Result run(Options const &opt, Format format, std::vector<Image> const &patterns)
+{
+	Result r;
+
+	VideoOption vopt;
+	vopt.active = true;
+	vopt.src_w = opt.width;
+	vopt.src_h = opt.height;
+	vopt.dst_w = opt.width;
+	vopt.dst_h = opt.height;
+	vopt.bit_depth = opt.bit_depth;
+	vopt.fps = opt.fps;
+	vopt.field_rate = opt.field_rate;
+	vopt.overflow_policy = opt.flat_out ? OverflowPolicy::Block : opt.policy;
+	if (opt.queue_mb > 0) {
+		vopt.queue_bytes = opt.queue_mb * 1024 * 1024;
+	}
+
+	AudioOption aopt;
+	aopt.active = opt.audio;
+
+	OutputOption oopt;
+	oopt.direct_io = opt.direct_io;
+	oopt.preallocate = opt.prealloc_mb * 1024 * 1024;
+
+	auto encoder = std::make_unique<FFmpegVideoEncoder>();
+	if (!encoder->create(opt.output, format, vopt, aopt, oopt)) {
+		return r;
+	}
+	r.available = true;
+
+	// 記録スレッドが動き出すまで待つ
+	while (!encoder->is_recording()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	const double interval = (double)opt.fps.den / opt.fps.num;
+	const uint64_t total = (uint64_t)(opt.seconds * opt.fps.num / opt.fps.den);
+	const auto start = std::chrono::steady_clock::now();
+	auto elapsed = [&](){
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	int64_t samples = 0;
+	double last_report = 0;
+	uint64_t last_frames = 0;
+	for (uint64_t n = 0; n < total; n++) {
+		// flat out のときは待ち行列が一杯になると put_frame が待つ
+		if (!opt.flat_out) {
+			const double t = n * interval - elapsed();
+			if (t > 0) {
+				std::this_thread::sleep_for(std::chrono::duration<double>(t));
+			}
+		}
+
+		// 入力装置と同じように、フレームごとに時刻を付ける（fps.num 分の1秒単位）
+		VideoFrameData frame;
+		frame.d->signal_valid = true;
+		frame.d->image = patterns[n % patterns.size()];
+		frame.d->field_dominance = opt.field_rate ? bmdUpperFieldFirst : bmdProgressiveFrame;
+		frame.d->time_scale = opt.fps.num;
+		frame.d->stream_time = n * opt.fps.den;
+		frame.d->stream_duration = opt.fps.den;
+		frame.d->audio_time = frame.d->stream_time;
+		const int64_t end = (int64_t)((n + 1) * 48000 * opt.fps.den / opt.fps.num);
+		if (opt.audio) {
+			frame.d->audio = make_tone(48000, samples, end - samples);
+		}
+		samples = end;
+		// 取りこぼしを模す。出力では捨てたフレームの分だけ映像の時刻が空き、音声はその間が無音になる
+		if (opt.drop > 0 && n % opt.drop == (uint64_t)(opt.drop - 1)) {
+			r.skipped++;
+			r.skipped_frames.push_back(n);
+		} else {
+			encoder->put_frame(frame);
+			r.pushed++;
+		}
+
+		const double t = elapsed();
+		if (t - last_report >= 1) {
+			FFmpegVideoEncoder::Stats s = encoder->stats();
+			printf("  %5.1fs  %6.1f fps  queue %3zu %7.1f MB (converted %zu, audio %3zu, packets %3zu)  dropped %llu  degraded %llu  latency %.1f ms\n", t, (s.video_frames - last_frames) / (t - last_report), s.video_queue, megabytes(s.queued_bytes), s.converted_queue, s.audio_queue, s.packet_queue, (unsigned long long)s.dropped_video_frames, (unsigned long long)s.degraded_video_frames, s.latency_ms);
+			last_frames = s.video_frames;
+			last_report = t;
+		}
+	}
+
+	// 投入したフレームを符号化し終えるまで待つ（止まってしまったときのために上限を設ける）
+	const double deadline = elapsed() + 30;
+	while (elapsed() < deadline) {
+		FFmpegVideoEncoder::Stats s = encoder->stats();
+		if (s.video_queue == 0 && s.converted_queue == 0) break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	r.seconds = elapsed();
+	encoder->close();
+	r.stats = encoder->stats(); // 閉じるときに書き込んだ分も含める
+
+	r.fps = r.seconds > 0 ? r.stats.video_frames / r.seconds : 0;
+	return r;
+}
+
+// 書き出したファイルの1つのストリームのパケットの時刻
+struct StreamTimes {
+	AVRational time_base = {0, 1};
+	std::vector<int64_t> pts;
+	int64_t end = 0; // 最後に終わるパケットの終わり
+	int64_t max_duration = 0;
+};
+
+// 出力を demux して、映像の時刻の抜けが --drop の位置と一致すること、音声と映像の終わりが1フレーム以内で揃っていることを確かめる
+bool check_output(Options const &opt, Result const &r)
+{
+	// 映像の1パケットの長さ。フィールドごとのときは1フレームから2つ作られる
+	const int fields = opt.field_rate ? 2 : 1;
+	const AVRational unit = {(int)opt.fps.den, (int)opt.fps.num * fields};
+
+	AVFormatContext *fc = nullptr;
+	if (avformat_open_input(&fc, opt.output.c_str(), nullptr, nullptr) < 0) {
+		printf("  check: could not open %s\n", opt.output.c_str());
+		return false;
+	}
+	if (avformat_find_stream_info(fc, nullptr) < 0) {
+		printf("  check: could not read the streams of %s\n", opt.output.c_str());
+		avformat_close_input(&fc);
+		return false;
+	}
+	const int video_index = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	const int audio_index = av_find_best_stream(fc, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+	StreamTimes video;
+	StreamTimes audio;
+	if (video_index >= 0) video.time_base = fc->streams[video_index]->time_base;
+	if (audio_index >= 0) audio.time_base = fc->streams[audio_index]->time_base;
+	AVPacket *pkt = av_packet_alloc();
+	while (av_read_frame(fc, pkt) >= 0) {
+		StreamTimes *t = pkt->stream_index == video_index ? &video : pkt->stream_index == audio_index ? &audio : nullptr;
+		if (t && pkt->pts != AV_NOPTS_VALUE) {
+			int64_t duration = pkt->duration;
+			if (duration <= 0 && t == &video) {
+				duration = av_rescale_q(1, unit, video.time_base);
+			}
+			t->pts.push_back(pkt->pts);
+			t->end = std::max(t->end, pkt->pts + duration);
+			t->max_duration = std::max(t->max_duration, duration);
+		}
+		av_packet_unref(pkt);
+	}
+	av_packet_free(&pkt);
+	avformat_close_input(&fc);
+
+	if (video.pts.empty()) {
+		printf("  check: no video packets in %s\n", opt.output.c_str());
+		return false;
+	}
+	bool ok = true;
+
+	// 映像の各パケットが入力のどのフレームから作られたか
+	std::sort(video.pts.begin(), video.pts.end());
+	std::map<int64_t, int> outputs; // 入力のフレームの番号と、そこから作られたパケットの数
+	for (int64_t pts : video.pts) {
+		const int64_t i = av_rescale_q_rnd(pts - video.pts.front(), video.time_base, unit, AV_ROUND_NEAR_INF);
+		outputs[i / fields]++;
+	}
+	// 最後に出力されたフレームまでで確かめる。それより後は終わりの時刻で確かめる
+	const int64_t last = outputs.rbegin()->first;
+	const std::set<uint64_t> skipped(r.skipped_frames.begin(), r.skipped_frames.end());
+	uint64_t missing = 0; // 捨てていないのに出力にないフレーム
+	for (int64_t i = 0; i <= last; i++) {
+		auto it = outputs.find(i);
+		if (skipped.count(i) > 0) {
+			if (it != outputs.end()) {
+				printf("  check: frame %lld was skipped but has a timestamp in the output\n", (long long)i);
+				ok = false;
+			}
+		} else if (it == outputs.end()) {
+			missing++;
+		} else if (it->second != fields) {
+			printf("  check: frame %lld has %d packet(s), expected %d\n", (long long)i, it->second, fields);
+			ok = false;
+		}
+	}
+	// 符号化器が待ち行列から捨てたフレーム（policy が drop-*）の分だけは抜けてもよい
+	if (missing > r.stats.dropped_video_frames) {
+		printf("  check: %llu frame(s) missing from the output, but only %llu dropped by the encoder\n", (unsigned long long)missing, (unsigned long long)r.stats.dropped_video_frames);
+		ok = false;
+	}
+
+	if (opt.audio) {
+		if (audio.pts.empty()) {
+			printf("  check: no audio packets in %s\n", opt.output.c_str());
+			return false;
+		}
+		// 音声は符号化器のフレーム単位で書かれるので、それが映像の1フレームより長ければその長さまで許す
+		const double video_end = video.end * av_q2d(video.time_base);
+		const double audio_end = audio.end * av_q2d(audio.time_base);
+		const double tolerance = std::max((double)opt.fps.den / opt.fps.num, audio.max_duration * av_q2d(audio.time_base));
+		printf("  check: video ends at %.4f s, audio at %.4f s (tolerance %.4f s)\n", video_end, audio_end, tolerance);
+		if (fabs(video_end - audio_end) > tolerance + 1e-6) {
+			printf("  check: audio and video end %.1f ms apart\n", fabs(video_end - audio_end) * 1000);
+			ok = false;
+		}
+	}
+	printf("  check: %zu video packets, %llu frame(s) skipped, %llu missing: %s\n", video.pts.size(), (unsigned long long)skipped.size(), (unsigned long long)missing, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: encoderbench [options]\n"
+		"  --size WxH        source and output size (default 1920x1080)\n"
+		"  --fps N[/D]       frame rate (default 60)\n"
+		"  --10bit           feed YUYV16 (Y210) instead of UYVY8\n"
+		"  --field-rate      deinterlace to fields and encode at twice the rate\n"
+		"  --seconds N       length of the source (default 10)\n"
+		"  --flat-out        push frames as fast as the encoder accepts them (implies --policy block)\n"
+		"  --policy NAME     block, drop-oldest, drop-newest, degrade (default drop-oldest)\n"
+		"  --queue-mb N      byte budget of the input queue in MiB (default 512)\n"
+		"  --no-audio        disable the audio stream\n"
+		"  --format NAME     mpeg4, h264_nvenc, hevc_nvenc, libsvtav1, rawvideo, ffv1, utvideo\n"
+		"                    (repeatable, default all)\n"
+		"  --output PATH     output file, read back and checked after each format (default /dev/null)\n"
+		"  --direct-io       write full blocks with O_DIRECT (Linux)\n"
+		"  --prealloc-mb N   preallocate N MiB of the output file (Linux)\n"
+		"  --drop N          skip every Nth source frame and its audio, keeping timestamps\n"
+		"  --min-fps F       exit with 1 if the encoded rate of any format is below F\n"
+	);
+}
+
+bool parse(int argc, char **argv, Options *opt)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string a = argv[i];
+		char const *v = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (a == "--size" && v) {
+			if (sscanf(v, "%dx%d", &opt->width, &opt->height) != 2) return false;
+			i++;
+		} else if (a == "--fps" && v) {
+			int num = 0;
+			int den = 1;
+			if (sscanf(v, "%d/%d", &num, &den) < 1 || num <= 0 || den <= 0) return false;
+			opt->fps = {num, den};
+			i++;
+		} else if (a == "--10bit") {
+			opt->bit_depth = 10;
+		} else if (a == "--field-rate") {
+			opt->field_rate = true;
+		} else if (a == "--seconds" && v) {
+			opt->seconds = atoi(v);
+			i++;
+		} else if (a == "--flat-out") {
+			opt->flat_out = true;
+		} else if (a == "--policy" && v) {
+			bool found = false;
+			for (PolicyName const &t : POLICY_NAMES) {
+				if (strcmp(t.name, v) == 0) {
+					opt->policy = t.policy;
+					found = true;
+				}
+			}
+			if (!found) return false;
+			i++;
+		} else if (a == "--queue-mb" && v) {
+			opt->queue_mb = (size_t)atol(v);
+			i++;
+		} else if (a == "--no-audio") {
+			opt->audio = false;
+		} else if (a == "--format" && v) {
+			bool found = false;
+			for (FormatName const &t : FORMAT_NAMES) {
+				if (strcmp(t.name, v) == 0) {
+					opt->formats.push_back(t.format);
+					found = true;
+				}
+			}
+			if (!found) return false;
+			i++;
+		} else if (a == "--output" && v) {
+			opt->output = v;
+			i++;
+		} else if (a == "--direct-io") {
+			opt->direct_io = true;
+		} else if (a == "--prealloc-mb" && v) {
+			opt->prealloc_mb = atoll(v);
+			i++;
+		} else if (a == "--drop" && v) {
+			opt->drop = atoi(v);
+			i++;
+		} else if (a == "--min-fps" && v) {
+			opt->min_fps = atof(v);
+			i++;
+		} else {
+			return false;
+		}
+	}
+	if (opt->width <= 0 || opt->height <= 0 || (opt->width & 1) || opt->seconds <= 0) return false;
+	if (opt->formats.empty()) {
+		for (FormatName const &t : FORMAT_NAMES) {
+			opt->formats.push_back(t.format);
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	if (!parse(argc, argv, &opt)) {
+		usage();
+		return 2;
+	}
+
+	std::vector<Image> patterns;
+	for (int i = 0; i < PATTERN_FRAMES; i++) {
+		patterns.push_back(make_pattern(opt.width, opt.height, opt.bit_depth, i));
+	}
+
+	const double target = (double)opt.fps.num / opt.fps.den * (opt.field_rate ? 2 : 1);
+	printf("source %dx%d %.3f fps %d-bit%s%s, %d s\n", opt.width, opt.height, (double)opt.fps.num / opt.fps.den, opt.bit_depth, opt.field_rate ? ", field rate" : "", opt.flat_out ? ", flat out" : "", opt.seconds);
+
+	bool ok = true;
+	std::vector<std::pair<Format, Result>> results;
+	for (Format f : opt.formats) {
+		printf("%s\n", format_name(f));
+		Result r = run(opt, f, patterns);
+		if (!r.available) {
+			printf("  not available\n");
+		} else if (opt.output != "/dev/null" && !check_output(opt, r)) {
+			ok = false;
+		}
+		results.emplace_back(f, r);
+	}
+
+	printf("\n%-12s %9s %9s %9s %9s %9s %9s %10s %10s %10s %10s %9s %9s %10s %9s\n", "format", "pushed", "skipped", "encoded", "dropped", "degraded", "fps", "convert", "encode", "latency", "max lat.", "max queue", "peak MB", "write MB/s", "stalls");
+	for (auto const &[f, r] : results) {
+		if (!r.available) {
+			printf("%-12s %9s\n", format_name(f), "n/a");
+			continue;
+		}
+		printf("%-12s %9llu %9llu %9llu %9llu %9llu %9.1f %7.2f ms %7.2f ms %7.1f ms %7.1f ms %9zu %9.1f %10.1f %9llu\n", format_name(f), (unsigned long long)r.pushed, (unsigned long long)r.skipped, (unsigned long long)r.stats.video_frames, (unsigned long long)r.stats.dropped_video_frames, (unsigned long long)r.stats.degraded_video_frames, r.fps, r.stats.convert_ms, r.stats.encode_ms, r.stats.latency_ms, r.stats.max_latency_ms, r.stats.max_video_queue, megabytes(r.stats.max_queued_bytes), r.stats.write_mbps, (unsigned long long)r.stats.write_stalls);
+		if (opt.min_fps > 0 && r.fps < opt.min_fps) ok = false;
+	}
+	printf("target %.1f fps\n", target);
+
+	return ok ? 0 : 1;
+}
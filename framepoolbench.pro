@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = framepoolbench
+CONFIG += c++17 console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+	framepoolbench/main.cpp \
+	FramePool.cpp
+
+HEADERS += \
+	FramePool.h
+
+unix:LIBS += -lpthread
@@ -0,0 +1,155 @@
+// FramePool と malloc/free のフレームバッファ確保の速さを比べる
+// 複数のスレッドが 1080p と 2160p のフレームを確保し、数フレーム保持してから解放するのを繰り返す
+// 確保したバッファはページごとに書き込み、新しいページを割り当てる費用も含めて測る
+
+#include "../FramePool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+	int threads = 0; // 0 なら論理コア数（最低 2）
+	int iterations = 2000; // スレッドあたりの確保回数
+	int depth = 3; // 各スレッドが同時に保持するフレーム数
+	bool touch = true;
+};
+
+struct FrameSize {
+	char const *name;
+	size_t bytes;
+};
+
+// UYVY 8bit の大きさ
+const FrameSize FRAME_SIZES[] = {
+	{"1080p", 1920 * 1080 * 2},
+	{"2160p", 3840 * 2160 * 2},
+};
+
+const size_t PAGE_SIZE = 4096;
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: framepoolbench [options]\n"
+		"  --threads N     allocating threads (default: logical cores, at least 2)\n"
+		"  --iterations N  allocations per thread (default 2000)\n"
+		"  --depth N       frames held by each thread at once (default 3)\n"
+		"  --no-touch      do not write to the allocated pages\n");
+}
+
+bool parse_options(int argc, char **argv, Options *opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&](){
+			return i + 1 < argc ? argv[++i] : (char const *)"";
+		};
+		if (arg == "--threads") {
+			opts->threads = atoi(next());
+		} else if (arg == "--iterations") {
+			opts->iterations = std::max(1, atoi(next()));
+		} else if (arg == "--depth") {
+			opts->depth = std::max(1, atoi(next()));
+		} else if (arg == "--no-touch") {
+			opts->touch = false;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void touch(void *p, size_t size)
+{
+	volatile uint8_t *q = (volatile uint8_t *)p;
+	for (size_t i = 0; i < size; i += PAGE_SIZE) {
+		q[i] = (uint8_t)i;
+	}
+}
+
+// 全スレッドの確保と解放にかかった時間（秒）を返す
+template <typename Alloc, typename Free>
+double run(Options const &opts, size_t size, Alloc alloc, Free release)
+{
+	std::vector<std::thread> threads;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int t = 0; t < opts.threads; t++) {
+		threads.emplace_back([&](){
+			std::deque<void *> held;
+			for (int i = 0; i < opts.iterations; i++) {
+				void *p = alloc(size);
+				if (!p) {
+					fprintf(stderr, "allocation failed\n");
+					exit(1);
+				}
+				if (opts.touch) {
+					touch(p, size);
+				}
+				held.push_back(p);
+				if ((int)held.size() > opts.depth) {
+					release(held.front(), size);
+					held.pop_front();
+				}
+			}
+			for (void *p : held) {
+				release(p, size);
+			}
+		});
+	}
+	for (std::thread &t : threads) {
+		t.join();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opts;
+	if (!parse_options(argc, argv, &opts)) {
+		usage();
+		return 2;
+	}
+	if (opts.threads < 1) {
+		opts.threads = std::max(2u, std::thread::hardware_concurrency());
+	}
+
+	// 全スレッドが保持するだけのブロックをプールできるようにする
+	const int blocks = opts.threads * (opts.depth + 1);
+
+	printf("threads %d, iterations %d, depth %d%s\n", opts.threads, opts.iterations, opts.depth, opts.touch ? "" : ", no touch");
+	printf("%-6s %-7s %10s %12s %10s\n", "size", "alloc", "frames/s", "us/frame", "hit rate");
+	for (FrameSize const &fs : FRAME_SIZES) {
+		const double frames = (double)opts.threads * opts.iterations;
+
+		double sec = run(opts, fs.bytes, [](size_t size){
+			return malloc(size);
+		}, [](void *p, size_t){
+			free(p);
+		});
+		printf("%-6s %-7s %10.0f %12.2f %10s\n", fs.name, "malloc", frames / sec, sec * 1e6 / frames, "-");
+
+		FramePool::setLimits(blocks, (size_t)blocks * fs.bytes);
+		FramePool::Stats s0 = FramePool::stats();
+		sec = run(opts, fs.bytes, [](size_t size){
+			return FramePool::allocate(size);
+		}, [](void *p, size_t size){
+			FramePool::deallocate(p, size);
+		});
+		FramePool::Stats s1 = FramePool::stats();
+		const uint64_t hits = s1.hits - s0.hits;
+		const uint64_t total = hits + s1.misses - s0.misses;
+		printf("%-6s %-7s %10.0f %12.2f %9.1f%%\n", fs.name, "pool", frames / sec, sec * 1e6 / frames, total > 0 ? hits * 100.0 / total : 0.0);
+		FramePool::clear();
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+TEMPLATE = app
+TARGET = frameringtest
+CONFIG += c++17 console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+	frameringtest/main.cpp
+
+HEADERS += \
+	FrameRing.h
+
+unix:LIBS += -lpthread
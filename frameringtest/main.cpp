@@ -0,0 +1,177 @@
+// FrameRing を1つの生産者と複数の処理スレッドで動かし、要素が失われたり重複したりしないことを確かめる
+// 未処理の要素を少なく制限して、生産者の drop_oldest と処理スレッドの claim を競合させる
+// 失敗があれば終了コード 1
+
+#include "../FrameRing.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef FrameRing<uint64_t, 16> Ring;
+
+const uint64_t NONE = UINT64_MAX;
+
+struct Options {
+	int workers = 4;
+	uint64_t frames = 200000;
+};
+
+int failures = 0;
+
+void check(bool ok, char const *policy, char const *what)
+{
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s: %s\n", policy, what);
+		failures++;
+	}
+}
+
+// 処理の重さをばらつかせる
+void work(uint64_t seed)
+{
+	const int n = (seed * 2654435761u >> 24) & 255;
+	volatile int x = 0;
+	for (int i = 0; i < n; i++) {
+		x = x + i;
+	}
+	if ((seed & 63) == 0) {
+		std::this_thread::yield();
+	}
+}
+
+void run(Options const &opts, Ring::DropPolicy policy, size_t max_pending, char const *name)
+{
+	std::unique_ptr<Ring> ring(new Ring);
+	ring->setDropPolicy(policy, max_pending);
+
+	// 位置ごとに、投入した値と取り出した値を記録する（要素の値は 1 から始まる連番）
+	const uint64_t n = opts.frames;
+	std::unique_ptr<std::atomic<uint64_t>[]> pushed(new std::atomic<uint64_t>[n]);
+	std::unique_ptr<std::atomic<uint64_t>[]> claimed(new std::atomic<uint64_t>[n]);
+	for (uint64_t i = 0; i < n; i++) {
+		pushed[i] = NONE;
+		claimed[i] = NONE;
+	}
+	std::atomic<int> duplicate_claims = 0;
+	std::atomic<int> wrong_completes = 0;
+
+	// drain の fn は順に1つずつ呼ばれるので、どのスレッドから呼ばれても記録してよい
+	std::vector<uint64_t> drained;
+	drained.reserve(n);
+	auto drain = [&](){
+		ring->drain([&](uint64_t const &item){
+			drained.push_back(item);
+		});
+	};
+
+	std::atomic<bool> done = false;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < opts.workers; t++) {
+		workers.emplace_back([&](){
+			while (1) {
+				uint64_t index;
+				uint64_t item;
+				if (ring->claim(&index, &item)) {
+					if (index >= n || claimed[index].exchange(item) != NONE) {
+						duplicate_claims++;
+					}
+					work(item);
+					ring->complete(index, std::move(item));
+				} else if (done && !ring->hasPending()) {
+					break;
+				} else {
+					std::this_thread::yield();
+				}
+				drain();
+			}
+		});
+	}
+
+	uint64_t accepted = 0;
+	uint64_t rejected = 0;
+	for (uint64_t seq = 1; seq <= n; seq++) {
+		uint64_t item = seq;
+		if (ring->push(std::move(item))) {
+			pushed[accepted++] = seq;
+		} else {
+			rejected++;
+		}
+		// 処理スレッドと同じ程度の間隔で投入し、捨てる場合と捨てない場合が混ざるようにする
+		work(seq * 7);
+		if ((seq & 15) == 0) {
+			drain();
+		}
+	}
+	done = true;
+	for (std::thread &t : workers) {
+		t.join();
+	}
+	drain();
+
+	// 受け付けた位置はすべて、処理されたか drop_oldest で捨てられたかのどちらか
+	uint64_t claimed_count = 0;
+	std::vector<uint64_t> expected;
+	for (uint64_t i = 0; i < n; i++) {
+		const uint64_t c = claimed[i];
+		if (c == NONE) continue;
+		claimed_count++;
+		if (i >= accepted) {
+			wrong_completes++;
+		} else if (c != pushed[i]) {
+			wrong_completes++;
+		}
+		expected.push_back(c);
+	}
+	const Ring::Stats s = ring->stats();
+	const uint64_t dropped_oldest = s.dropped - rejected;
+
+	check(duplicate_claims == 0, name, "an index was claimed twice");
+	check(wrong_completes == 0, name, "a claimed item differs from the item pushed at its index");
+	check(s.pushed == n, name, "pushed count");
+	check(s.completed == claimed_count, name, "completed count differs from claimed count");
+	check(claimed_count + dropped_oldest == accepted, name, "accepted items were lost");
+	check(policy == Ring::DropPolicy::DropOldest || dropped_oldest == 0, name, "DropNewest discarded a queued item");
+	check(drained == expected, name, "drained items are not the claimed items in push order");
+	check(std::is_sorted(drained.begin(), drained.end()) && std::adjacent_find(drained.begin(), drained.end()) == drained.end(), name, "drained items are out of order or duplicated");
+	check(!ring->hasPending(), name, "items left pending");
+
+	printf("%-10s pending %2zu: accepted %llu, rejected %llu, dropped oldest %llu, completed %llu\n", name, max_pending,
+		   (unsigned long long)accepted, (unsigned long long)rejected, (unsigned long long)dropped_oldest, (unsigned long long)claimed_count);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opts;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--workers" && i + 1 < argc) {
+			opts.workers = std::max(1, atoi(argv[++i]));
+		} else if (arg == "--frames" && i + 1 < argc) {
+			opts.frames = std::max(1, atoi(argv[++i]));
+		} else {
+			fprintf(stderr, "usage: frameringtest [--workers N] [--frames N]\n");
+			return 2;
+		}
+	}
+
+	run(opts, Ring::DropPolicy::DropOldest, 2, "DropOldest");
+	run(opts, Ring::DropPolicy::DropOldest, 8, "DropOldest");
+	run(opts, Ring::DropPolicy::DropNewest, 2, "DropNewest");
+	run(opts, Ring::DropPolicy::DropNewest, 16, "DropNewest");
+
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,19 @@
+TEMPLATE = app
+TARGET = imagekernelstest
+CONFIG += c++17 console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+linux:QMAKE_CXXFLAGS += -fopenmp
+linux:QMAKE_LFLAGS += -fopenmp
+
+SOURCES += \
+	imagekernelstest/main.cpp \
+	ImageKernels.cpp
+
+HEADERS += \
+	ImageKernels.h
@@ -0,0 +1,406 @@
+// ImageKernels の SIMD 版の行関数がスカラー版と同じ結果を出すことを確かめる
+// この環境で使えるすべての Level について、奇数を含む幅と揃っていない行の先頭で1バイトずつ比べる
+// 行の後ろの余白に書き込んでいないことも確かめる。縮小の横方向の補間 (interpolate_row) は行の末尾を指す標本も混ぜる。失敗があれば終了コード 1
+// 10 ビットの形式 (v210, YUYV16) は、既知の値を詰めた入力から期待する値が出ることも1サンプルずつ確かめる
+
+#include "../ImageKernels.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+typedef ImageKernels::Level Level;
+typedef ImageKernels::RowFunc RowFunc;
+
+// 行の後ろに置く余白。ここに書き込んだら失敗
+const int GUARD = 64;
+const int ROWS = 4;
+
+struct RowKernel {
+	char const *name;
+	RowFunc ImageKernels::Table::*func;
+	int (*src_bytes)(int w);
+	int (*dst_bytes)(int w);
+	bool reads_dst; // 出力の一部を残す関数（set_luma）
+};
+
+int bytes1(int w) { return w; }
+int bytes2(int w) { return w * 2; }
+int bytes3(int w) { return w * 3; }
+int bytes4(int w) { return w * 4; }
+int bytes_v210(int w) { return (w + 5) / 6 * 16; }
+
+const RowKernel ROW_KERNELS[] = {
+	{"swap_yuv422", &ImageKernels::Table::swap_yuv422, bytes2, bytes2, false},
+	{"uyvy_to_rgb", &ImageKernels::Table::uyvy_to_rgb, bytes2, bytes3, false},
+	{"yuyv_to_rgb", &ImageKernels::Table::yuyv_to_rgb, bytes2, bytes3, false},
+	{"gray_to_rgb", &ImageKernels::Table::gray_to_rgb, bytes1, bytes3, false},
+	{"rgb_to_gray", &ImageKernels::Table::rgb_to_gray, bytes3, bytes1, false},
+	{"uyvy_to_gray", &ImageKernels::Table::uyvy_to_gray, bytes2, bytes1, false},
+	{"yuyv_to_gray", &ImageKernels::Table::yuyv_to_gray, bytes2, bytes1, false},
+	{"rgb_to_uyvy", &ImageKernels::Table::rgb_to_uyvy, bytes3, bytes2, false},
+	{"rgb_to_yuyv", &ImageKernels::Table::rgb_to_yuyv, bytes3, bytes2, false},
+	{"gray_to_uyvy", &ImageKernels::Table::gray_to_uyvy, bytes1, bytes2, false},
+	{"gray_to_yuyv", &ImageKernels::Table::gray_to_yuyv, bytes1, bytes2, false},
+	{"v210_to_yuyv16", &ImageKernels::Table::v210_to_yuyv16, bytes_v210, bytes4, false},
+	{"yuyv16_to_yuyv", &ImageKernels::Table::yuyv16_to_yuyv, bytes4, bytes2, false},
+	{"yuyv_to_yuyv16", &ImageKernels::Table::yuyv_to_yuyv16, bytes2, bytes4, false},
+	{"uyvy_get_luma", &ImageKernels::Table::uyvy_get_luma, bytes2, bytes1, false},
+	{"yuyv_get_luma", &ImageKernels::Table::yuyv_get_luma, bytes2, bytes1, false},
+	{"uyvy_set_luma", &ImageKernels::Table::uyvy_set_luma, bytes1, bytes2, true},
+	{"yuyv_set_luma", &ImageKernels::Table::yuyv_set_luma, bytes1, bytes2, true},
+};
+
+char const *level_name(Level level)
+{
+	switch (level) {
+	case Level::Scalar: return "Scalar";
+	case Level::SSSE3: return "SSSE3";
+	case Level::AVX2: return "AVX2";
+	case Level::NEON: return "NEON";
+	}
+	return "?";
+}
+
+int failures = 0;
+
+void fail(Level level, char const *name, int w, int offset, char const *what)
+{
+	if (failures < 20) {
+		fprintf(stderr, "FAIL: %s %s width %d offset %d: %s\n", level_name(level), name, w, offset, what);
+	}
+	failures++;
+}
+
+std::vector<int> test_widths()
+{
+	std::vector<int> widths;
+	for (int w = 1; w <= 70; w++) {
+		widths.push_back(w);
+	}
+	for (int w : {95, 96, 97, 127, 129, 255, 721, 1279, 1920, 1921, 3839}) {
+		widths.push_back(w);
+	}
+	return widths;
+}
+
+// 毎回同じ乱数列
+struct Random {
+	uint32_t state = 12345;
+	uint8_t next()
+	{
+		state = state * 1103515245 + 12345;
+		return uint8_t(state >> 16);
+	}
+	void fill(uint8_t *p, size_t n)
+	{
+		for (size_t i = 0; i < n; i++) {
+			p[i] = next();
+		}
+	}
+};
+
+// ROWS 行を、行ごとに先頭の揃い方を変えて処理する
+// offset は最初の行の先頭のずれ。行の間隔はバイト数に奇数を足したもの
+template <typename F> void run_rows(std::vector<uint8_t> *buf, int offset, int bytes, F fn)
+{
+	const int stride = bytes + GUARD + 3;
+	buf->assign(offset + stride * ROWS + GUARD, 0xcd);
+	for (int y = 0; y < ROWS; y++) {
+		fn(buf->data() + offset + stride * y, y);
+	}
+}
+
+void test_row_kernel(Level level, ImageKernels::Table const *t, RowKernel const &k)
+{
+	ImageKernels::Table const *ref = ImageKernels::table(Level::Scalar);
+	RowFunc f = t->*k.func;
+	RowFunc g = ref->*k.func;
+	if (!f || !g) {
+		fail(level, k.name, 0, 0, "missing function");
+		return;
+	}
+	Random rnd;
+	std::vector<uint8_t> src, dst, expected;
+	for (int w : test_widths()) {
+		for (int offset = 0; offset < 4; offset++) {
+			const int sb = k.src_bytes(w);
+			const int db = k.dst_bytes(w);
+			std::vector<uint8_t> input(sb * ROWS);
+			std::vector<uint8_t> initial(db * ROWS);
+			rnd.fill(input.data(), input.size());
+			rnd.fill(initial.data(), initial.size());
+			std::vector<uint8_t const *> rows(ROWS);
+			run_rows(&src, offset, sb, [&](uint8_t *p, int y){
+				memcpy(p, input.data() + sb * y, sb);
+				rows[y] = p;
+			});
+			auto convert = [&](std::vector<uint8_t> *out, RowFunc fn){
+				run_rows(out, offset + 1, db, [&](uint8_t *p, int y){
+					if (k.reads_dst) {
+						memcpy(p, initial.data() + db * y, db);
+					}
+					fn(rows[y], p, w);
+				});
+			};
+			convert(&expected, g);
+			convert(&dst, f);
+			if (dst != expected) {
+				fail(level, k.name, w, offset, "output differs from scalar");
+			}
+			// 余白が残っていること（dst は expected と同じなので SIMD 版も確かめたことになる）
+			const int stride = db + GUARD + 3;
+			for (int y = 0; y < ROWS; y++) {
+				uint8_t const *guard = expected.data() + offset + 1 + stride * y + db;
+				for (int i = 0; i < GUARD + 3; i++) {
+					if (guard[i] != 0xcd) {
+						fail(level, k.name, w, offset, "wrote past the end of the row");
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+// n はバイト数。acc の後ろの余白も比べる
+void test_accumulate_row(Level level, ImageKernels::Table const *t)
+{
+	ImageKernels::Table const *ref = ImageKernels::table(Level::Scalar);
+	Random rnd;
+	for (int n : test_widths()) {
+		for (int offset = 0; offset < 4; offset++) {
+			std::vector<uint8_t> src(offset + n);
+			rnd.fill(src.data(), src.size());
+			std::vector<uint16_t> acc(1 + n + GUARD);
+			for (uint16_t &v : acc) {
+				v = rnd.next() | (rnd.next() & 0x3f) << 8;
+			}
+			std::vector<uint16_t> expected = acc;
+			// acc は uint16_t なので、要素1つ分ずらしてベクトルの境界から外す
+			ref->accumulate_row(src.data() + offset, expected.data() + 1, n);
+			t->accumulate_row(src.data() + offset, acc.data() + 1, n);
+			if (acc != expected) {
+				fail(level, "accumulate_row", n, offset, "output differs from scalar");
+			}
+		}
+	}
+}
+
+void test_blend_rows(Level level, ImageKernels::Table const *t)
+{
+	ImageKernels::Table const *ref = ImageKernels::table(Level::Scalar);
+	Random rnd;
+	for (int n : test_widths()) {
+		for (int f : {0, 1, 77, 128, 200, 255, 256}) {
+			const int offset = (n + f) % 4;
+			std::vector<uint8_t> a(offset + n), b(offset + 2 * n);
+			rnd.fill(a.data(), a.size());
+			rnd.fill(b.data(), b.size());
+			std::vector<uint8_t> dst(offset + 3 + n + GUARD, 0xcd);
+			std::vector<uint8_t> expected = dst;
+			ref->blend_rows(a.data() + offset, b.data() + offset + n, f, expected.data() + offset + 3, n);
+			t->blend_rows(a.data() + offset, b.data() + offset + n, f, dst.data() + offset + 3, n);
+			if (dst != expected) {
+				fail(level, "blend_rows", n, offset, "output differs from scalar");
+			}
+		}
+	}
+}
+
+// n は出力のバイト数。入力の行は n と同じ長さで、最後の数バイトを指す標本も混ぜる（AVX2 版はそこだけ gather を使わない）
+void test_interpolate_row(Level level, ImageKernels::Table const *t)
+{
+	ImageKernels::Table const *ref = ImageKernels::table(Level::Scalar);
+	Random rnd;
+	for (int n : test_widths()) {
+		for (int offset = 0; offset < 4; offset++) {
+			std::vector<uint8_t> src(offset + n);
+			rnd.fill(src.data(), src.size());
+			std::vector<int32_t> i0(n), i1(n), w(n);
+			for (int j = 0; j < n; j++) {
+				const int r = rnd.next() | rnd.next() << 8;
+				i0[j] = (j % 5 == 4) ? n - 1 - r % std::min(n, 4) : r % n;
+				i1[j] = std::min(n - 1, i0[j] + (int)(rnd.next() % 5));
+				const int f = (j % 7 == 6) ? 0 : rnd.next() % 256;
+				w[j] = (256 - f) | (f << 16);
+			}
+			std::vector<uint8_t> dst(offset + 3 + n + GUARD, 0xcd);
+			std::vector<uint8_t> expected = dst;
+			ref->interpolate_row(src.data() + offset, n, expected.data() + offset + 3, n, i0.data(), i1.data(), w.data());
+			t->interpolate_row(src.data() + offset, n, dst.data() + offset + 3, n, i0.data(), i1.data(), w.data());
+			if (dst != expected) {
+				fail(level, "interpolate_row", n, offset, "output differs from scalar");
+			}
+		}
+	}
+}
+
+// 既知の値の幅
+const int KNOWN_WIDTHS[] = {6, 47, 48, 50, 1920};
+
+// x 画素目の 10 ビットの輝度と色差。0 と 1023 も含む
+int known_y(int x)
+{
+	return x % 97 == 0 ? 1023 : (x * 37 + 5) & 0x3ff;
+}
+
+int known_c(int x) // x が偶数なら Cb、奇数なら Cr
+{
+	return x % 89 == 1 ? 0 : (x * 53 + 512 + (x & 1) * 300) & 0x3ff;
+}
+
+// v210 の6画素（4つの 32 ビット値）は Cb0 Y0 Cr0 | Y1 Cb1 Y2 | Cr1 Y3 Cb2 | Y4 Cr2 Y5 で、各 10 ビットを下位から詰める
+// 幅が6の倍数でなければ、最後のまとまりの残りは出力に現れてはいけない値（1023 と 0 の繰り返し）で埋める
+std::vector<uint8_t> pack_v210(int w)
+{
+	const int groups = (w + 5) / 6;
+	std::vector<uint8_t> out(groups * 16);
+	for (int g = 0; g < groups; g++) {
+		int v[12];
+		for (int i = 0; i < 6; i++) {
+			const int x = g * 6 + i;
+			v[2 * i + 1] = x < w ? known_y(x) : 1023;
+			v[2 * i + 0] = x < w ? known_c(x) : 0;
+		}
+		for (int i = 0; i < 4; i++) {
+			const uint32_t word = v[3 * i] | (v[3 * i + 1] << 10) | ((uint32_t)v[3 * i + 2] << 20);
+			for (int b = 0; b < 4; b++) {
+				out[g * 16 + i * 4 + b] = uint8_t(word >> (8 * b));
+			}
+		}
+	}
+	return out;
+}
+
+void fail_sample(Level level, char const *name, int w, int i, int value, int expected)
+{
+	char what[100];
+	snprintf(what, sizeof(what), "sample %d is 0x%04x, expected 0x%04x", i, value, expected);
+	fail(level, name, w, 0, what);
+}
+
+// v210 を既知の値から作り、YUYV16 の各サンプルが 10 ビットの値を上位に詰めたものになること
+void test_v210_known(Level level, ImageKernels::Table const *t)
+{
+	for (int w : KNOWN_WIDTHS) {
+		const std::vector<uint8_t> src = pack_v210(w);
+		std::vector<uint8_t> dst(w * 4 + GUARD, 0xcd);
+		t->v210_to_yuyv16(src.data(), dst.data(), w);
+		uint16_t const *d = (uint16_t const *)dst.data();
+		for (int x = 0; x < w; x++) {
+			if (d[2 * x] != known_y(x) << 6) {
+				fail_sample(level, "v210_to_yuyv16 (known values)", w, 2 * x, d[2 * x], known_y(x) << 6);
+				break;
+			}
+			if (d[2 * x + 1] != known_c(x) << 6) {
+				fail_sample(level, "v210_to_yuyv16 (known values)", w, 2 * x + 1, d[2 * x + 1], known_c(x) << 6);
+				break;
+			}
+		}
+		if (std::count(dst.begin() + w * 4, dst.end(), 0xcd) != GUARD) {
+			fail(level, "v210_to_yuyv16 (known values)", w, 0, "wrote past the end of the row");
+		}
+	}
+}
+
+// YUYV16 から YUYV8 は上位 8 ビット、YUYV8 から YUYV16 は 8 ビットの値を上位に詰めたもの
+void test_yuyv16_known(Level level, ImageKernels::Table const *t)
+{
+	for (int w : KNOWN_WIDTHS) {
+		const int n = w * 2; // サンプル数
+		std::vector<uint16_t> wide(n);
+		for (int i = 0; i < n; i++) {
+			wide[i] = (i & 1 ? known_c(i / 2) : known_y(i / 2)) << 6;
+		}
+		std::vector<uint8_t> narrow(n + GUARD, 0xcd);
+		t->yuyv16_to_yuyv((uint8_t const *)wide.data(), narrow.data(), w);
+		for (int i = 0; i < n; i++) {
+			if (narrow[i] != wide[i] >> 8) {
+				fail_sample(level, "yuyv16_to_yuyv (known values)", w, i, narrow[i], wide[i] >> 8);
+				break;
+			}
+		}
+		if (std::count(narrow.begin() + n, narrow.end(), 0xcd) != GUARD) {
+			fail(level, "yuyv16_to_yuyv (known values)", w, 0, "wrote past the end of the row");
+		}
+
+		// 8 ビットの値をひととおり（256 サンプル以上の幅ですべての値）
+		std::vector<uint8_t> bytes(n);
+		for (int i = 0; i < n; i++) {
+			bytes[i] = uint8_t(i * 29 + (i >> 8));
+		}
+		std::vector<uint16_t> back(n + GUARD / 2, 0xcdcd);
+		t->yuyv_to_yuyv16(bytes.data(), (uint8_t *)back.data(), w);
+		for (int i = 0; i < n; i++) {
+			if (back[i] != bytes[i] << 8) {
+				fail_sample(level, "yuyv_to_yuyv16 (known values)", w, i, back[i], bytes[i] << 8);
+				break;
+			}
+		}
+		if (std::count(back.begin() + n, back.end(), 0xcdcd) != GUARD / 2) {
+			fail(level, "yuyv_to_yuyv16 (known values)", w, 0, "wrote past the end of the row");
+		}
+	}
+}
+
+// 同時に借りたスレッドの合計が threadCount() を超えないこと
+void test_thread_budget()
+{
+	auto check = [](bool ok, char const *what){
+		if (!ok) {
+			fprintf(stderr, "FAIL: ThreadBudget: %s\n", what);
+			failures++;
+		}
+	};
+	ImageKernels::setThreadCount(4);
+	{
+		ImageKernels::ThreadBudget a(8);
+		check(a.count() == 4, "first caller gets all threads");
+		{
+			ImageKernels::ThreadBudget b(8);
+			check(b.count() == 1, "second caller runs on its own thread");
+		}
+		ImageKernels::ThreadBudget c(1);
+		check(c.count() == 1, "serial caller");
+	}
+	{
+		ImageKernels::ThreadBudget a(2);
+		ImageKernels::ThreadBudget b(8);
+		check(a.count() == 2 && b.count() == 2, "remaining threads are shared");
+	}
+	ImageKernels::ThreadBudget d(8);
+	check(d.count() == 4, "threads are returned");
+	ImageKernels::setThreadCount(0);
+}
+
+} // namespace
+
+int main()
+{
+	for (Level level : {Level::Scalar, Level::SSSE3, Level::AVX2, Level::NEON}) {
+		ImageKernels::Table const *t = ImageKernels::table(level);
+		if (!t) {
+			printf("%-6s not supported, skipped\n", level_name(level));
+			continue;
+		}
+		const int before = failures;
+		for (RowKernel const &k : ROW_KERNELS) {
+			test_row_kernel(level, t, k);
+		}
+		test_accumulate_row(level, t);
+		test_blend_rows(level, t);
+		test_interpolate_row(level, t);
+		test_v210_known(level, t);
+		test_yuyv16_known(level, t);
+		printf("%-6s %s\n", level_name(level), failures == before ? "ok" : "FAILED");
+	}
+	test_thread_budget();
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+QT += core gui
+TEMPLATE = app
+TARGET = pipelinebench
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DESTDIR = $$PWD/_bin
+
+DEFINES += USE_FFMPEG
+INCLUDEPATH += $$PWD
+
+linux:QMAKE_CXXFLAGS += -fopenmp
+linux:QMAKE_LFLAGS += -fopenmp
+gcc:QMAKE_CXXFLAGS += -Wno-switch
+
+win32:INCLUDEPATH += C:/ffmpeg/include
+win32:LIBS += -LC:/ffmpeg/bin
+macx:INCLUDEPATH += /usr/local/Cellar/ffmpeg/4.1.4_1/include
+macx:LIBS += -L/usr/local/Cellar/ffmpeg/4.1.4_1/lib
+LIBS += -lavutil -lswscale
+
+SOURCES += \
+	pipelinebench/main.cpp \
+	Deinterlace.cpp \
+	FramePool.cpp \
+	FrameProcessThread.cpp \
+	Image.cpp \
+	ImageKernels.cpp
+
+HEADERS += \
+	Deinterlace.h \
+	FramePool.h \
+	FrameProcessThread.h \
+	FrameRing.h \
+	Image.h \
+	ImageKernels.h \
+	VideoFrameData.h
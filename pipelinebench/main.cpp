@@ -0,0 +1,270 @@
+// FrameProcessThread に合成したフレームを流し、出力の順序と各段の処理時間を測る
+// 1080i（UYVY8、インタレース、デインタレースしてから縮小）と 2160p（UYVY8、プログレッシブ、縮小のみ）のフレームを投入し、
+// ready で受け取ったフレームが投入順に並んでいること、捨てられたフレーム以外がすべて届くことを確かめる。崩れていれば終了コード 1
+// 各段の1フレームあたりの時間は deinterlaceTiming() と scaleTiming() から取る
+// 続けて FrameProcessThread::scale() だけを、変換器 (SwsContext) と出力のバッファを毎回作る場合と使い回す場合で比べる
+
+#include "../FrameProcessThread.h"
+#include "../ImageKernels.h"
+#include "../VideoFrameData.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+	int frames = 120;
+	int width = 1280; // 画面表示用の大きさ
+	int height = 720;
+	int in_flight = 4; // 出力を待たずに投入するフレームの数。処理待ちの上限 (4) を超えると古いものから捨てられる
+	bool field_rate = false;
+	int scale_frames = 60; // scale() を比べるときのフレーム数
+};
+
+struct SourceCase {
+	char const *name;
+	int width;
+	int height;
+	BMDFieldDominance field_dominance;
+};
+
+const SourceCase SOURCES[] = {
+	{"1080i", 1920, 1080, bmdUpperFieldFirst},
+	{"2160p", 3840, 2160, bmdProgressiveFrame},
+};
+
+// scale() を比べる入力の形式。UYVY8 は ImageKernels::scaleYUV422ToRGB、それ以外は swscale で縮小する
+struct ScaleCase {
+	char const *name;
+	Image::Format format;
+};
+
+const ScaleCase SCALE_FORMATS[] = {
+	{"UYVY8", Image::Format::UYVY8},
+	{"RGB8", Image::Format::RGB8},
+	{"YUYV16", Image::Format::YUYV16},
+};
+
+// 入力として繰り返し使う画像の数
+const int PATTERN_FRAMES = 8;
+
+// すべての出力を待つ時間の上限
+const std::chrono::seconds DRAIN_TIMEOUT(30);
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: pipelinebench [options]\n"
+		"  --frames N        frames per source (default 120)\n"
+		"  --view WxH        preview size (default 1280x720)\n"
+		"  --in-flight N     frames requested before waiting for output (default 4)\n"
+		"  --field-rate      output each field of interlaced sources as a frame\n"
+		"  --scale-frames N  frames per scale() measurement (default 60)\n");
+}
+
+bool parse_options(int argc, char **argv, Options *opts)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&](){
+			return i + 1 < argc ? argv[++i] : (char const *)"";
+		};
+		if (arg == "--frames") {
+			opts->frames = std::max(1, atoi(next()));
+		} else if (arg == "--view") {
+			if (sscanf(next(), "%dx%d", &opts->width, &opts->height) != 2 || opts->width < 1 || opts->height < 1) return false;
+		} else if (arg == "--in-flight") {
+			opts->in_flight = std::max(1, atoi(next()));
+		} else if (arg == "--field-rate") {
+			opts->field_rate = true;
+		} else if (arg == "--scale-frames") {
+			opts->scale_frames = std::max(1, atoi(next()));
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// 横に流れる模様。偶数行は時刻 t * 2、奇数行は t * 2 + 1 のフィールド
+Image make_image(int w, int h, int t)
+{
+	Image image(w, h, Image::Format::UYVY8);
+	for (int y = 0; y < h; y++) {
+		const int ft = t * 2 + (y & 1);
+		uint8_t *p = image.scanLine(y);
+		for (int x = 0; x < w; x++) {
+			p[2 * x] = 128;
+			p[2 * x + 1] = 64 + ((x + ft * 6) & 127) - ((y * 3) & 31);
+		}
+	}
+	return image;
+}
+
+// ready で受け取ったフレームを記録する
+struct Receiver {
+	std::mutex mutex;
+	std::condition_variable cond;
+	uint64_t frames = 0; // 受け取った入力フレームの数（後のフィールドは数えない）
+	uint64_t outputs = 0;
+	int64_t last = -1; // 最後に受け取った出力の順序
+	uint64_t out_of_order = 0;
+	uint64_t bad_size = 0;
+
+	void receive(VideoFrameData const &frame, QSize const &view)
+	{
+		std::lock_guard lock(mutex);
+		// フィールドごとの出力では前のフィールド、後のフィールドの順に届く
+		const int64_t order = frame.d->stream_time * 2 + (frame.d->second_field ? 1 : 0);
+		if (order <= last) {
+			out_of_order++;
+		}
+		last = order;
+		if (frame.d->image_for_view.width() != view.width() || frame.d->image_for_view.height() != view.height()) {
+			bad_size++;
+		}
+		outputs++;
+		if (!frame.d->second_field) {
+			frames++;
+		}
+		cond.notify_all();
+	}
+};
+
+struct Result {
+	double seconds = 0;
+	uint64_t frames = 0;
+	uint64_t outputs = 0;
+	uint64_t dropped = 0;
+	bool complete = false;
+	uint64_t out_of_order = 0;
+	uint64_t bad_size = 0;
+	FrameProcessThread::StageTiming deinterlace;
+	FrameProcessThread::StageTiming scale;
+};
+
+uint64_t dropped_frames(FrameProcessThread const &fpt)
+{
+	return fpt.deinterlaceTiming().dropped + fpt.scaleTiming().dropped;
+}
+
+Result run(Options const &opts, SourceCase const &src, std::vector<Image> const &pattern)
+{
+	const QSize view(opts.width, opts.height);
+	Receiver receiver;
+	FrameProcessThread fpt;
+	fpt.enableFieldRate(opts.field_rate);
+	QObject::connect(&fpt, &FrameProcessThread::ready, [&](VideoFrameData const &frame){
+		receiver.receive(frame, view);
+	});
+	fpt.start();
+
+	Result r;
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int n = 0; n < opts.frames; n++) {
+		VideoFrameData frame;
+		frame.d->image = pattern[n % pattern.size()];
+		frame.d->signal_valid = true;
+		frame.d->field_dominance = src.field_dominance;
+		frame.d->time_scale = 60000;
+		frame.d->stream_duration = 1001;
+		frame.d->stream_time = n; // 順序を確かめるため、時刻の代わりに通し番号を入れる
+		fpt.request(frame, view);
+
+		// 出力が追いつくまで待つ
+		std::unique_lock lock(receiver.mutex);
+		while (n + 1 - receiver.frames - dropped_frames(fpt) >= (uint64_t)opts.in_flight) {
+			receiver.cond.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+	{
+		std::unique_lock lock(receiver.mutex);
+		const auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+		while (receiver.frames + dropped_frames(fpt) < (uint64_t)opts.frames && std::chrono::steady_clock::now() < deadline) {
+			receiver.cond.wait_for(lock, std::chrono::milliseconds(10));
+		}
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		r.complete = receiver.frames + dropped_frames(fpt) == (uint64_t)opts.frames;
+	}
+	fpt.stop();
+
+	r.frames = receiver.frames;
+	r.outputs = receiver.outputs;
+	r.out_of_order = receiver.out_of_order;
+	r.bad_size = receiver.bad_size;
+	r.dropped = dropped_frames(fpt);
+	r.deinterlace = fpt.deinterlaceTiming();
+	r.scale = fpt.scaleTiming();
+	return r;
+}
+
+// scale() の1フレームあたりの時間（ミリ秒）
+double time_scale(Options const &opts, Image const &image, bool reuse)
+{
+	FrameProcessThread::scale(image, opts.width, opts.height, QImage::Format_RGB888, reuse); // 暖機
+	const auto t0 = std::chrono::steady_clock::now();
+	for (int n = 0; n < opts.scale_frames; n++) {
+		FrameProcessThread::scale(image, opts.width, opts.height, QImage::Format_RGB888, reuse);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1000 / opts.scale_frames;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	Options opts;
+	if (!parse_options(argc, argv, &opts)) {
+		usage();
+		return 2;
+	}
+
+	int failures = 0;
+	printf("view %dx%d, frames %d, in flight %d, field rate %s, processors %u, kernel threads %d\n", opts.width, opts.height, opts.frames, opts.in_flight, opts.field_rate ? "on" : "off", std::thread::hardware_concurrency(), ImageKernels::threadCount());
+	printf("%-6s %8s %8s %8s %14s %14s %6s\n", "source", "outputs", "dropped", "fps", "deinterlace ms", "scale ms", "order");
+	for (SourceCase const &src : SOURCES) {
+		std::vector<Image> pattern;
+		for (int t = 0; t < PATTERN_FRAMES; t++) {
+			pattern.push_back(make_image(src.width, src.height, t));
+		}
+		Result r = run(opts, src, pattern);
+		const bool ok = r.complete && r.out_of_order == 0 && r.bad_size == 0;
+		// 段の時間は処理スレッド1本あたり。複数のスレッドが並行して処理するので、fps はその逆数より大きくなりうる
+		printf("%-6s %8llu %8llu %8.1f %14.3f %14.3f %6s\n", src.name, (unsigned long long)r.outputs, (unsigned long long)r.dropped, r.outputs / r.seconds, r.deinterlace.average_ms, r.scale.average_ms, ok ? "ok" : "FAILED");
+		if (!r.complete) {
+			fprintf(stderr, "%s: %llu of %d frames neither output nor dropped\n", src.name, (unsigned long long)(opts.frames - r.dropped - r.frames), opts.frames);
+		}
+		if (r.out_of_order > 0) {
+			fprintf(stderr, "%s: %llu frame(s) out of order\n", src.name, (unsigned long long)r.out_of_order);
+		}
+		if (r.bad_size > 0) {
+			fprintf(stderr, "%s: %llu frame(s) with a wrong preview size\n", src.name, (unsigned long long)r.bad_size);
+		}
+		if (!ok) {
+			failures++;
+		}
+	}
+
+	printf("\n%-6s %-7s %10s %10s %8s\n", "source", "format", "fresh ms", "cached ms", "speedup");
+	for (SourceCase const &src : SOURCES) {
+		const Image uyvy = make_image(src.width, src.height, 0);
+		for (ScaleCase const &sc : SCALE_FORMATS) {
+			const Image image = uyvy.convertToFormat(sc.format);
+			const double fresh = time_scale(opts, image, false);
+			const double cached = time_scale(opts, image, true);
+			printf("%-6s %-7s %10.3f %10.3f %7.2fx\n", src.name, sc.name, fresh, cached, fresh / cached);
+		}
+	}
+
+	if (failures > 0) {
+		return 1;
+	}
+	return 0;
+}
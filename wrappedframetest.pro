@@ -0,0 +1,25 @@
+QT += core
+TEMPLATE = app
+TARGET = wrappedframetest
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+DESTDIR = $$PWD/_bin
+
+INCLUDEPATH += $$PWD
+
+linux:QMAKE_CXXFLAGS += -fopenmp
+linux:QMAKE_LFLAGS += -fopenmp
+gcc:QMAKE_CXXFLAGS += -Wno-switch
+
+SOURCES += \
+	wrappedframetest/main.cpp \
+	FramePool.cpp \
+	Image.cpp \
+	ImageKernels.cpp
+
+HEADERS += \
+	FramePool.h \
+	Image.h \
+	ImageKernels.h \
+	WrappedFrame.h
@@ -0,0 +1,186 @@
+// 入力フレームを参照する Image (WrappedFrame) の寿命と複製の動作を確かめる
+// 装置の代わりに AddRef/Release を数える偽のフレームを使う。失敗があれば終了コード 1
+
+#include "../WrappedFrame.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// IDeckLinkVideoInputFrame の代わり。参照カウントが 0 になったら released を立てる
+struct FakeFrame {
+	static const int W = 64;
+	static const int H = 8;
+	static const int STRIDE = W * 2 + 16;
+	std::vector<uint8_t> buffer;
+	std::atomic_int refs = 1;
+	std::atomic_int release_calls = 0;
+	std::atomic_bool released = false;
+
+	FakeFrame()
+		: buffer(STRIDE * H)
+	{
+		for (size_t i = 0; i < buffer.size(); i++) {
+			buffer[i] = uint8_t(i * 7 + 3);
+		}
+	}
+	void AddRef()
+	{
+		refs++;
+	}
+	void Release()
+	{
+		release_calls++;
+		if (--refs == 0) {
+			released = true;
+		}
+	}
+	Image wrap()
+	{
+		return WrappedFrame<FakeFrame>::wrap(this, W, H, Image::Format::UYVY8, STRIDE, buffer.data());
+	}
+};
+
+int failures = 0;
+
+void check(bool ok, char const *what)
+{
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+bool same_pixels(Image const &a, Image const &b)
+{
+	if (a.width() != b.width() || a.height() != b.height() || a.format() != b.format()) return false;
+	for (int y = 0; y < a.height(); y++) {
+		if (memcmp(a.scanLine(y), b.scanLine(y), a.width() * a.bytesPerPixel()) != 0) return false;
+	}
+	return true;
+}
+
+// 参照は最後の Image が解放されるまでフレームを保持する
+void test_lifetime()
+{
+	FakeFrame frame;
+	Image copy;
+	{
+		Image image = frame.wrap();
+		check(image && image.isExternal(), "wrap returns an external image");
+		check(std::as_const(image).bits() == frame.buffer.data(), "wrapped image shares the frame buffer");
+		check(frame.refs == 2, "wrap adds a reference");
+		copy = image;
+		// 装置がフレームを手放しても、Image が残っている間は解放されない
+		frame.Release();
+		check(!frame.released, "frame outlives the capture callback");
+	}
+	check(!frame.released, "copy keeps the frame alive");
+	check(std::as_const(copy).scanLine(1) == frame.buffer.data() + FakeFrame::STRIDE, "copy uses the frame stride");
+	copy = Image();
+	check(frame.released, "frame is released with the last image");
+	check(frame.release_calls == 2, "release callback is called exactly once");
+	check(WrappedFrame<FakeFrame>::count() == 0, "wrapped frame count returns to zero");
+}
+
+// 書き込むと自前のバッファに複製され、フレームはすぐに解放される
+void test_copy_on_write()
+{
+	FakeFrame frame;
+	std::vector<uint8_t> original = frame.buffer;
+	Image image = frame.wrap();
+	Image shared = image;
+	frame.Release();
+
+	uint8_t *p = image.scanLine(0);
+	check(p != frame.buffer.data(), "write access detaches from the frame buffer");
+	check(!image.isExternal(), "detached image owns its pixels");
+	check(same_pixels(image, shared), "detached image has the same pixels");
+	p[0] = ~p[0];
+	check(frame.buffer == original, "writing the detached image leaves the frame untouched");
+	check(!frame.released, "other reference still holds the frame");
+
+	uint8_t *q = shared.scanLine(0);
+	check(q != frame.buffer.data(), "last reference also detaches");
+	check(frame.released, "frame is released once nothing refers to it");
+	check(frame.release_calls == 2, "release callback is called exactly once after detach");
+	check(WrappedFrame<FakeFrame>::count() == 0, "wrapped frame count returns to zero after detach");
+}
+
+// 上限を超えると空の Image を返し、AddRef しない
+void test_limit()
+{
+	const int n = WrappedFrame<FakeFrame>::MAX_WRAPPED_FRAMES;
+	std::vector<FakeFrame> frames(n + 1);
+	std::vector<Image> images;
+	for (int i = 0; i < n; i++) {
+		images.push_back(frames[i].wrap());
+		check(images.back(), "wrap succeeds below the limit");
+	}
+	Image over = frames[n].wrap();
+	check(!over, "wrap fails at the limit");
+	check(frames[n].refs == 1, "failed wrap does not add a reference");
+	check(WrappedFrame<FakeFrame>::count() == n, "failed wrap does not change the count");
+	images.pop_back();
+	check(frames[n].wrap(), "wrap succeeds again after a release");
+	images.clear();
+	check(WrappedFrame<FakeFrame>::count() == 0, "count is zero after releasing all");
+}
+
+// 複数のスレッドから同時に参照を作っても上限を超えない
+void test_race()
+{
+	const int threads = std::max(4u, std::thread::hardware_concurrency());
+	const int n = WrappedFrame<FakeFrame>::MAX_WRAPPED_FRAMES;
+	std::vector<FakeFrame> frames(threads);
+	std::atomic_int alive = 0;
+	std::atomic_int max_alive = 0;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t](){
+			std::vector<Image> held;
+			for (int i = 0; i < 20000; i++) {
+				Image image = frames[t].wrap();
+				if (image) {
+					const int k = ++alive;
+					int m = max_alive;
+					while (k > m && !max_alive.compare_exchange_weak(m, k));
+					held.push_back(image);
+				}
+				if (held.size() > 3 || (!image && !held.empty())) {
+					alive -= (int)held.size();
+					held.clear();
+				}
+			}
+			alive -= (int)held.size();
+		});
+	}
+	for (std::thread &t : workers) {
+		t.join();
+	}
+	check(max_alive <= n, "concurrent wraps never exceed the limit");
+	check(WrappedFrame<FakeFrame>::count() == 0, "count is zero after the race");
+	for (FakeFrame &f : frames) {
+		check(f.refs == 1, "every wrap is matched by a release");
+	}
+}
+
+} // namespace
+
+int main()
+{
+	test_lifetime();
+	test_copy_on_write();
+	test_limit();
+	test_race();
+	if (failures > 0) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}